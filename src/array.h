@@ -32,12 +32,17 @@ void array_unordered_remove_by_index_(void *data, s64 *count, u64 unit_size, s64
      (ARRAY))
 
 #define Add(ARRAY) \
-    ((ARRAY)->data = maybe_grow_array((ARRAY)->data, &(ARRAY)->limit, (ARRAY)->count, sizeof((ARRAY)->data[0]), (ARRAY)->context), \
+    (EnterAllocSite(), \
+     (ARRAY)->data = maybe_grow_array((ARRAY)->data, &(ARRAY)->limit, (ARRAY)->count, sizeof((ARRAY)->data[0]), (ARRAY)->context), \
      (ARRAY)->count += 1, \
+     LeaveAllocSite(), \
      &(ARRAY)->data[(ARRAY)->count-1])
 
 #define array_reserve(ARRAY, LIMIT) \
-    ((ARRAY)->data = array_reserve_((ARRAY)->data, &(ARRAY)->limit, (LIMIT), sizeof((ARRAY)->data[0]), (ARRAY)->context))
+    (EnterAllocSite(), \
+     (ARRAY)->data = array_reserve_((ARRAY)->data, &(ARRAY)->limit, (LIMIT), sizeof((ARRAY)->data[0]), (ARRAY)->context), \
+     LeaveAllocSite(), \
+     (ARRAY)->data)
 
 #define reverse_array(ARRAY) \
     (reverse_array_((ARRAY)->data, (ARRAY)->limit, (ARRAY)->count, sizeof((ARRAY)->data[0]), (ARRAY)->context))
@@ -1,7 +1,17 @@
+#define _POSIX_C_SOURCE 200809L // For clock_gettime().
+
 #include <stdarg.h>
 
 #include "basic.h"
 
+#if OS == WINDOWS
+  #include <windows.h>
+#else
+  #include <sched.h>
+  #include <time.h>
+  #include <unistd.h>
+#endif
+
 bool is_power_of_two(s64 x)
 {
     if (x <= 0)  return false;
@@ -28,6 +38,47 @@ s64 round_up_pow2(s64 x)
     return x + 1;
 }
 
+u64 get_time_ns(void)
+// Return the time in nanoseconds from some arbitrary starting point. Only use it to measure durations.
+{
+#if OS == WINDOWS
+    static LARGE_INTEGER frequency;
+    if (!frequency.QuadPart)  QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    return (u64)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (u64)t.tv_sec*1000000000 + (u64)t.tv_nsec;
+#endif
+}
+
+void yield_thread(void)
+// Let another thread have the CPU.
+{
+#if OS == WINDOWS
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+s64 get_cpu_count(void)
+// Return how many CPUs are online.
+{
+#if OS == WINDOWS
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    return sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
 void log_error_(char *file, int line, char *format, ...)
 {
     fprintf(stderr, "%s:%d: ", file, line);
@@ -19,6 +19,12 @@
   #error "We couldn't identify the operating system."
 #endif
 
+#if OS == WINDOWS
+  #define thread_local  __declspec(thread)
+#else
+  #define thread_local  __thread
+#endif
+
 typedef  uint8_t  u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
@@ -30,6 +36,16 @@ typedef  int64_t s64;
 
 s64 round_up_pow2(s64 num);
 bool is_power_of_two(s64 num);
+
+static inline u64 align_to_16(u64 size)
+// Round up to a multiple of 16.
+{
+    return (size + 15) & ~(u64)15;
+}
+
+u64 get_time_ns(void);
+void yield_thread(void);
+s64 get_cpu_count(void);
 void log_error_(char *file, int line, char *format, ...);
 
 #define log_error(...)  log_error_(__FILE__, __LINE__, __VA_ARGS__)
@@ -53,6 +69,40 @@ void log_error_(char *file, int line, char *format, ...);
 
 #define Fatal(...)  (log_error("Fatal error: " __VA_ARGS__), Breakpoint(), exit(1))
 
+// Sequentially consistent atomic operations on 32- and 64-bit integers. AtomicCompareSwap() and AtomicAdd() return the old value.
+#if defined(_MSC_VER)
+  #include <intrin.h>
+  #define AtomicCompareSwap(P, OLD, NEW)  (sizeof(*(P)) == 8 ? (u64)_InterlockedCompareExchange64((volatile long long *)(P), (long long)(NEW), (long long)(OLD)) \
+                                                             : (u32)_InterlockedCompareExchange((volatile long *)(P), (long)(NEW), (long)(OLD)))
+  #define AtomicExchange(P, VAL)          (sizeof(*(P)) == 8 ? (u64)_InterlockedExchange64((volatile long long *)(P), (long long)(VAL)) \
+                                                             : (u32)_InterlockedExchange((volatile long *)(P), (long)(VAL)))
+  #define AtomicAdd(P, VAL)               (sizeof(*(P)) == 8 ? (u64)_InterlockedExchangeAdd64((volatile long long *)(P), (long long)(VAL)) \
+                                                             : (u32)_InterlockedExchangeAdd((volatile long *)(P), (long)(VAL)))
+  #define AtomicLoad(P)                   AtomicAdd((P), 0)
+  #define AtomicStore(P, VAL)             ((void)AtomicExchange((P), (VAL)))
+  #define CpuRelax()                      _mm_pause()
+  #define AtomicFence()                   _mm_mfence()
+#else
+  #define AtomicCompareSwap(P, OLD, NEW)  __sync_val_compare_and_swap((P), (OLD), (NEW))
+  #define AtomicExchange(P, VAL)          __atomic_exchange_n((P), (VAL), __ATOMIC_SEQ_CST)
+  #define AtomicAdd(P, VAL)               __atomic_fetch_add((P), (VAL), __ATOMIC_SEQ_CST)
+  #define AtomicLoad(P)                   __atomic_load_n((P), __ATOMIC_SEQ_CST)
+  #define AtomicStore(P, VAL)             __atomic_store_n((P), (VAL), __ATOMIC_SEQ_CST)
+  #define AtomicFence()                   __atomic_thread_fence(__ATOMIC_SEQ_CST)
+  #if defined(__x86_64__) || defined(__i386__)
+    #define CpuRelax()                    __builtin_ia32_pause()
+  #else
+    #define CpuRelax()                    ((void)0)
+  #endif
+#endif
+
+// Ask the CPU to start loading the cache line containing an address, because we're going to read it soon.
+#if defined(_MSC_VER)
+  #define Prefetch(ADDRESS)  _mm_prefetch((char const *)(ADDRESS), _MM_HINT_T0)
+#else
+  #define Prefetch(ADDRESS)  __builtin_prefetch(ADDRESS)
+#endif
+
 #define Min(A, B)  ((A) < (B) ? (A) : (B))
 #define Max(A, B)  ((A) > (B) ? (A) : (B))
 #define Clamp(MIN, VAL, MAX)  Min(Max(VAL, MIN), MAX)
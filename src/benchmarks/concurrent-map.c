@@ -0,0 +1,127 @@
+#include "../concurrent.h"
+#include "../array.h"
+
+//
+// Compare a ConcurrentMap against an ordinary Map behind a single lock, on a workload of 90% lookups and 10% writes
+// spread over a fixed set of keys. The numbers only say much about scaling on a machine with several CPUs.
+//
+
+enum {
+    NUM_KEYS       = 1 << 16,
+    OPS_PER_THREAD = 1 << 20,
+    NUM_SHARDS     = 64,
+};
+
+typedef ConcurrentMap(u64, u64) Bench_concurrent_map;
+typedef Map(u64, u64)           Bench_map;
+
+typedef struct Thread_args Thread_args;
+
+struct Thread_args {
+    Bench_concurrent_map *concurrent_map;
+    Bench_map            *locked_map;
+    Lock                 *lock;
+    u64                   random_state;
+    u64                   total;
+};
+
+static u64 next_random(u64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void *concurrent_routine(void *arg)
+{
+    Thread_args *args = arg;
+
+    for (s64 i = 0; i < OPS_PER_THREAD; i++) {
+        u64 r   = next_random(&args->random_state);
+        u64 key = r % NUM_KEYS;
+
+        if (r % 10 == 0) {
+            ConcurrentSet(args->concurrent_map, &key, &r);
+        } else {
+            u64 val;
+            if (ConcurrentGet(args->concurrent_map, &key, &val))  args->total += val;
+        }
+    }
+
+    return NULL;
+}
+
+static void *locked_routine(void *arg)
+{
+    Thread_args *args = arg;
+
+    for (s64 i = 0; i < OPS_PER_THREAD; i++) {
+        u64 r   = next_random(&args->random_state);
+        u64 key = r % NUM_KEYS;
+
+        acquire_lock(args->lock);
+        if (r % 10 == 0)  *Set(args->locked_map, key) = r;
+        else              args->total += *Get(args->locked_map, key);
+        release_lock(args->lock);
+    }
+
+    return NULL;
+}
+
+static void run(char *name, void *(*routine)(void *), int num_threads)
+{
+    Memory_context *ctx = new_context(NULL);
+
+    Bench_concurrent_map *concurrent_map = NewConcurrentMap(concurrent_map, NUM_SHARDS, ctx);
+    Bench_map            *locked_map     = NewMap(locked_map, ctx);
+
+    Lock lock;
+    init_lock(&lock, LOCK_ADAPTIVE);
+
+    for (u64 key = 0; key < NUM_KEYS; key++) {
+        ConcurrentSet(concurrent_map, &key, &key);
+        *Set(locked_map, key) = key;
+    }
+
+    Array(pthread_t)   threads = {.context = ctx};
+    Array(Thread_args) args    = {.context = ctx};
+
+    for (int i = 0; i < num_threads; i++) {
+        *Add(&args) = (Thread_args){concurrent_map, locked_map, &lock, 0x9e3779b97f4a7c15 * (i+1), 0};
+    }
+
+    u64 start = get_time_ns();
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(Add(&threads), NULL, routine, &args.data[i]))  Fatal("Failed to create a thread.");
+    }
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_join(threads.data[i], NULL))  Fatal("Failed to join a thread.");
+    }
+
+    u64 elapsed = get_time_ns() - start;
+
+    u64 total = 0;
+    for (int i = 0; i < num_threads; i++)  total += args.data[i].total;
+    if (total == 42)  printf("(Unlikely.)\n"); // Keep the compiler from skipping the lookups.
+
+    s64 total_ops = num_threads * OPS_PER_THREAD;
+
+    printf("%-10s %2d threads  %6.1f ns/op  %7.1f Mops/s\n", name, num_threads,
+           (double)elapsed/total_ops, 1000.0*total_ops/elapsed);
+
+    free_context(ctx);
+}
+
+int main()
+{
+    int thread_counts[] = {1, 2, 4, 8};
+
+    for (int i = 0; i < countof(thread_counts); i++) {
+        run("locked",     locked_routine,     thread_counts[i]);
+        run("concurrent", concurrent_routine, thread_counts[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "../array.h"
+
+//
+// Compare the two kinds of lock on contended workloads. In each one, a number of threads share a single context.
+//
+//   alloc      Like tests/context-threads.c. Threads allocate from and deallocate to the context, freeing their own
+//              allocations in FIFO order so the context doesn't grow forever. The lock is only held for a moment, so
+//              it's rarely contended.
+//   hold       Threads hold the context's lock for about HOLD_NS nanoseconds of work, then do a little work outside
+//              it. With more than one CPU, nearly every acquisition is contended and a waiter is usually let in
+//              within the time an adaptive lock spins for.
+//   preempted  Threads yield the CPU while holding the lock, as if the holder had been preempted. Every other
+//              thread that runs has to wait for it, even on one CPU.
+//
+
+typedef struct Thread_args Thread_args;
+
+typedef enum {
+    WORKLOAD_ALLOC,
+    WORKLOAD_HOLD,
+    WORKLOAD_PREEMPTED,
+} Workload;
+
+enum {
+    HOLD_NS    = 500,
+    OUTSIDE_NS = 100,
+};
+
+struct Thread_args {
+    Memory_context *context;
+    Workload        workload;
+    u64             random_state;
+    s64             num_ops;
+};
+
+static u64 next_random(u64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void busy_wait(u64 ns)
+{
+    u64 end = get_time_ns() + ns;
+    while (get_time_ns() < end)  CpuRelax();
+}
+
+static void *thread_routine(void *arg)
+{
+    Thread_args *args = arg;
+
+    if (args->workload != WORKLOAD_ALLOC) {
+        for (s64 i = 0; i < args->num_ops; i++) {
+            lock_context(args->context);
+            if (args->workload == WORKLOAD_HOLD)  busy_wait(HOLD_NS);
+            else                                  yield_thread();
+            unlock_context(args->context);
+
+            busy_wait(OUTSIDE_NS);
+        }
+
+        return NULL;
+    }
+
+    enum {NUM_LIVE = 64};
+    void *live[NUM_LIVE] = {0};
+
+    for (s64 i = 0; i < args->num_ops; i++) {
+        void **slot = &live[i % NUM_LIVE];
+        if (*slot)  dealloc(*slot, args->context);
+
+        s64 size = next_random(&args->random_state) % 200 + 1;
+        *slot = alloc(size, 1, args->context);
+    }
+
+    for (int i = 0; i < NUM_LIVE; i++) {
+        if (live[i])  dealloc(live[i], args->context);
+    }
+
+    return NULL;
+}
+
+static void run(Workload workload, Lock_kind kind, int num_threads, s64 ops_per_thread)
+{
+    Memory_context *top = new_context(NULL);
+    Memory_context *ctx = new_context(top);
+    set_context_lock_kind(ctx, kind);
+
+    Array(pthread_t)   threads = {.context = top};
+    Array(Thread_args) args    = {.context = top};
+
+    for (int i = 0; i < num_threads; i++) {
+        *Add(&args) = (Thread_args){.context = ctx, .workload = workload, .random_state = 0x9e3779b97f4a7c15 * (i+1), .num_ops = ops_per_thread};
+    }
+
+    u64 start = get_time_ns();
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(Add(&threads), NULL, thread_routine, &args.data[i]))  Fatal("Failed to create a thread.");
+    }
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_join(threads.data[i], NULL))  Fatal("Failed to join a thread.");
+    }
+
+    u64 elapsed = get_time_ns() - start;
+
+    Lock_stats stats = get_context_lock_stats(ctx);
+
+    s64 total_ops = num_threads * ops_per_thread;
+
+    char *workload_names[] = {"alloc", "hold", "preempted"};
+    char *kind_names[]     = {"mutex", "adaptive"};
+
+    printf("%-9s  %-8s  %2d threads  %7.1f ns/op  %7.3f%% contended  %10.1f ns average wait\n",
+           workload_names[workload], kind_names[kind], num_threads, (double)elapsed/total_ops,
+           100.0 * stats.num_contended / stats.num_acquisitions,
+           stats.num_contended ? (double)stats.wait_time/stats.num_contended : 0.0);
+
+    free_context(top);
+}
+
+int main()
+{
+    printf("%lld CPUs\n", (long long)get_cpu_count());
+
+    int thread_counts[] = {1, 2, 4, 12};
+
+    for (Workload workload = WORKLOAD_ALLOC; workload <= WORKLOAD_PREEMPTED; workload++) {
+        s64 ops_per_thread = (workload == WORKLOAD_ALLOC) ? 200000 : 20000;
+
+        for (int i = 0; i < countof(thread_counts); i++) {
+            run(workload, LOCK_MUTEX,    thread_counts[i], ops_per_thread);
+            run(workload, LOCK_ADAPTIVE, thread_counts[i], ops_per_thread);
+        }
+    }
+
+    return 0;
+}
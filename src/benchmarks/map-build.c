@@ -0,0 +1,76 @@
+#include "../map.h"
+
+//
+// Compare ways of filling a map whose final size we know: calling Set() for each key, calling MapReserve() first, and
+// MapBuildFromArrays().
+//
+
+enum {
+    NUM_KEYS   = 1 << 20,
+    NUM_ROUNDS = 5,
+};
+
+static u64 next_random(u64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void print_result(char *name, u64 elapsed)
+{
+    printf("%-22s %6.1f ns/key\n", name, (double)elapsed/(NUM_ROUNDS*NUM_KEYS));
+}
+
+int main()
+{
+    Memory_context *ctx = new_context(NULL);
+
+    u64 *keys = New(NUM_KEYS, u64, ctx);
+    u64 *vals = New(NUM_KEYS, u64, ctx);
+
+    u64 state = 1;
+    for (s64 i = 0; i < NUM_KEYS; i++) {
+        keys[i] = next_random(&state);
+        vals[i] = i;
+    }
+
+    u64 set_time = 0, reserve_time = 0, build_time = 0;
+
+    for (int round = 0; round < NUM_ROUNDS; round++) {
+        Memory_context *round_ctx = new_context(ctx);
+
+        u64 start = get_time_ns();
+        {
+            Map(u64, u64) *map = NewMap(map, round_ctx);
+            for (s64 i = 0; i < NUM_KEYS; i++)  *Set(map, keys[i]) = vals[i];
+        }
+        set_time += get_time_ns() - start;
+
+        start = get_time_ns();
+        {
+            Map(u64, u64) *map = NewMap(map, round_ctx);
+            MapReserve(map, NUM_KEYS);
+            for (s64 i = 0; i < NUM_KEYS; i++)  *Set(map, keys[i]) = vals[i];
+        }
+        reserve_time += get_time_ns() - start;
+
+        start = get_time_ns();
+        {
+            Map(u64, u64) *map = NewMap(map, round_ctx);
+            MapBuildFromArrays(map, keys, vals, NUM_KEYS);
+        }
+        build_time += get_time_ns() - start;
+
+        free_context(round_ctx);
+    }
+
+    print_result("Set()", set_time);
+    print_result("MapReserve() + Set()", reserve_time);
+    print_result("MapBuildFromArrays()", build_time);
+
+    free_context(ctx);
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "../map.h"
+
+//
+// Compare a generic Map(u64, u32) with one made by DeclareMap(). We insert NUM_KEYS keys, look up random keys that are
+// in the map and random keys that aren't, then delete all the keys.
+//
+
+enum {
+    NUM_KEYS    = 1 << 20,
+    NUM_LOOKUPS = 1 << 22,
+};
+
+DeclareMap(Id_map, u64, u32, hash_int, IntsEqual)
+
+static u64 next_random(u64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Even keys go in the map. Odd keys don't.
+static u64 get_key(u64 n)  { return n * 0x2545f4914f6cdd1d; }
+
+static void print_result(char *name, char *kind, u64 elapsed, s64 num_ops)
+{
+    printf("%-8s %-8s %6.1f ns/op\n", name, kind, (double)elapsed/num_ops);
+}
+
+static void benchmark_generic(void)
+{
+    Memory_context *ctx = new_context(NULL);
+
+    Map(u64, u32) *map = NewMap(map, ctx);
+
+    u64 start = get_time_ns();
+    for (s64 n = 0; n < NUM_KEYS; n++)  *Set(map, get_key(2*n)) = n;
+    print_result("generic", "inserts", get_time_ns() - start, NUM_KEYS);
+
+    u64 state = 1;
+    u64 total = 0;
+
+    start = get_time_ns();
+    for (s64 i = 0; i < NUM_LOOKUPS; i++)  total += *Get(map, get_key(2*(next_random(&state) % NUM_KEYS)));
+    print_result("generic", "hits", get_time_ns() - start, NUM_LOOKUPS);
+
+    start = get_time_ns();
+    for (s64 i = 0; i < NUM_LOOKUPS; i++)  total += *Get(map, get_key(2*(next_random(&state) % NUM_KEYS) + 1));
+    print_result("generic", "misses", get_time_ns() - start, NUM_LOOKUPS);
+
+    start = get_time_ns();
+    for (s64 n = 0; n < NUM_KEYS; n++)  Delete(map, get_key(2*n));
+    print_result("generic", "deletes", get_time_ns() - start, NUM_KEYS);
+
+    if (total == 42)  printf("(Unlikely.)\n"); // Keep the compiler from skipping the lookups.
+
+    free_context(ctx);
+}
+
+static void benchmark_declared(void)
+{
+    Memory_context *ctx = new_context(NULL);
+
+    Id_map map = {.context = ctx, .binary_mode = true};
+
+    u64 start = get_time_ns();
+    for (s64 n = 0; n < NUM_KEYS; n++)  *Id_map_set(&map, get_key(2*n)) = n;
+    print_result("declared", "inserts", get_time_ns() - start, NUM_KEYS);
+
+    u64 state = 1;
+    u64 total = 0;
+
+    start = get_time_ns();
+    for (s64 i = 0; i < NUM_LOOKUPS; i++)  total += *Id_map_get(&map, get_key(2*(next_random(&state) % NUM_KEYS)));
+    print_result("declared", "hits", get_time_ns() - start, NUM_LOOKUPS);
+
+    start = get_time_ns();
+    for (s64 i = 0; i < NUM_LOOKUPS; i++)  total += *Id_map_get(&map, get_key(2*(next_random(&state) % NUM_KEYS) + 1));
+    print_result("declared", "misses", get_time_ns() - start, NUM_LOOKUPS);
+
+    start = get_time_ns();
+    for (s64 n = 0; n < NUM_KEYS; n++)  Id_map_delete(&map, get_key(2*n));
+    print_result("declared", "deletes", get_time_ns() - start, NUM_KEYS);
+
+    if (total == 42)  printf("(Unlikely.)\n");
+
+    free_context(ctx);
+}
+
+int main()
+{
+    benchmark_generic();
+    benchmark_declared();
+
+    return 0;
+}
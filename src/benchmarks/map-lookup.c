@@ -0,0 +1,133 @@
+#include "../map.h"
+
+//
+// Measure map lookup throughput for a few typical key sizes. For each size we fill a map with NUM_KEYS keys, then look
+// up random keys that are in the map (hits) and random keys that aren't (misses). We also try the strings with a Bloom
+// filter, which should make the misses cheaper.
+//
+
+enum {
+    NUM_KEYS    = 1 << 18,
+    NUM_LOOKUPS = 1 << 22,
+};
+
+typedef struct {u64 words[2];} Key16;
+typedef struct {u64 words[4];} Key32;
+typedef struct {u64 words[8];} Key64;
+
+static u64 next_random(u64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void make_key(void *key, u64 key_size, u64 n)
+// Fill a key with bytes that depend on n. Odd n give keys that we don't put in the map.
+{
+    u64 state = 0x9e3779b97f4a7c15 * (n+1);
+
+    for (u64 i = 0; i < key_size; i += sizeof(u64)) {
+        u64 word = next_random(&state);
+        memcpy((u8 *)key + i, &word, Min(sizeof(u64), key_size - i));
+    }
+}
+
+static void print_result(char *name, char *kind, u64 elapsed)
+{
+    printf("%-10s %-7s %6.1f ns/lookup\n", name, kind, (double)elapsed/NUM_LOOKUPS);
+}
+
+#define DefineBenchmark(KEY_TYPE)                                                  \
+    static void benchmark_##KEY_TYPE(char *name)                                   \
+    {                                                                              \
+        Memory_context *ctx = new_context(NULL);                                   \
+                                                                                   \
+        KEY_TYPE *keys = New(2*NUM_KEYS, KEY_TYPE, ctx);                           \
+        for (s64 n = 0; n < 2*NUM_KEYS; n++)  make_key(&keys[n], sizeof(KEY_TYPE), n); \
+                                                                                   \
+        Map(KEY_TYPE, s64) *map = NewMap(map, ctx);                                \
+        for (s64 n = 0; n < 2*NUM_KEYS; n += 2)  *Set(map, keys[n]) = n;           \
+                                                                                   \
+        u64 state = 1;                                                             \
+        s64 total = 0;                                                             \
+                                                                                   \
+        u64 start = get_time_ns();                                                 \
+        for (s64 i = 0; i < NUM_LOOKUPS; i++) {                                    \
+            s64 n = 2*(next_random(&state) % NUM_KEYS);                            \
+            total += *Get(map, keys[n]);                                           \
+        }                                                                          \
+        print_result(name, "hits", get_time_ns() - start);                         \
+                                                                                   \
+        start = get_time_ns();                                                     \
+        for (s64 i = 0; i < NUM_LOOKUPS; i++) {                                    \
+            s64 n = 2*(next_random(&state) % NUM_KEYS) + 1;                        \
+            total += *Get(map, keys[n]);                                           \
+        }                                                                          \
+        print_result(name, "misses", get_time_ns() - start);                       \
+                                                                                   \
+        if (total == 42)  printf("(Unlikely.)\n"); /* Keep the compiler from skipping the lookups. */ \
+                                                                                   \
+        free_context(ctx);                                                         \
+    }
+
+DefineBenchmark(u32)
+DefineBenchmark(u64)
+DefineBenchmark(Key16)
+DefineBenchmark(Key32)
+DefineBenchmark(Key64)
+
+static void benchmark_strings(char *name, s64 bloom_bits_per_key)
+{
+    Memory_context *ctx = new_context(NULL);
+
+    // Make keys of between 8 and 40 characters.
+    char **keys = New(2*NUM_KEYS, char *, ctx);
+    for (s64 n = 0; n < 2*NUM_KEYS; n++) {
+        u64 state  = 0x9e3779b97f4a7c15 * (n+1);
+        s64 length = 8 + next_random(&state) % 33;
+
+        keys[n] = alloc(length+1, sizeof(char), ctx);
+        for (s64 i = 0; i < length; i++)  keys[n][i] = 'a' + next_random(&state) % 26;
+        keys[n][length] = '\0';
+    }
+
+    Dict(s64) *dict = NewDict(dict, ctx);
+    dict->bloom_bits_per_key = bloom_bits_per_key;
+    for (s64 n = 0; n < 2*NUM_KEYS; n += 2)  *Set(dict, keys[n]) = n;
+
+    u64 state = 1;
+    s64 total = 0;
+
+    u64 start = get_time_ns();
+    for (s64 i = 0; i < NUM_LOOKUPS; i++) {
+        s64 n = 2*(next_random(&state) % NUM_KEYS);
+        total += *Get(dict, keys[n]);
+    }
+    print_result(name, "hits", get_time_ns() - start);
+
+    start = get_time_ns();
+    for (s64 i = 0; i < NUM_LOOKUPS; i++) {
+        s64 n = 2*(next_random(&state) % NUM_KEYS) + 1;
+        total += *Get(dict, keys[n]);
+    }
+    print_result(name, "misses", get_time_ns() - start);
+
+    if (total == 42)  printf("(Unlikely.)\n");
+
+    free_context(ctx);
+}
+
+int main()
+{
+    benchmark_u32("4 bytes");
+    benchmark_u64("8 bytes");
+    benchmark_Key16("16 bytes");
+    benchmark_Key32("32 bytes");
+    benchmark_Key64("64 bytes");
+    benchmark_strings("strings", 0);
+    benchmark_strings("+ bloom", 10);
+
+    return 0;
+}
@@ -0,0 +1,419 @@
+#include "btree.h"
+
+//
+// A node is a Btree_node header followed by its keys, then its values (for a leaf) or children (for an inner node),
+// each part starting on a 16-byte boundary. We make the arrays one item longer than the node's capacity. That way we
+// can insert into a full node as normal and split it afterwards, instead of working out which half the new item goes in
+// before we split.
+//
+#define MIN_CAPACITY  4
+
+static u64 get_keys_offset(void)
+{
+    return align_to_16(sizeof(Btree_node));
+}
+
+static u64 get_leaf_size(s64 capacity, u64 key_size, u64 val_size)
+{
+    return get_keys_offset() + align_to_16((capacity+1)*key_size) + align_to_16((capacity+1)*val_size);
+}
+
+static u64 get_inner_size(s64 capacity, u64 key_size)
+{
+    return get_keys_offset() + align_to_16((capacity+1)*key_size) + align_to_16((capacity+2)*sizeof(Btree_node *));
+}
+
+static void *get_key(Btree_node *node, u64 key_size, s64 index)
+{
+    return (u8 *)node + get_keys_offset() + index*key_size;
+}
+
+static void *get_val(Any_btree *tree, Btree_node *leaf, u64 key_size, u64 val_size, s64 index)
+{
+    return (u8 *)leaf + get_keys_offset() + align_to_16((tree->leaf_capacity+1)*key_size) + index*val_size;
+}
+
+static Btree_node **get_children(Any_btree *tree, Btree_node *node, u64 key_size)
+{
+    return (Btree_node **)((u8 *)node + get_keys_offset() + align_to_16((tree->inner_capacity+1)*key_size));
+}
+
+static Btree_node *new_node(Any_btree *tree, u64 key_size, u64 val_size, bool is_leaf)
+{
+    u64 size = is_leaf ? get_leaf_size(tree->leaf_capacity, key_size, val_size) : get_inner_size(tree->inner_capacity, key_size);
+
+    Btree_node *node = alloc(size/16, 16, tree->context);
+    node->count   = 0;
+    node->is_leaf = is_leaf;
+    node->next    = NULL;
+
+    return node;
+}
+
+void init_btree_if_needed(Any_btree *tree, u64 key_size, u64 val_size)
+// Work out how many keys fit in a node, make the storage for .key and .default_val, and make an empty leaf for the root.
+{
+    if (tree->root)  return;
+
+    assert(tree->context && tree->compare);
+
+    s64 leaf_capacity = MIN_CAPACITY;
+    while (get_leaf_size(leaf_capacity+1, key_size, val_size) <= BTREE_NODE_SIZE)  leaf_capacity += 1;
+
+    s64 inner_capacity = MIN_CAPACITY;
+    while (get_inner_size(inner_capacity+1, key_size) <= BTREE_NODE_SIZE)  inner_capacity += 1;
+
+    tree->leaf_capacity  = leaf_capacity;
+    tree->inner_capacity = inner_capacity;
+
+    u8 *storage = zero_alloc((align_to_16(key_size) + align_to_16(val_size))/16, 16, tree->context);
+    tree->key         = storage;
+    tree->default_val = storage + align_to_16(key_size);
+
+    tree->root   = new_node(tree, key_size, val_size, true);
+    tree->height = 1;
+}
+
+static s64 lower_bound(Any_btree *tree, Btree_node *node, u64 key_size, void *key)
+// Return the index of the first key in the node that's not less than the given key, or node->count if there isn't one.
+//|Speed: For small integer keys a linear scan with the comparison inlined would beat calling tree->compare.
+{
+    s64 low  = 0;
+    s64 high = node->count;
+
+    while (low < high) {
+        s64 middle = (low + high)/2;
+
+        if (tree->compare(get_key(node, key_size, middle), key) < 0)  low = middle+1;
+        else                                                         high = middle;
+    }
+
+    return low;
+}
+
+static s64 upper_bound(Any_btree *tree, Btree_node *node, u64 key_size, void *key)
+// Return the index of the first key in the node that's greater than the given key. In an inner node, this is the index
+// of the child that holds the key.
+{
+    s64 low  = 0;
+    s64 high = node->count;
+
+    while (low < high) {
+        s64 middle = (low + high)/2;
+
+        if (tree->compare(get_key(node, key_size, middle), key) <= 0)  low = middle+1;
+        else                                                          high = middle;
+    }
+
+    return low;
+}
+
+static Btree_node *find_leaf(Any_btree *tree, u64 key_size, void *key)
+{
+    Btree_node *node = tree->root;
+
+    while (!node->is_leaf)  node = get_children(tree, node, key_size)[upper_bound(tree, node, key_size, key)];
+
+    return node;
+}
+
+void btree_get(Any_btree *tree, u64 key_size, u64 val_size)
+// Look up the key in tree->key and point tree->val at its value, or at the default value if it's not there.
+{
+    Btree_node *leaf = find_leaf(tree, key_size, tree->key);
+    s64         i    = lower_bound(tree, leaf, key_size, tree->key);
+
+    if (i < leaf->count && !tree->compare(get_key(leaf, key_size, i), tree->key)) {
+        tree->val = get_val(tree, leaf, key_size, val_size, i);
+    } else {
+        tree->val = tree->default_val;
+    }
+}
+
+static Btree_node *split_leaf(Any_btree *tree, Btree_node *leaf, u64 key_size, u64 val_size)
+// Move the top half of an overfull leaf into a new leaf that comes after it, and return the new leaf.
+{
+    Btree_node *right = new_node(tree, key_size, val_size, true);
+
+    s64 left_count  = leaf->count/2;
+    s64 right_count = leaf->count - left_count;
+
+    memcpy(get_key(right, key_size, 0), get_key(leaf, key_size, left_count), right_count*key_size);
+    memcpy(get_val(tree, right, key_size, val_size, 0), get_val(tree, leaf, key_size, val_size, left_count), right_count*val_size);
+
+    right->count = right_count;
+    leaf->count  = left_count;
+    right->next  = leaf->next;
+    leaf->next   = right;
+
+    return right;
+}
+
+static Btree_node *split_inner(Any_btree *tree, Btree_node *node, u64 key_size)
+// Move the top half of an overfull inner node into a new node and return the new node. The middle key goes up to the
+// parent. It stays in the left node's key array, just past its last key, until the caller copies it.
+{
+    Btree_node *right = new_node(tree, key_size, 0, false);
+
+    s64 middle      = node->count/2;
+    s64 right_count = node->count - middle - 1;
+
+    memcpy(get_key(right, key_size, 0), get_key(node, key_size, middle+1), right_count*key_size);
+    memcpy(get_children(tree, right, key_size), &get_children(tree, node, key_size)[middle+1], (right_count+1)*sizeof(Btree_node *));
+
+    right->count = right_count;
+    node->count  = middle;
+
+    return right;
+}
+
+static void insert_into_inner(Any_btree *tree, Btree_node *node, u64 key_size, s64 index, void *key, Btree_node *child)
+// Put the key at index and the child just after it, to the key's right.
+{
+    Btree_node **children = get_children(tree, node, key_size);
+
+    memmove(get_key(node, key_size, index+1), get_key(node, key_size, index), (node->count - index)*key_size);
+    memmove(&children[index+2], &children[index+1], (node->count - index)*sizeof(Btree_node *));
+
+    memcpy(get_key(node, key_size, index), key, key_size);
+    children[index+1] = child;
+    node->count += 1;
+}
+
+void btree_set(Any_btree *tree, u64 key_size, u64 val_size)
+// Add the key in tree->key if it isn't there already, with a zeroed value, and point tree->val at its value.
+{
+    // Find the leaf, remembering the way down so we can split nodes on the way back up.
+    Btree_node *path[64];
+    s64         path_indexes[64];
+
+    Btree_node *node = tree->root;
+    s64         depth = 0;
+
+    while (!node->is_leaf) {
+        s64 i = upper_bound(tree, node, key_size, tree->key);
+
+        assert(depth < countof(path));
+
+        path[depth]         = node;
+        path_indexes[depth] = i;
+        depth += 1;
+
+        node = get_children(tree, node, key_size)[i];
+    }
+
+    s64 i = lower_bound(tree, node, key_size, tree->key);
+
+    if (i < node->count && !tree->compare(get_key(node, key_size, i), tree->key)) {
+        tree->val = get_val(tree, node, key_size, val_size, i);
+        return;
+    }
+
+    // Insert the key and a zeroed value. There's always room for one more.
+    memmove(get_key(node, key_size, i+1), get_key(node, key_size, i), (node->count - i)*key_size);
+    memmove(get_val(tree, node, key_size, val_size, i+1), get_val(tree, node, key_size, val_size, i), (node->count - i)*val_size);
+
+    memcpy(get_key(node, key_size, i), tree->key, key_size);
+    memset(get_val(tree, node, key_size, val_size, i), 0, val_size);
+    node->count += 1;
+    tree->count += 1;
+
+    tree->val = get_val(tree, node, key_size, val_size, i);
+
+    if (node->count <= tree->leaf_capacity)  return;
+
+    // The leaf is overfull. Split it and add the new leaf's first key to the parent, splitting the parent if that makes
+    // it overfull, and so on up.
+    Btree_node *right = split_leaf(tree, node, key_size, val_size);
+    if (i >= node->count)  tree->val = get_val(tree, right, key_size, val_size, i - node->count);
+
+    void *separator = get_key(right, key_size, 0);
+
+    while (depth > 0) {
+        depth -= 1;
+        Btree_node *parent = path[depth];
+
+        insert_into_inner(tree, parent, key_size, path_indexes[depth], separator, right);
+        if (parent->count <= tree->inner_capacity)  return;
+
+        right     = split_inner(tree, parent, key_size);
+        separator = get_key(parent, key_size, parent->count);
+    }
+
+    // We split the root, so the tree gets a new root above it.
+    Btree_node *root = new_node(tree, key_size, 0, false);
+
+    memcpy(get_key(root, key_size, 0), separator, key_size);
+    get_children(tree, root, key_size)[0] = tree->root;
+    get_children(tree, root, key_size)[1] = right;
+    root->count = 1;
+
+    tree->root    = root;
+    tree->height += 1;
+}
+
+bool btree_delete(Any_btree *tree, u64 key_size, u64 val_size)
+// Remove the key in tree->key. Return true if it was there. We don't rebalance, so leaves can end up empty. That's
+// allowed everywhere else: lookups and cursors just move past them.
+{
+    Btree_node *leaf = find_leaf(tree, key_size, tree->key);
+    s64         i    = lower_bound(tree, leaf, key_size, tree->key);
+
+    if (i == leaf->count || tree->compare(get_key(leaf, key_size, i), tree->key))  return false;
+
+    memmove(get_key(leaf, key_size, i), get_key(leaf, key_size, i+1), (leaf->count - i - 1)*key_size);
+    memmove(get_val(tree, leaf, key_size, val_size, i), get_val(tree, leaf, key_size, val_size, i+1), (leaf->count - i - 1)*val_size);
+
+    leaf->count -= 1;
+    tree->count -= 1;
+
+    return true;
+}
+
+static void settle_cursor(Any_btree *tree, u64 key_size, u64 val_size, Any_btree_cursor *cursor)
+// If the cursor is past the end of its leaf, move it to the start of the next leaf that has any keys. Then point its key
+// and value at the current pair, or set them to NULL if there are no more.
+{
+    while (cursor->leaf && cursor->index >= cursor->leaf->count) {
+        cursor->leaf  = cursor->leaf->next;
+        cursor->index = 0;
+    }
+
+    if (cursor->leaf) {
+        cursor->key = get_key(cursor->leaf, key_size, cursor->index);
+        cursor->val = get_val(tree, cursor->leaf, key_size, val_size, cursor->index);
+    } else {
+        cursor->key = NULL;
+        cursor->val = NULL;
+    }
+}
+
+void btree_first(Any_btree *tree, u64 key_size, u64 val_size, Any_btree_cursor *cursor)
+{
+    Btree_node *node = tree->root;
+
+    while (!node->is_leaf)  node = get_children(tree, node, key_size)[0];
+
+    cursor->leaf  = node;
+    cursor->index = 0;
+
+    settle_cursor(tree, key_size, val_size, cursor);
+}
+
+void btree_lower_bound(Any_btree *tree, u64 key_size, u64 val_size, Any_btree_cursor *cursor)
+// Point the cursor at the first key that's not less than the key in tree->key.
+{
+    cursor->leaf  = find_leaf(tree, key_size, tree->key);
+    cursor->index = lower_bound(tree, cursor->leaf, key_size, tree->key);
+
+    settle_cursor(tree, key_size, val_size, cursor);
+}
+
+void btree_next(Any_btree *tree, u64 key_size, u64 val_size, Any_btree_cursor *cursor)
+{
+    if (!cursor->leaf)  return;
+
+    cursor->index += 1;
+
+    settle_cursor(tree, key_size, val_size, cursor);
+}
+
+void build_btree(Any_btree *tree, u64 key_size, u64 val_size, void *keys, void *vals, s64 count)
+// Build the tree bottom-up from sorted arrays of keys and values. We spread the keys evenly over as few leaves as will
+// hold them, then do the same with each level of inner nodes until there's only one node, which is the root.
+{
+    init_btree_if_needed(tree, key_size, val_size);
+    assert(tree->count == 0);
+
+    if (!count)  return;
+
+    for (s64 i = 1; i < count; i++)  assert(tree->compare((u8 *)keys + (i-1)*key_size, (u8 *)keys + i*key_size) < 0);
+
+    // Each level is an array of nodes, along with the smallest key under each one, which becomes a key in its parent.
+    Memory_context *tmp = new_context(tree->context);
+
+    s64          num_nodes = (count + tree->leaf_capacity-1)/tree->leaf_capacity;
+    Btree_node **nodes     = New(num_nodes, Btree_node *, tmp);
+    void       **min_keys  = New(num_nodes, void *, tmp);
+
+    dealloc(tree->root, tree->context);
+
+    {
+        s64 start = 0;
+        Btree_node *previous = NULL;
+
+        for (s64 n = 0; n < num_nodes; n++) {
+            s64 size = count/num_nodes + (n < count%num_nodes);
+
+            Btree_node *leaf = new_node(tree, key_size, val_size, true);
+            memcpy(get_key(leaf, key_size, 0), (u8 *)keys + start*key_size, size*key_size);
+            memcpy(get_val(tree, leaf, key_size, val_size, 0), (u8 *)vals + start*val_size, size*val_size);
+            leaf->count = size;
+
+            if (previous)  previous->next = leaf;
+            previous = leaf;
+
+            nodes[n]    = leaf;
+            min_keys[n] = get_key(leaf, key_size, 0);
+            start      += size;
+        }
+    }
+
+    s64 height = 1;
+
+    while (num_nodes > 1) {
+        s64 num_parents = (num_nodes + tree->inner_capacity)/(tree->inner_capacity+1);
+        s64 start       = 0;
+
+        for (s64 p = 0; p < num_parents; p++) {
+            s64 size = num_nodes/num_parents + (p < num_nodes%num_parents); // The number of children.
+
+            Btree_node  *parent   = new_node(tree, key_size, 0, false);
+            Btree_node **children = get_children(tree, parent, key_size);
+
+            for (s64 c = 0; c < size; c++) {
+                children[c] = nodes[start+c];
+                if (c > 0)  memcpy(get_key(parent, key_size, c-1), min_keys[start+c], key_size);
+            }
+            parent->count = size-1;
+
+            // We can reuse the arrays, since each parent comes before its children.
+            void *min_key = min_keys[start];
+            nodes[p]      = parent;
+            min_keys[p]   = min_key;
+            start        += size;
+        }
+
+        num_nodes = num_parents;
+        height   += 1;
+    }
+
+    tree->root   = nodes[0];
+    tree->height = height;
+    tree->count  = count;
+
+    free_context(tmp);
+}
+
+int compare_s64(const void *a, const void *b)
+{
+    s64 x = *(s64 *)a,  y = *(s64 *)b;
+    return (x > y) - (x < y);
+}
+
+int compare_u64(const void *a, const void *b)
+{
+    u64 x = *(u64 *)a,  y = *(u64 *)b;
+    return (x > y) - (x < y);
+}
+
+int compare_s32(const void *a, const void *b)
+{
+    s32 x = *(s32 *)a,  y = *(s32 *)b;
+    return (x > y) - (x < y);
+}
+
+int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(char **)a, *(char **)b);
+}
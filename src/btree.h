@@ -0,0 +1,158 @@
+#ifndef BTREE_H_INCLUDED
+#define BTREE_H_INCLUDED
+
+#include "context.h"
+
+//
+// A BTree is an ordered map: a B+tree whose keys are kept in sorted order by a comparison function, so that besides
+// looking keys up you can find the first key at or after a given one and walk through the keys in order from there.
+//
+//     BTree(s64, char *) *tree = NewBTree(tree, compare_s64, ctx);
+//     *BTreeSet(tree, 30) = "thirty";
+//     *BTreeSet(tree, 10) = "ten";
+//     *BTreeSet(tree, 20) = "twenty";
+//
+//     char *name = *BTreeGet(tree, 20);  // Like *Get(), this points to a zeroed default value if the key isn't there.
+//
+//     // Visit the keys from 15 up to but not including 30, in order.
+//     BTreeCursor(s64, char *) cursor;
+//     for (BTreeLowerBound(tree, 15, &cursor); cursor.key && *cursor.key < 30; BTreeNext(tree, &cursor)) {
+//         printf("%lld: %s\n", (long long)*cursor.key, *cursor.val);
+//     }
+//
+// The comparison function works like qsort()'s: it takes pointers to two keys and returns a negative number, zero or a
+// positive number. There are some for common key types below.
+//
+// All the key-value pairs are in the leaves, and each leaf points to the next, so a range scan is a walk along the
+// leaves. The inner nodes hold only keys, which we use to pick a child: child i holds the keys from key i-1 up to but
+// not including key i. Every node is about BTREE_NODE_SIZE bytes, a few cache lines, and a node keeps its keys together
+// in one array so that a search within a node reads as few cache lines as possible. The number of keys a node holds
+// depends on the sizes of the keys and values. Nodes are allocated from the tree's context.
+//
+// To build a tree from keys you already have in order, use BTreeBuildFromArrays(). It fills the leaves and builds the
+// inner nodes above them bottom-up, without any searching or splitting:
+//
+//     BTreeBuildFromArrays(tree, keys->data, vals->data, keys->count);
+//
+// BTreeDelete() removes a key from its leaf but doesn't merge nodes that get small. A tree that has had most of its keys
+// deleted will be bigger and slower than it needs to be until you rebuild it.
+//
+// The pointers from BTreeGet(), BTreeSet() and the cursors are only good until the next BTreeSet() or BTreeDelete(),
+// which can move the pairs around.
+//
+// .key and .val are used for temporary storage by the macros. .default_val points to the value *BTreeGet() returns if
+// the key isn't there.
+//
+
+#ifndef BTREE_NODE_SIZE
+#define BTREE_NODE_SIZE  512
+#endif
+
+typedef struct Btree_node Btree_node;
+
+struct Btree_node {
+    s32         count;   // The number of keys in the node.
+    bool        is_leaf;
+    Btree_node *next;    // For leaves, the next leaf in key order, or NULL. Inner nodes don't use this.
+    // The node's keys follow, and then its values if it's a leaf or its children if it isn't.
+};
+
+#define BTree(KEY_TYPE, VAL_TYPE)                         \
+    struct {                                              \
+        Btree_node     *root;                             \
+        s64             count;                            \
+        s64             height;                           \
+        s32             leaf_capacity;                    \
+        s32             inner_capacity;                   \
+        int           (*compare)(const void *, const void *); \
+        Memory_context *context;                          \
+        KEY_TYPE       *key;                              \
+        VAL_TYPE       *val;                              \
+        VAL_TYPE       *default_val;                      \
+    }
+
+#define BTreeCursor(KEY_TYPE, VAL_TYPE) \
+    struct {                            \
+        KEY_TYPE   *key;  /* NULL when the cursor has gone past the last key. */ \
+        VAL_TYPE   *val;                \
+        Btree_node *leaf;               \
+        s64         index;              \
+    }
+
+typedef BTree(void, void)       Any_btree;
+typedef BTreeCursor(void, void) Any_btree_cursor;
+
+void init_btree_if_needed(Any_btree *tree, u64 key_size, u64 val_size);
+void btree_get(Any_btree *tree, u64 key_size, u64 val_size);
+void btree_set(Any_btree *tree, u64 key_size, u64 val_size);
+bool btree_delete(Any_btree *tree, u64 key_size, u64 val_size);
+void btree_first(Any_btree *tree, u64 key_size, u64 val_size, Any_btree_cursor *cursor);
+void btree_lower_bound(Any_btree *tree, u64 key_size, u64 val_size, Any_btree_cursor *cursor);
+void btree_next(Any_btree *tree, u64 key_size, u64 val_size, Any_btree_cursor *cursor);
+void build_btree(Any_btree *tree, u64 key_size, u64 val_size, void *keys, void *vals, s64 count);
+
+int compare_s64(const void *a, const void *b);
+int compare_u64(const void *a, const void *b);
+int compare_s32(const void *a, const void *b);
+int compare_strings(const void *a, const void *b); // For char * keys.
+
+#define NewBTree(TREE, COMPARE, CONTEXT) \
+    ((TREE) = zero_alloc(1, sizeof(*TREE), (CONTEXT)), \
+     (TREE)->compare = (COMPARE), \
+     (TREE)->context = (CONTEXT), \
+     (TREE))
+
+#define BTreeGet(TREE, KEY) \
+    (EnterAllocSite(), \
+     init_btree_if_needed((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val)), \
+     LeaveAllocSite(), \
+     *(TREE)->key = (KEY), \
+     btree_get((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val)), \
+     (TREE)->val)
+
+#define BTreeIsSet(TREE, KEY) \
+    (BTreeGet((TREE), (KEY)) != (TREE)->default_val)
+
+#define BTreeSet(TREE, KEY) \
+    (EnterAllocSite(), \
+     init_btree_if_needed((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val)), \
+     *(TREE)->key = (KEY), \
+     btree_set((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val)), \
+     LeaveAllocSite(), \
+     (TREE)->val)
+
+#define BTreeDelete(TREE, KEY) \
+    (EnterAllocSite(), \
+     init_btree_if_needed((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val)), \
+     LeaveAllocSite(), \
+     *(TREE)->key = (KEY), \
+     btree_delete((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val)))
+
+// Point the cursor at the first key in the tree.
+#define BTreeFirst(TREE, CURSOR) \
+    (EnterAllocSite(), \
+     init_btree_if_needed((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val)), \
+     LeaveAllocSite(), \
+     (void)(1 ? (CURSOR)->key : (TREE)->key), (void)(1 ? (CURSOR)->val : (TREE)->val), \
+     btree_first((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val), (Any_btree_cursor *)(CURSOR)))
+
+// Point the cursor at the first key that's not less than KEY.
+#define BTreeLowerBound(TREE, KEY, CURSOR) \
+    (EnterAllocSite(), \
+     init_btree_if_needed((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val)), \
+     LeaveAllocSite(), \
+     *(TREE)->key = (KEY), \
+     (void)(1 ? (CURSOR)->key : (TREE)->key), (void)(1 ? (CURSOR)->val : (TREE)->val), \
+     btree_lower_bound((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val), (Any_btree_cursor *)(CURSOR)))
+
+#define BTreeNext(TREE, CURSOR) \
+    btree_next((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val), (Any_btree_cursor *)(CURSOR))
+
+// The tree must be empty, and the keys must be in strictly increasing order.
+#define BTreeBuildFromArrays(TREE, KEYS, VALS, COUNT) \
+    (EnterAllocSite(), \
+     build_btree((Any_btree *)(TREE), sizeof(*(TREE)->key), sizeof(*(TREE)->val), \
+                 (1 ? (KEYS) : (TREE)->key), (1 ? (VALS) : (TREE)->val), (COUNT)), \
+     LeaveAllocSite())
+
+#endif // BTREE_H_INCLUDED
@@ -0,0 +1,196 @@
+#include "concurrent.h"
+
+void init_concurrent_map(Any_concurrent_map *map, s64 num_shards, Memory_context *context, bool binary_mode, bool slice_mode)
+{
+    assert(num_shards > 0);
+
+    // Round the number of shards up to a power of two so we can pick a shard by masking the hash.
+    s64 n = 1;
+    while (n < num_shards)  n *= 2;
+
+    map->context    = new_context(context);
+    map->num_shards = n;
+    map->shards     = zero_alloc(n, sizeof(Map_shard), map->context);
+
+    for (s64 i = 0; i < n; i++) {
+        Map_shard *shard = &map->shards[i];
+
+        init_lock(&shard->lock, LOCK_ADAPTIVE);
+
+        // Each shard gets its own context so that writers to different shards don't contend for the allocator.
+        shard->map.context     = new_context(map->context);
+        shard->map.binary_mode = binary_mode;
+        shard->map.slice_mode  = slice_mode;
+    }
+}
+
+void free_concurrent_map(Any_concurrent_map *map)
+// Free everything but the struct itself. No other thread can be using the map.
+{
+    for (s64 i = 0; i < map->num_shards; i++)  destroy_lock(&map->shards[i].lock);
+
+    free_context(map->context);
+    *map = (Any_concurrent_map){0};
+}
+
+static Map_shard *get_shard(Any_concurrent_map *map, u64 hash)
+{
+    // The low bits of the hash pick the bucket and the top 7 bits are the control byte, so we take bits from the middle.
+    return &map->shards[(hash >> 32) & (map->num_shards-1)];
+}
+
+static void begin_write(Map_shard *shard)
+{
+    acquire_lock(&shard->lock);
+    AtomicAdd(&shard->sequence, 1);
+    AtomicFence(); // Make the odd sequence visible before our writes to the map, like smp_wmb() in write_seqcount_begin().
+}
+
+static void end_write(Map_shard *shard)
+{
+    AtomicAdd(&shard->sequence, 1);
+    release_lock(&shard->lock);
+}
+
+static bool read_failed(Map_shard *shard, u32 sequence)
+// Return true if a writer has touched the shard since we read its sequence number, in which case anything we've read
+// since then might be garbage.
+{
+    AtomicFence();
+    return AtomicLoad(&shard->sequence) != sequence;
+}
+
+enum Read_result {
+    READ_RETRY,
+    READ_FOUND,
+    READ_NOT_FOUND,
+};
+
+static enum Read_result try_read(Map_shard *shard, u64 key_size, u64 val_size, Probe_key *key, void *out_val)
+// Look for the key in the shard's map without taking the lock or writing to anything but *out_val.
+//
+// Everything we read from the map might be changing under us, so we never trust a value until we've checked that the
+// sequence number hasn't changed. We check it before following any pointer or index we've read, so that we only ever
+// touch memory that belonged to the map at some point. That memory stays mapped, as explained in concurrent.h.
+{
+    u32 sequence = AtomicLoad(&shard->sequence);
+    if (sequence & 1)  return READ_RETRY;
+
+    Any_map map = shard->map;
+    if (read_failed(shard, sequence))  return READ_RETRY;
+
+    if (!map.keys)  return READ_NOT_FOUND;
+
+    u64 mask        = map.num_buckets-1;
+    u8  hash_byte   = hash_to_ctrl(key->hash);
+    s64 group_start = key->hash & mask;
+    s64 num_groups  = map.num_buckets/GROUP_SIZE + 1;
+
+    // Since the table might be changing, we can't count on finding an empty bucket, so we limit the number of groups
+    // we check. If we get to the end, a writer must have been busy.
+    for (s64 g = 0; g < num_groups; g++) {
+        Ctrl_group group = load_group(&map.ctrl[group_start]);
+
+        for (u32 match = match_byte(group, hash_byte); match; match &= match-1) {
+            s64 bucket_index = (group_start + lowest_bit(match)) & mask;
+
+            if (!bucket_hash_matches(map.buckets, map.num_buckets, bucket_index, key->hash))  continue;
+
+            // The index might be garbage. map.limit includes the reserved pair at index -1.
+            s64 kv_index = get_bucket_kv_index(map.buckets, map.num_buckets, bucket_index);
+            if (kv_index < 0 || kv_index >= map.limit-1)  return READ_RETRY;
+
+            bool matched;
+            if (map.binary_mode) {
+                matched = !memcmp(key->data, (u8 *)map.keys + kv_index*key_size, key_size);
+            } else {
+                Key_info info = map.key_info[kv_index];
+                void    *data = (map.slice_mode) ? (void *)((Byte_slice *)map.keys)[kv_index].data : (void *)((char **)map.keys)[kv_index];
+
+                // Make sure the key pointer and length belong together before we read from the pointer.
+                if (read_failed(shard, sequence))  return READ_RETRY;
+
+                matched = info.length == key->length && !memcmp(key->data, data, key->length);
+            }
+
+            if (matched) {
+                memcpy(out_val, (u8 *)map.vals + kv_index*val_size, val_size);
+                return read_failed(shard, sequence) ? READ_RETRY : READ_FOUND;
+            }
+        }
+
+        if (match_empty(group))  return read_failed(shard, sequence) ? READ_RETRY : READ_NOT_FOUND;
+
+        group_start = (group_start + GROUP_SIZE) & mask;
+    }
+
+    return READ_RETRY;
+}
+
+bool concurrent_get(Any_concurrent_map *map, u64 key_size, u64 val_size, void *key, void *out_val)
+// Copy the key's value to *out_val and return true if the key is in the map. *out_val might be overwritten even if the
+// key isn't in the map.
+{
+    // Any shard's map will do for working out the kind of key.
+    Probe_key probe = get_probe_key(&map->shards[0].map, key_size, key);
+
+    Map_shard *shard = get_shard(map, probe.hash);
+
+    // If a writer keeps getting in the way (maybe because it's been descheduled in the middle of a change), we give up
+    // on reading optimistically and take the lock. Holding the lock, our read can't fail.
+    s64 MAX_ATTEMPTS = 64;
+
+    for (s64 attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+        enum Read_result result = try_read(shard, key_size, val_size, &probe, out_val);
+        if (result != READ_RETRY)  return result == READ_FOUND;
+
+        CpuRelax();
+    }
+
+    acquire_lock(&shard->lock);
+    enum Read_result result = try_read(shard, key_size, val_size, &probe, out_val);
+    release_lock(&shard->lock);
+
+    assert(result != READ_RETRY);
+
+    return result == READ_FOUND;
+}
+
+void concurrent_set(Any_concurrent_map *map, u64 key_size, u64 val_size, void *key, void *val)
+{
+    Probe_key probe = get_probe_key(&map->shards[0].map, key_size, key);
+
+    Map_shard *shard = get_shard(map, probe.hash);
+    Any_map   *m     = &shard->map;
+
+    begin_write(shard);
+
+    grow_map_if_needed(m, key_size, val_size);
+    memcpy((u8 *)m->keys - key_size, key, key_size);
+
+    s64 kv_index = set_key(m, key_size);
+    memcpy((u8 *)m->vals + kv_index*val_size, val, val_size);
+
+    end_write(shard);
+}
+
+bool concurrent_delete(Any_concurrent_map *map, u64 key_size, u64 val_size, void *key)
+// Return true if the key existed.
+{
+    Probe_key probe = get_probe_key(&map->shards[0].map, key_size, key);
+
+    Map_shard *shard = get_shard(map, probe.hash);
+    Any_map   *m     = &shard->map;
+
+    begin_write(shard);
+
+    bool deleted = false;
+    if (m->keys) {
+        memcpy((u8 *)m->keys - key_size, key, key_size);
+        deleted = delete_key(m, key_size, val_size);
+    }
+
+    end_write(shard);
+
+    return deleted;
+}
@@ -0,0 +1,97 @@
+#ifndef CONCURRENT_H_INCLUDED
+#define CONCURRENT_H_INCLUDED
+
+#include "map.h"
+
+//
+// A ConcurrentMap is a map that many threads can use at once. It's split into shards, each an ordinary Map with its own
+// lock and its own child context. A key's shard is picked by its hash, so writers to different shards don't contend.
+//
+// Writers take the shard's lock. Readers don't take any lock. Instead each shard has a sequence number that a writer
+// increments before and after changing the map, so that it's odd while a change is in progress. A reader notes the
+// sequence number, looks up the key without writing to anything, and then checks the sequence number is the same as
+// before. If it isn't, the reader might have seen a half-changed map, so it throws away what it found and tries again.
+// This is a seqlock. Reads are fast and scale with the number of threads. If a reader has to try again too many times,
+// it takes the lock like a writer, so it can't be starved by a shard that's written to constantly.
+//
+// A reader may be looking at a shard's storage when a writer grows the map and deallocates it. That's fine because
+// dealloc() gives the memory back to the shard's context, which keeps it mapped until the context is trimmed or freed.
+// So: don't call trim_context() on a concurrent map's context (or its ancestors) while threads might be reading it.
+//
+// The keys and values are passed by pointer, and ConcurrentGet() copies the value out instead of returning a pointer
+// into the map, since the value could move as soon as we've found it:
+//
+//     ConcurrentMap(u64, s64) *map = NewConcurrentMap(map, 16, ctx);
+//
+//     u64 key = 42;
+//     s64 val = 7;
+//     ConcurrentSet(map, &key, &val);
+//
+//     s64 found;
+//     if (ConcurrentGet(map, &key, &found))  assert(found == 7);  // OUT_VAL may be overwritten even on a miss.
+//
+//     ConcurrentDelete(map, &key);
+//
+// NewConcurrentDict() and NewConcurrentSliceMap() make maps with string and Byte_slice keys, in which case you pass a
+// pointer to a char * or a Byte_slice. The number of shards is rounded up to a power of two. Don't touch the shards'
+// maps directly while other threads are using the concurrent map.
+//
+// .key_type and .val_type are always NULL. They're just there so the macros can check the types of keys and values.
+//
+
+typedef struct Map_shard Map_shard;
+
+struct Map_shard {
+    Lock     lock;     // Writers hold this while they change the map.
+    u32      sequence; // Odd while a writer is changing the map.
+    Any_map  map;
+    //|Speed: Neighbouring shards might share a cache line. We could pad them out.
+};
+
+#define ConcurrentMap(KEY_TYPE, VAL_TYPE) \
+    struct {                              \
+        Map_shard      *shards;           \
+        s64             num_shards;       \
+        Memory_context *context;          \
+        KEY_TYPE       *key_type;         \
+        VAL_TYPE       *val_type;         \
+    }
+
+typedef ConcurrentMap(void, void) Any_concurrent_map;
+
+void init_concurrent_map(Any_concurrent_map *map, s64 num_shards, Memory_context *context, bool binary_mode, bool slice_mode);
+void free_concurrent_map(Any_concurrent_map *map);
+bool concurrent_get(Any_concurrent_map *map, u64 key_size, u64 val_size, void *key, void *out_val);
+void concurrent_set(Any_concurrent_map *map, u64 key_size, u64 val_size, void *key, void *val);
+bool concurrent_delete(Any_concurrent_map *map, u64 key_size, u64 val_size, void *key);
+
+#define NewConcurrentMap(MAP, NUM_SHARDS, CONTEXT) \
+    ((MAP) = zero_alloc(1, sizeof(*MAP), (CONTEXT)), \
+     init_concurrent_map((Any_concurrent_map *)(MAP), (NUM_SHARDS), (CONTEXT), true, false), \
+     (MAP))
+
+#define NewConcurrentDict(MAP, NUM_SHARDS, CONTEXT) \
+    ((MAP) = zero_alloc(1, sizeof(*MAP), (CONTEXT)), \
+     init_concurrent_map((Any_concurrent_map *)(MAP), (NUM_SHARDS), (CONTEXT), false, false), \
+     (MAP))
+
+#define NewConcurrentSliceMap(MAP, NUM_SHARDS, CONTEXT) \
+    ((MAP) = zero_alloc(1, sizeof(*MAP), (CONTEXT)), \
+     init_concurrent_map((Any_concurrent_map *)(MAP), (NUM_SHARDS), (CONTEXT), false, true), \
+     (MAP))
+
+#define ConcurrentGet(MAP, KEY_PTR, OUT_VAL_PTR) \
+    concurrent_get((Any_concurrent_map *)(MAP), sizeof(*(MAP)->key_type), sizeof(*(MAP)->val_type), \
+                   (1 ? (KEY_PTR) : (MAP)->key_type), (1 ? (OUT_VAL_PTR) : (MAP)->val_type))
+
+#define ConcurrentSet(MAP, KEY_PTR, VAL_PTR) \
+    (EnterAllocSite(), \
+     concurrent_set((Any_concurrent_map *)(MAP), sizeof(*(MAP)->key_type), sizeof(*(MAP)->val_type), \
+                    (1 ? (KEY_PTR) : (MAP)->key_type), (1 ? (VAL_PTR) : (MAP)->val_type)), \
+     LeaveAllocSite())
+
+#define ConcurrentDelete(MAP, KEY_PTR) \
+    concurrent_delete((Any_concurrent_map *)(MAP), sizeof(*(MAP)->key_type), sizeof(*(MAP)->val_type), \
+                      (1 ? (KEY_PTR) : (MAP)->key_type))
+
+#endif // CONCURRENT_H_INCLUDED
@@ -6,6 +6,13 @@
 // everything back to the right. There is room for improvement here.
 
 #include "context.h"
+#include "trace.h"
+
+// These are the functions that the call-site recording macros in context.h wrap.
+#undef alloc
+#undef zero_alloc
+#undef try_alloc
+#undef try_zero_alloc
 
 static s64 get_free_block_index(Memory_context *context, u64 size, u8 *data)
 // Return the index of the block if it exists or the index where it would be inserted.
@@ -104,35 +111,52 @@ static bool is_sentinel(Memory_context *context, u8 *data, u64 size)
     return false;
 }
 
-static Memory_block *add_block(Memory_context *context, Memory_block **blocks, s64 *count, s64 *limit, void *data, u64 size)
-// Add a block with the specified data pointer and size to an array of Memory_blocks, maintaining the array's order.
+static bool reserve_blocks(Memory_context *context, Memory_block **blocks, s64 *limit, s64 new_count)
+// Make sure an array of Memory_blocks has room for new_count blocks. Return false if we couldn't get the memory.
 {
     s64 INITIAL_LIMIT = 4; // How many buffers, used_blocks and free_blocks to make room for to begin with.
 
     Memory_context *c = context;
 
-    assert(blocks == &c->buffers || blocks == &c->free_blocks || blocks == &c->used_blocks);
-    assert(data && (size || (blocks == &c->used_blocks && is_sentinel(c, data, size))));
+    if (new_count <= *limit)  return true;
+
+    s64 new_limit = *limit ? *limit : INITIAL_LIMIT;
+    while (new_limit < new_count)  new_limit *= 2;
+
+    Memory_block *new_blocks;
 
     if (*blocks == NULL) {
         // The array of blocks needs to be allocated.
-        assert(*limit == 0 && *count == 0);
+        assert(*limit == 0);
 
-        *limit = INITIAL_LIMIT;
-
-        if (c->parent)  *blocks = alloc(*limit, sizeof(Memory_block), c->parent);
-        else            *blocks = malloc(*limit * sizeof(Memory_block));
-    } else if (*count >= *limit) {
+        if (c->parent)  new_blocks = try_alloc(new_limit, sizeof(Memory_block), c->parent);
+        else            new_blocks = malloc(new_limit * sizeof(Memory_block));
+    } else {
         // The array of blocks needs to be resized.
-        assert(*count == *limit);
         assert(is_power_of_two(*limit));
 
-        *limit *= 2;
-
-        if (c->parent)  *blocks = resize(*blocks, *limit, sizeof(Memory_block), c->parent);
-        else            *blocks = realloc(*blocks, *limit * sizeof(Memory_block));
+        if (c->parent)  new_blocks = try_resize(*blocks, new_limit, sizeof(Memory_block), c->parent);
+        else            new_blocks = realloc(*blocks, new_limit * sizeof(Memory_block));
     }
 
+    if (!new_blocks)  return false;
+
+    *blocks = new_blocks;
+    *limit  = new_limit;
+
+    return true;
+}
+
+static Memory_block *add_block(Memory_context *context, Memory_block **blocks, s64 *count, s64 *limit, void *data, u64 size)
+// Add a block with the specified data pointer and size to an array of Memory_blocks, maintaining the array's order.
+{
+    Memory_context *c = context;
+
+    assert(blocks == &c->buffers || blocks == &c->free_blocks || blocks == &c->used_blocks);
+    assert(data && (size || (blocks == &c->used_blocks && is_sentinel(c, data, size))));
+
+    if (!reserve_blocks(c, blocks, limit, *count+1))  Fatal("Out of memory.");
+
     s64 insert_index; {
         if (blocks == &c->free_blocks)       insert_index = get_free_block_index(c, size, data);
         else if (blocks == &c->used_blocks)  insert_index = get_used_block_index(c, data);
@@ -165,12 +189,15 @@ static void delete_block(Memory_block *blocks, s64 *count, Memory_block *block)
 }
 
 static Memory_block *grow_context(Memory_context *context, u64 size)
-// Add a new buffer of at least size bytes to a context. Return the associated free block.
+// Add a new buffer of at least size bytes to a context. Return the associated free block, or NULL if the
+// new buffer would put the context over its budget or we couldn't get the memory from the parent or the OS.
 {
     u64 FIRST_BUFFER_SIZE = BUFSIZ;
 
     Memory_context *c = context;
 
+    u64 trace_start = TraceTime();
+
     Memory_block buffer = {0};
 
     // Our idea here is to double the size of each additional buffer that we add to a context.
@@ -182,10 +209,20 @@ static Memory_block *grow_context(Memory_context *context, u64 size)
     // Keep doubling until we know we have room for an allocation of length `size`.
     while (buffer.size < size)  buffer.size *= 2;
 
-    if (c->parent)  buffer.data = alloc(1, buffer.size, c->parent);
+    if (c->budget && c->buffer_bytes + buffer.size > c->budget) {
+        // A buffer of the usual size would put us over budget. Use whatever's left of the budget if that's enough.
+        if (c->buffer_bytes + size > c->budget)  return NULL;
+
+        buffer.size = c->budget - c->buffer_bytes;
+    }
+
+    if (c->parent)  buffer.data = try_alloc(1, buffer.size, c->parent);
     else            buffer.data = malloc(buffer.size);
 
+    if (!buffer.data)  return NULL;
+
     add_buffer(c, buffer.data, buffer.size);
+    c->buffer_bytes += buffer.size;
 
     // Create sentinel used blocks at the beginning and end of the buffer.
     add_used_block(c, buffer.data,               0);
@@ -193,6 +230,8 @@ static Memory_block *grow_context(Memory_context *context, u64 size)
 
     Memory_block *free_block = add_free_block(c, buffer.data, buffer.size);
 
+    TraceEvent(TRACE_GROW_CONTEXT, trace_start, buffer.size);
+
     return free_block;
 }
 
@@ -336,7 +375,192 @@ static Memory_block *dealloc_block(Memory_context *context, Memory_block *used_b
     return freed_block;
 }
 
-void *alloc(s64 count, u64 unit_size, Memory_context *context)
+// The most blocks release_blocks() takes at once. free_context() needs a few more than the number of buffers a context
+// can have, and each buffer is at least twice as big as the last.
+#define MAX_RELEASE_BATCH  128
+
+static void sort_pointers(u8 **pointers, s64 count)
+// Insertion sort. We only use this for short arrays.
+{
+    for (s64 i = 1; i < count; i++) {
+        u8 *p = pointers[i];
+        s64 j = i;
+        for (; j > 0 && pointers[j-1] > p; j--)  pointers[j] = pointers[j-1];
+        pointers[j] = p;
+    }
+}
+
+static bool is_before_in_free_order(Memory_block *a, Memory_block *b)
+{
+    if (a->size != b->size)  return a->size < b->size;
+
+    return a->data < b->data;
+}
+
+static void sort_in_free_order(Memory_block *blocks, s64 count)
+// Insertion sort. We only use this for short arrays.
+{
+    for (s64 i = 1; i < count; i++) {
+        Memory_block block = blocks[i];
+        s64 j = i;
+        for (; j > 0 && is_before_in_free_order(&block, &blocks[j-1]); j--)  blocks[j] = blocks[j-1];
+        blocks[j] = block;
+    }
+}
+
+static void release_blocks(Memory_context *context, u8 **pointers, s64 count)
+// Deallocate a batch of used blocks, which must be sorted by address. The caller must hold the context's lock.
+//
+// This does the same job as calling dealloc_block() for each pointer, but dealloc_block() searches for each block and
+// its free neighbours, and shifts the arrays of blocks left and right for each block it frees. Here we make one pass
+// over the used blocks, merging them against the pointers, and then one pass over the free blocks.
+{
+    Memory_context *c = context;
+
+    assert(count <= MAX_RELEASE_BATCH);
+
+    // A run of used blocks that are next to each other in the array coalesces into one fresh free block, along with
+    // the free gaps between and around them. Those gaps are stale: they get swallowed by the fresh block.
+    Memory_block stale[2*MAX_RELEASE_BATCH];
+    Memory_block fresh[MAX_RELEASE_BATCH];
+    s64          num_stale = 0;
+    s64          num_fresh = 0;
+
+    // Remove the used blocks, working out the stale and fresh free blocks as we go.
+    {
+        s64 next      = 0;     // The next pointer to look for.
+        s64 write     = 0;
+        u8 *run_start = NULL;  // If we're in a run of freed blocks, where the fresh free block starts.
+        u8 *run_end   = NULL;  // And where the last freed block in the run ends.
+
+        for (s64 read = 0; read < c->used_count; read++) {
+            Memory_block block = c->used_blocks[read];
+
+            // Sentinels can have the same address as a block, but they have no size.
+            if (next < count && block.data == pointers[next] && block.size) {
+                if (!run_start) {
+                    // This assert should always be true due to the presence of sentinels.
+                    assert(write > 0);
+                    Memory_block *prev = &c->used_blocks[write-1];
+                    run_start = run_end = prev->data + prev->size;
+                }
+                if (block.data != run_end)  stale[num_stale++] = (Memory_block){.data=run_end, .size=block.data-run_end};
+
+#ifndef NDEBUG
+                // Wipe freed memory in debug builds to make use-after-free bugs more obvious.
+                memset(block.data, 0, block.size);
+#endif
+
+                run_end  = block.data + block.size;
+                next    += 1;
+                continue;
+            }
+
+            if (run_start) {
+                if (block.data != run_end)  stale[num_stale++] = (Memory_block){.data=run_end, .size=block.data-run_end};
+                fresh[num_fresh++] = (Memory_block){.data=run_start, .size=block.data-run_start};
+                run_start = NULL;
+            }
+
+            c->used_blocks[write++] = block;
+        }
+
+        // Every pointer must have been a used block, and the sentinels mean a run can't be at the end.
+        assert(next == count && !run_start);
+
+        c->used_count = write;
+    }
+
+    // Rebuild the free list in one pass, skipping the stale blocks and merging in the fresh ones. Both arrays are short,
+    // so we sort them into the free list's order first. Writing a fresh block can get ahead of reading the old ones, so
+    // old blocks we've read but not written yet wait in a queue. It never holds more than num_fresh+1 blocks.
+    {
+        sort_in_free_order(stale, num_stale);
+        sort_in_free_order(fresh, num_fresh);
+
+        s64 new_count = c->free_count - num_stale + num_fresh;
+        if (!reserve_blocks(c, &c->free_blocks, &c->free_limit, new_count))  Fatal("Out of memory: couldn't release blocks.");
+
+        Memory_block queue[MAX_RELEASE_BATCH+1];
+        s64          queue_start = 0;
+        s64          queue_count = 0;
+        s64          next_stale  = 0;
+        s64          next_fresh  = 0;
+        s64          write       = 0;
+
+        for (s64 read = 0; read <= c->free_count; read++) {
+            if (read < c->free_count) {
+                Memory_block block = c->free_blocks[read];
+
+                if (next_stale < num_stale && block.data == stale[next_stale].data && block.size == stale[next_stale].size) {
+                    next_stale += 1;
+                } else {
+                    queue[(queue_start + queue_count++) % countof(queue)] = block;
+                }
+            }
+
+            // We can write over everything we've read. Once we've read everything, we can write the rest.
+            s64 limit = (read < c->free_count) ? read+1 : new_count;
+
+            while (write < limit && (queue_count || (read == c->free_count && next_fresh < num_fresh))) {
+                Memory_block *oldest = queue_count ? &queue[queue_start] : NULL;
+
+                if (next_fresh < num_fresh && (!oldest || is_before_in_free_order(&fresh[next_fresh], oldest))) {
+                    c->free_blocks[write++] = fresh[next_fresh++];
+                } else {
+                    c->free_blocks[write++] = *oldest;
+                    queue_start  = (queue_start + 1) % countof(queue);
+                    queue_count -= 1;
+                }
+            }
+
+            assert(queue_count < countof(queue));
+        }
+
+        assert(write == new_count && next_stale == num_stale);
+
+        c->free_count = new_count;
+    }
+}
+
+static u8 *alloc_locked(Memory_context *context, u64 size, u64 alignment)
+// Return NULL if there's no room and we can't grow the context. The caller must hold the context's lock.
+{
+    Memory_context *c = context;
+
+    // Make sure the arrays of blocks have room for everything that we (or resize(), when it frees the old block)
+    // might add to them. This way, we find out now if we can't get the memory, and add_block() never has to allocate.
+    if (!reserve_blocks(c, &c->buffers,     &c->buffer_limit, c->buffer_count+1))  return NULL;
+    if (!reserve_blocks(c, &c->used_blocks, &c->used_limit,   c->used_count+3))    return NULL;
+    if (!reserve_blocks(c, &c->free_blocks, &c->free_limit,   c->free_count+4))    return NULL;
+
+    // See if there's an already-free block of the right size.
+    for (s64 i = get_free_block_index(c, size, NULL); i < c->free_count; i++) {
+        Memory_block *free_block = &c->free_blocks[i];
+        Memory_block *used_block = alloc_block(c, free_block, size, alignment);
+        if (used_block)  return used_block->data;
+    }
+
+    // We weren't able to find a block big enough in the free list.
+    // We need to add a new buffer to the context.
+    Memory_block *free_block = grow_context(c, size);
+    if (!free_block)  return NULL;
+
+    return alloc_block(c, free_block, size, alignment)->data;
+}
+
+static bool relieve_pressure(Memory_context *context, u64 size)
+// Call the context's memory pressure callback, if it has one. Return true if it's worth trying the allocation again.
+{
+    Memory_context *c = context;
+
+    if (!c->on_pressure)  return false;
+
+    return c->on_pressure(c, size, c->pressure_data);
+}
+
+void *try_alloc(s64 count, u64 unit_size, Memory_context *context)
+// Like alloc(), but return NULL instead of exiting if the context is over budget or the OS won't give us memory.
 {
     Memory_context *c = context;
 
@@ -349,27 +573,40 @@ void *alloc(s64 count, u64 unit_size, Memory_context *context)
 
     void *data = NULL;
 
-    pthread_mutex_lock(&c->mutex);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        lock_context(c);
+        data = alloc_locked(c, size, alignment);
+        unlock_context(c);
 
-    // See if there's an already-free block of the right size.
-    for (s64 i = get_free_block_index(c, size, NULL); i < c->free_count; i++) {
-        Memory_block *free_block = &c->free_blocks[i];
-        Memory_block *used_block = alloc_block(c, free_block, size, alignment);
-        if (used_block) {
-            data = used_block->data;
-            break;
-        }
+        // If there wasn't room, give the memory pressure callback a chance to free something and try once more.
+        // We call it without holding the lock so it can free memory in related contexts.
+        if (data || attempt || !relieve_pressure(c, size))  break;
     }
 
-    if (!data) {
-        // We weren't able to find a block big enough in the free list.
-        // We need to add a new buffer to the context.
-        Memory_block *free_block = grow_context(context, size);
-
-        data = alloc_block(c, free_block, size, alignment)->data;
+#ifdef PROFILING
+    if (data) {
+        bytes_until_alloc_sample -= size;
+        if (bytes_until_alloc_sample <= 0)  sample_alloc(data, size, c);
     }
+#endif
+
+    return data;
+}
+
+void *alloc(s64 count, u64 unit_size, Memory_context *context)
+{
+    void *data = try_alloc(count, unit_size, context);
 
-    pthread_mutex_unlock(&c->mutex);
+    if (!data)  Fatal("Out of memory: couldn't allocate %llu bytes.", (unsigned long long)(count*unit_size));
+
+    return data;
+}
+
+void *try_zero_alloc(s64 count, u64 unit_size, Memory_context *context)
+{
+    void *data = try_alloc(count, unit_size, context);
+
+    if (data)  memset(data, 0, count*unit_size);
 
     return data;
 }
@@ -383,7 +620,19 @@ void *zero_alloc(s64 count, u64 unit_size, Memory_context *context)
     return data;
 }
 
-void *resize(void *data, s64 new_limit, u64 unit_size, Memory_context *context)
+#ifdef PROFILING
+static void note_resize(void *old_data, void *new_data, u64 new_size, Memory_context *context)
+// For profiling purposes we treat a resize like a new allocation of the new size.
+{
+    if (context->num_alloc_samples && move_alloc_sample(old_data, new_data, new_size, context))  return;
+
+    bytes_until_alloc_sample -= new_size;
+    if (bytes_until_alloc_sample <= 0)  sample_alloc(new_data, new_size, context);
+}
+#endif
+
+void *try_resize(void *data, s64 new_limit, u64 unit_size, Memory_context *context)
+// Like resize(), but return NULL instead of exiting if there's no memory. In that case the old data is left alone.
 {
     Memory_context *c = context;
 
@@ -394,63 +643,71 @@ void *resize(void *data, s64 new_limit, u64 unit_size, Memory_context *context)
 
     u64 new_size = new_limit * unit_size;
 
-    pthread_mutex_lock(&c->mutex);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        lock_context(c);
 
-    Memory_block *used_block = find_used_block(c, data);
-    assert(used_block);
+        Memory_block *used_block = find_used_block(c, data);
+        assert(used_block);
 
-    Memory_block *resized = resize_block(context, used_block, new_size);
-    if (resized) {
-        // We managed to resize in place.
-        assert(resized->data == data);
-        pthread_mutex_unlock(&c->mutex);
-        return data;
-    }
+        Memory_block *resized = resize_block(context, used_block, new_size);
+        if (resized) {
+            // We managed to resize in place.
+            assert(resized->data == data);
+            unlock_context(c);
+#ifdef PROFILING
+            note_resize(data, data, new_size, c);
+#endif
+            return data;
+        }
 
-    // We can't resize the block in place. We'll have to move it.
+        // We can't resize the block in place. We'll have to move it.
 
-    s64 old_index = used_block - c->used_blocks;
+        u64 trace_start = TraceTime();
 
-    void *new_data = NULL;
-    // |Copypasta from alloc():
-    {
-        u64 alignment = get_alignment(unit_size);
+        s64 old_index = used_block - c->used_blocks;
 
-        // See if there's an already-free block of the right size.
-        for (s64 i = get_free_block_index(c, new_size, NULL); i < c->free_count; i++) {
-            Memory_block *free_block = &c->free_blocks[i];
-            Memory_block *used_block = alloc_block(c, free_block, new_size, alignment);
-            if (used_block) {
-                new_data = used_block->data;
-                break;
+        void *new_data = alloc_locked(c, new_size, get_alignment(unit_size));
+
+        if (new_data) {
+            // alloc_locked() may have made an unknown number of allocations or reallocations. Which means the used
+            // block's index might have changed and the whole array of used blocks might have moved. We need
+            // to find the old used block in this case so we can deallocate it.
+            used_block = &c->used_blocks[old_index];
+            if (used_block->data < (u8 *)data || !used_block->size) {
+                do used_block += 1;  while (data != used_block->data || !used_block->size);
+            } else if (used_block->data > (u8 *)data) {
+                do used_block -= 1;  while (data != used_block->data);
             }
-        }
 
-        if (!new_data) {
-            // We weren't able to find a block big enough in the free list.
-            // We need to add a new buffer to the context.
-            Memory_block *free_block = grow_context(context, new_size);
+            u64 copy_size = Min(used_block->size, new_size);
+            memcpy(new_data, data, copy_size);
+
+            dealloc_block(context, used_block);
 
-            new_data = alloc_block(c, free_block, new_size, alignment)->data;
+            TraceEvent(TRACE_RESIZE_MOVE, trace_start, copy_size);
+
+            unlock_context(c);
+
+#ifdef PROFILING
+            note_resize(data, new_data, new_size, c);
+#endif
+
+            return new_data;
         }
-    }
 
-    // `alloc` may have made an unknown number of allocations or reallocations. Which means the used
-    // block's index might have changed and the whole array of used blocks might have moved. We need
-    // to find the old used block in this case so we can deallocate it.
-    used_block = &c->used_blocks[old_index];
-    if (used_block->data < (u8 *)data || !used_block->size) {
-        do used_block += 1;  while (data != used_block->data || !used_block->size);
-    } else if (used_block->data > (u8 *)data) {
-        do used_block -= 1;  while (data != used_block->data);
+        unlock_context(c);
+
+        if (attempt || !relieve_pressure(c, new_size))  break;
     }
 
-    u64 copy_size = Min(used_block->size, new_size);
-    memcpy(new_data, data, copy_size);
+    return NULL;
+}
 
-    dealloc_block(context, used_block);
+void *resize(void *data, s64 new_limit, u64 unit_size, Memory_context *context)
+{
+    void *new_data = try_resize(data, new_limit, unit_size, context);
 
-    pthread_mutex_unlock(&c->mutex);
+    if (!new_data)  Fatal("Out of memory: couldn't resize an allocation to %llu bytes.", (unsigned long long)(new_limit*unit_size));
 
     return new_data;
 }
@@ -460,14 +717,107 @@ void dealloc(void *data, Memory_context *context)
     assert(data);
     assert(context);
 
-    pthread_mutex_lock(&context->mutex);
+    lock_context(context);
 
     Memory_block *used_block = find_used_block(context, data);
     assert(used_block);
 
     dealloc_block(context, used_block);
 
-    pthread_mutex_unlock(&context->mutex);
+    unlock_context(context);
+
+#ifdef PROFILING
+    if (context->num_alloc_samples)  forget_alloc_sample(data, context);
+#endif
+}
+
+void lock_context(Memory_context *context)
+{
+    acquire_lock(&context->lock);
+}
+
+void unlock_context(Memory_context *context)
+{
+    release_lock(&context->lock);
+}
+
+void set_context_lock_kind(Memory_context *context, Lock_kind kind)
+// Choose what kind of lock a context uses. Only call this before the context is shared between threads.
+// New contexts use the same kind of lock as their parent.
+{
+    destroy_lock(&context->lock);
+    init_lock(&context->lock, kind);
+}
+
+Lock_stats get_context_lock_stats(Memory_context *context)
+{
+    return get_lock_stats(&context->lock);
+}
+
+void set_context_budget(Memory_context *context, u64 budget)
+// Limit the total size of the buffers a context takes from its parent (or the OS). Zero means no limit. Since a context's
+// descendants get all their memory from its buffers, the budget also covers the whole subtree.
+//
+// When an allocation would go over budget, alloc() exits and try_alloc() returns NULL. If the budget is already
+// exceeded when you set it, the context won't grow again until it's back under.
+{
+    lock_context(context);
+    context->budget = budget;
+    unlock_context(context);
+}
+
+void set_memory_pressure_callback(Memory_context *context, Memory_pressure_callback *callback, void *data)
+// Set a function to call when an allocation from this context fails because of its budget or because the parent or the
+// OS refused. The callback gets the number of bytes we were trying to allocate. It might free or trim other contexts,
+// for example. If it returns true, we try the allocation once more.
+//
+// The callback is called without the context's lock, but the thread might hold the lock of a descendant that was
+// growing, so the callback must not use this context's descendants.
+{
+    lock_context(context);
+    context->on_pressure   = callback;
+    context->pressure_data = data;
+    unlock_context(context);
+}
+
+u64 trim_context(Memory_context *context)
+// Give buffers that are completely unused back to the parent (or the OS). Return the number of bytes released.
+{
+    Memory_context *c = context;
+
+    u64 num_released = 0;
+
+    lock_context(c);
+
+    for (s64 i = c->buffer_count-1; i >= 0; i--) {
+        Memory_block buffer = c->buffers[i];
+
+        Memory_block *free_block = find_free_block(c, buffer.size, buffer.data);
+        if (!free_block)  continue;
+
+        delete_block(c->free_blocks, &c->free_count, free_block);
+
+        // Delete the sentinels. If there's another buffer right before or after this one, two sentinels will have the
+        // same address, but since they're identical it doesn't matter which one we delete.
+        u8 *sentinels[] = {buffer.data, buffer.data + buffer.size};
+        for (int j = 0; j < countof(sentinels); j++) {
+            Memory_block *sentinel = &c->used_blocks[get_used_block_index(c, sentinels[j]) - 1];
+            assert(sentinel->data == sentinels[j] && !sentinel->size);
+            delete_block(c->used_blocks, &c->used_count, sentinel);
+        }
+
+        delete_block(c->buffers, &c->buffer_count, &c->buffers[i]);
+        c->buffer_bytes -= buffer.size;
+
+        if (c->parent)  dealloc(buffer.data, c->parent);
+        else            free(buffer.data);
+
+        num_released += buffer.size;
+    }
+
+    unlock_context(c);
+
+    return num_released;
 }
 
 Memory_context *new_context(Memory_context *parent)
@@ -479,36 +829,92 @@ Memory_context *new_context(Memory_context *parent)
 
     context->parent = parent;
 
-    pthread_mutex_init(&context->mutex, NULL);
+    init_lock(&context->lock, parent ? parent->lock.kind : LOCK_MUTEX);
+
+    if (parent) {
+        lock_context(parent);
+
+        context->next_sibling = parent->first_child;
+        if (parent->first_child)  parent->first_child->prev_sibling = context;
+        parent->first_child = context;
+
+        unlock_context(parent);
+    }
 
     return context;
 }
 
 void free_context(Memory_context *context)
-// This function automatically frees all child contexts because they all allocated from this parent.
+// Free a context and all its descendants. We don't have to visit the descendants, because all of their memory
+// (including the Memory_context structs themselves) was allocated from this context's buffers. Returning those
+// buffers to the parent takes care of the whole subtree.
 {
     Memory_context *c = context;
+    Memory_context *p = c->parent;
+
+#ifdef PROFILING
+    forget_context_samples(c);
+#endif
 
-    pthread_mutex_lock(&c->mutex);
+    if (p) {
+        // Collect every block this context got from its parent, including the context itself, so we can
+        // hand them all back with one lock of the parent and a pass over each of its block arrays per batch.
+        // Each buffer is usually twice as big as the last, so a context normally has only a handful of them, but
+        // raising a budget in small steps adds a small buffer per step. We collect all the pointers before releasing
+        // any of them, since the blocks we release first might hold the list of the others.
+        u8 *batch[MAX_RELEASE_BATCH];
+        u8 **pointers     = batch;
+        s64  num_pointers = 0;
+
+        lock_context(c);
+
+        if (c->buffer_count + 4 > countof(batch)) {
+            pointers = malloc((c->buffer_count + 4) * sizeof(u8 *));
+            if (!pointers)  Fatal("Out of memory: couldn't free a context.");
+        }
+
+        for (s64 i = 0; i < c->buffer_count; i++)  pointers[num_pointers++] = c->buffers[i].data;
+
+        if (c->buffers)      pointers[num_pointers++] = (u8 *)c->buffers;
+        if (c->free_blocks)  pointers[num_pointers++] = (u8 *)c->free_blocks;
+        if (c->used_blocks)  pointers[num_pointers++] = (u8 *)c->used_blocks;
+        pointers[num_pointers++] = (u8 *)c;
+
+        unlock_context(c);
+        destroy_lock(&c->lock);
 
-    if (c->parent) {
-        for (s64 i = 0; i < c->buffer_count; i++)  dealloc(c->buffers[i].data, c->parent);
+        sort_pointers(pointers, num_pointers);
 
-        if (c->buffers)      dealloc(c->buffers,     c->parent);
-        if (c->free_blocks)  dealloc(c->free_blocks, c->parent);
-        if (c->used_blocks)  dealloc(c->used_blocks, c->parent);
+        lock_context(p);
+
+        if (c->prev_sibling)  c->prev_sibling->next_sibling = c->next_sibling;
+        else                  p->first_child = c->next_sibling;
+        if (c->next_sibling)  c->next_sibling->prev_sibling = c->prev_sibling;
+
+        for (s64 i = 0; i < num_pointers; i += MAX_RELEASE_BATCH) {
+            release_blocks(p, pointers+i, Min(num_pointers-i, MAX_RELEASE_BATCH));
+        }
 
-        pthread_mutex_unlock(&c->mutex);
+        unlock_context(p);
 
-        dealloc(c, c->parent);
+#ifdef PROFILING
+        if (p->num_alloc_samples) {
+            for (s64 i = 0; i < num_pointers; i++)  forget_alloc_sample(pointers[i], p);
+        }
+#endif
+
+        if (pointers != batch)  free(pointers);
     } else {
+        lock_context(c);
+
         for (s64 i = 0; i < c->buffer_count; i++)  free(c->buffers[i].data);
 
         if (c->buffers)      free(c->buffers);
         if (c->free_blocks)  free(c->free_blocks);
         if (c->used_blocks)  free(c->used_blocks);
 
-        pthread_mutex_unlock(&c->mutex);
+        unlock_context(c);
+        destroy_lock(&c->lock);
 
         free(c);
     }
@@ -518,11 +924,18 @@ void reset_context(Memory_context *context)
 {
     Memory_context *c = context;
 
-    pthread_mutex_lock(&c->mutex);
+#ifdef PROFILING
+    forget_context_samples(c);
+#endif
+
+    lock_context(c);
 
     c->free_count = 0;
     c->used_count = 0;
 
+    // Any child contexts lived in the memory we're about to reuse.
+    c->first_child = NULL;
+
     for (s64 i = 0; i < c->buffer_count; i++) {
         u8 *data = c->buffers[i].data;
         u64 size = c->buffers[i].size;
@@ -539,7 +952,7 @@ void reset_context(Memory_context *context)
         add_free_block(c, data, size);
     }
 
-    pthread_mutex_unlock(&c->mutex);
+    unlock_context(c);
 }
 
 char *copy_string(char *source, Memory_context *context)
@@ -551,6 +964,43 @@ char *copy_string(char *source, Memory_context *context)
     return copy;
 }
 
+static u8 *arena_reserve(String_arena *arena, s64 size)
+{
+    s64 CHUNK_SIZE = 4096;
+
+    assert(arena->context);
+
+    if (!arena->chunk || arena->used + size > arena->limit) {
+        // Start a new chunk. We just leave whatever room was left in the old one. We start one even for an empty
+        // reservation, so that we never hand out a null pointer.
+        arena->limit = Max(CHUNK_SIZE, size);
+        arena->chunk = alloc(arena->limit, sizeof(u8), arena->context);
+        arena->used  = 0;
+    }
+
+    u8 *result = arena->chunk + arena->used;
+    arena->used += size;
+
+    return result;
+}
+
+void *arena_copy(String_arena *arena, void *data, s64 size)
+// Copy size bytes into the arena and return a pointer to the copy. The copy isn't aligned.
+{
+    u8 *copy = arena_reserve(arena, size);
+    if (size)  memcpy(copy, data, size);
+    return copy;
+}
+
+char *arena_copy_string(String_arena *arena, char *string, s64 length)
+// Copy the first length bytes of a string into the arena, with a zero terminator.
+{
+    char *copy = (char *)arena_reserve(arena, length+1);
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    return copy;
+}
+
 //
 // We expose check_context_integrity() for testing purposes. Since that function works by making
 // lots of assertions, we hide it behind this #ifndef, so we don't accidentally link a non-debug
@@ -585,7 +1035,7 @@ void check_context_integrity(Memory_context *context)
 {
     Memory_context *c = context;
 
-    pthread_mutex_lock(&c->mutex);
+    lock_context(c);
 
     assert(are_in_free_order(c->free_blocks, c->free_count));
     assert(are_in_used_order(c->used_blocks, c->used_count));
@@ -647,6 +1097,16 @@ void check_context_integrity(Memory_context *context)
     assert(num_free == c->free_count);
     assert(num_used == c->used_count);
 
-    pthread_mutex_unlock(&c->mutex);
+    u64 buffer_bytes = 0;
+    for (s64 i = 0; i < c->buffer_count; i++)  buffer_bytes += c->buffers[i].size;
+    assert(buffer_bytes == c->buffer_bytes);
+
+    for (Memory_context *child = c->first_child; child; child = child->next_sibling) {
+        assert(child->parent == c);
+        if (child->next_sibling)  assert(child->next_sibling->prev_sibling == child);
+        assert(find_used_block(c, (u8 *)child));
+    }
+
+    unlock_context(c);
 }
 #endif // NDEBUG
@@ -1,12 +1,15 @@
 #ifndef CONTEXT_H_INCLUDED
 #define CONTEXT_H_INCLUDED
 
-#include <pthread.h>
-
 #include "basic.h"
+#include "lock.h"
+#include "profile.h"
 
 typedef struct Memory_block   Memory_block;
 typedef struct Memory_context Memory_context;
+typedef struct String_arena   String_arena;
+
+typedef bool Memory_pressure_callback(Memory_context *context, u64 size, void *data);
 
 struct Memory_block {
     u8  *data;
@@ -14,10 +17,18 @@ struct Memory_block {
 };
 
 struct Memory_context {
-    pthread_mutex_t mutex;
+    Lock            lock;
+#ifdef PROFILING
+    s64             num_alloc_samples; // How many of this context's live allocations the profiler has sampled.
+#endif
 
     Memory_context *parent;
 
+    // Child contexts form a doubly-linked list so that a child can unlink itself in constant time.
+    Memory_context *first_child;
+    Memory_context *prev_sibling;
+    Memory_context *next_sibling;
+
     // Backing memory the context has allocated from its parent (or from the operating system if the parent is NULL).
     Memory_block   *buffers;
     s64             buffer_count;
@@ -32,18 +43,55 @@ struct Memory_context {
     Memory_block   *used_blocks;
     s64             used_count;
     s64             used_limit;
+
+    u64             buffer_bytes; // The total size of the buffers.
+
+    // See set_context_budget() and set_memory_pressure_callback().
+    u64                       budget;
+    Memory_pressure_callback *on_pressure;
+    void                     *pressure_data;
+};
+
+// A String_arena packs lots of small strings into a few big allocations from a context, instead of making an allocation
+// for each one. You can't free the strings individually. They go when the context is freed or reset. Initialise an
+// arena with just the context: `String_arena arena = {.context = ctx};`
+struct String_arena {
+    Memory_context *context;
+    u8             *chunk;
+    s64             used;
+    s64             limit;
 };
 
 void *alloc(s64 count, u64 unit_size, Memory_context *context);
 void *zero_alloc(s64 count, u64 unit_size, Memory_context *context);
 void *resize(void *data, s64 new_limit, u64 unit_size, Memory_context *context);
+void *try_alloc(s64 count, u64 unit_size, Memory_context *context);
+void *try_zero_alloc(s64 count, u64 unit_size, Memory_context *context);
+void *try_resize(void *data, s64 new_limit, u64 unit_size, Memory_context *context);
 void dealloc(void *data, Memory_context *context);
 Memory_context *new_context(Memory_context *parent);
 void free_context(Memory_context *context);
 void reset_context(Memory_context *context);
 char *copy_string(char *source, Memory_context *context);
+void *arena_copy(String_arena *arena, void *data, s64 size);
+char *arena_copy_string(String_arena *arena, char *string, s64 length);
+void lock_context(Memory_context *context);
+void unlock_context(Memory_context *context);
+void set_context_lock_kind(Memory_context *context, Lock_kind kind);
+Lock_stats get_context_lock_stats(Memory_context *context);
+void set_context_budget(Memory_context *context, u64 budget);
+void set_memory_pressure_callback(Memory_context *context, Memory_pressure_callback *callback, void *data);
+u64 trim_context(Memory_context *context);
 void check_context_integrity(Memory_context *context);
 
+#ifdef PROFILING
+  // Record the call site of allocations. See profile.h.
+  #define alloc(COUNT, UNIT_SIZE, CONTEXT)       (EnterAllocSite(), leave_alloc_site(alloc((COUNT), (UNIT_SIZE), (CONTEXT))))
+  #define zero_alloc(COUNT, UNIT_SIZE, CONTEXT)  (EnterAllocSite(), leave_alloc_site(zero_alloc((COUNT), (UNIT_SIZE), (CONTEXT))))
+  #define try_alloc(COUNT, UNIT_SIZE, CONTEXT)       (EnterAllocSite(), leave_alloc_site(try_alloc((COUNT), (UNIT_SIZE), (CONTEXT))))
+  #define try_zero_alloc(COUNT, UNIT_SIZE, CONTEXT)  (EnterAllocSite(), leave_alloc_site(try_zero_alloc((COUNT), (UNIT_SIZE), (CONTEXT))))
+#endif
+
 //
 // The macro magic below sets up the New() macro so that the first argument is optional.
 // This optional argument is a count specifier. If left out, it defaults to one.
@@ -0,0 +1,102 @@
+#ifndef CTRL_H_INCLUDED
+#define CTRL_H_INCLUDED
+
+#include "basic.h"
+
+//
+// The hash table is a Swiss table, more or less. Next to the array of buckets is an array of control bytes, one for
+// each bucket. A control byte is CTRL_EMPTY if its bucket is empty. Otherwise it holds the top 7 bits of the hash of
+// the key in the bucket. We use linear probing, starting at the bucket hash & (num_buckets-1) and moving forwards, but
+// instead of visiting one bucket at a time we load the control bytes of the next GROUP_SIZE buckets and compare them
+// all against the key's 7 bits at once. We only look at the buckets themselves (and the keys) for the bytes that match.
+// Most of the time this means a lookup touches one cache line of control bytes and then goes straight to the key.
+//
+// So that a group can start at any bucket, the first GROUP_SIZE-1 control bytes are mirrored after the last one. This
+// is why there are always at least GROUP_SIZE buckets. The number of buckets is always a power of two, so we can wrap
+// around the end of the table with a mask instead of a division.
+//
+#define GROUP_SIZE    16
+#define CTRL_EMPTY    0x80
+#define CTRL_DELETED  0xfe // Only used in the old table while a map is being resized. See migrate_buckets() in map.c.
+
+#if defined(_MSC_VER)
+  #include <intrin.h> // For _BitScanForward().
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+  #include <emmintrin.h>
+
+  typedef __m128i Ctrl_group;
+
+  static inline Ctrl_group load_group(u8 *ctrl)         { return _mm_loadu_si128((__m128i *)ctrl); }
+  static inline u32 match_byte(Ctrl_group group, u8 byte) { return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte))); }
+  static inline u32 match_empty(Ctrl_group group)         { return match_byte(group, CTRL_EMPTY); }
+#else
+  // Without SSE2 we use two 64-bit words and some bit-twiddling. We assume a little-endian machine.
+
+  typedef struct {u64 words[2];} Ctrl_group;
+
+  #define LowBits   0x0101010101010101ull
+  #define HighBits  0x8080808080808080ull
+
+  static inline Ctrl_group load_group(u8 *ctrl)
+  {
+      Ctrl_group group;
+      memcpy(group.words, ctrl, sizeof(group.words));
+      return group;
+  }
+
+  static inline u32 high_bits_to_mask(u64 word)
+  // Turn a word where some bytes have their high bit set into an 8-bit mask with a bit for each of those bytes.
+  {
+      return (((word & HighBits) >> 7) * 0x0102040810204080ull) >> 56;
+  }
+
+  static inline u32 match_byte(Ctrl_group group, u8 byte)
+  // This can give false positives for a byte that follows a true match. That's OK because we check the hashes anyway.
+  {
+      u32 mask = 0;
+      for (int i = 0; i < 2; i++) {
+          u64 x = group.words[i] ^ (LowBits * byte);
+          mask |= high_bits_to_mask((x - LowBits) & ~x) << 8*i;
+      }
+      return mask;
+  }
+
+  static inline u32 match_empty(Ctrl_group group)
+  // CTRL_EMPTY is the only control byte with the high bit set and the second-lowest bit clear.
+  {
+      u64 *w = group.words;
+      return high_bits_to_mask(w[0] & ~(w[0] << 6)) | high_bits_to_mask(w[1] & ~(w[1] << 6)) << 8;
+  }
+#endif
+
+static inline int lowest_bit(u32 mask)
+// Return the index of the lowest set bit. The mask must not be zero.
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+static inline u8 hash_to_ctrl(u64 hash)
+{
+    return hash >> 57;
+}
+
+static inline bool is_full(u8 ctrl)
+{
+    return !(ctrl & 0x80);
+}
+
+static inline void set_ctrl(u8 *ctrl, s64 num_buckets, s64 bucket_index, u8 byte)
+{
+    ctrl[bucket_index] = byte;
+    if (bucket_index < GROUP_SIZE-1)  ctrl[num_buckets + bucket_index] = byte;
+}
+
+#endif // CTRL_H_INCLUDED
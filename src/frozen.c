@@ -0,0 +1,195 @@
+#include "frozen.h"
+
+static s64 group_of(u64 hash, s64 num_groups)
+// Use the low 32 bits of the hash to pick a group. Multiplying and shifting is a quicker way than % to map them onto the
+// range 0..num_groups-1.
+{
+    return ((hash & 0xffffffff) * num_groups) >> 32;
+}
+
+static s64 slot_of(u64 hash, u64 pilot, s64 count)
+// Mix the pilot into the whole hash and map the result onto 0..count-1. count is less than 2^32.
+{
+    u64 x = hash ^ (pilot * 0x9e3779b97f4a7c15);
+
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93;
+    x ^= x >> 32;
+
+    return ((x >> 32) * count) >> 32;
+}
+
+void freeze_map(Any_map *map, u64 key_size, u64 val_size, Any_frozen_map *frozen, Memory_context *context)
+// Fill in *frozen with a read-only copy of the map. See frozen.h.
+{
+    s64  n             = map->count;
+    bool copy_bytes    = !map->binary_mode || map->slice_mode;
+    s64  num_groups    = n/4 + 1;
+
+    if (n >= (s64)1 << 32)  Fatal("Can't freeze a map with %lld keys.", (long long)n);
+
+    // Everything we only need while building goes in a temporary context.
+    Memory_context *tmp = new_context(context);
+
+    u64 *hashes = New(n+1, u64, tmp);
+    for (s64 i = 0; i < n; i++) {
+        if (copy_bytes)  hashes[i] = map->key_info[i].hash;
+        else             hashes[i] = hash_bytes((u8 *)map->keys + i*key_size, key_size);
+    }
+
+    // Sort the keys by group. group_starts[g] is where group g's members start in members.
+    s64 *group_starts = New(num_groups+1, s64, tmp);
+    s64 *members      = New(n+1, s64, tmp);
+    {
+        for (s64 i = 0; i < n; i++)  group_starts[group_of(hashes[i], num_groups)+1] += 1;
+        for (s64 g = 0; g < num_groups; g++)  group_starts[g+1] += group_starts[g];
+
+        s64 *fill = New(num_groups, s64, tmp);
+        memcpy(fill, group_starts, num_groups*sizeof(s64));
+
+        for (s64 i = 0; i < n; i++)  members[fill[group_of(hashes[i], num_groups)]++] = i;
+    }
+
+    // Order the groups by size, biggest first. Groups are small, so we use a counting sort.
+    s64 *order = New(num_groups, s64, tmp);
+    {
+        s64 max_size = 0;
+        for (s64 g = 0; g < num_groups; g++)  max_size = Max(max_size, group_starts[g+1] - group_starts[g]);
+
+        s64 *size_starts = New(max_size+2, s64, tmp);
+        for (s64 g = 0; g < num_groups; g++)  size_starts[max_size - (group_starts[g+1] - group_starts[g]) + 1] += 1;
+        for (s64 s = 0; s <= max_size; s++)  size_starts[s+1] += size_starts[s];
+
+        for (s64 g = 0; g < num_groups; g++)  order[size_starts[max_size - (group_starts[g+1] - group_starts[g])]++] = g;
+    }
+
+    // Make one allocation for the pilots, the key info (if any), the keys, the values and the keys' bytes (if any).
+    u64 num_bytes = 0;
+    if (copy_bytes) {
+        for (s64 i = 0; i < n; i++)  num_bytes += map->key_info[i].length + !map->slice_mode; // Dict keys need a zero at the end.
+    }
+
+    u64 key_info_offset = align_to_16(num_groups * sizeof(u32));
+    u64 keys_offset     = key_info_offset + (copy_bytes ? n * sizeof(Key_info) : 0);
+    u64 vals_offset     = keys_offset + align_to_16((n+1) * key_size);
+    u64 bytes_offset    = vals_offset + align_to_16((n+1) * val_size);
+    u64 size            = bytes_offset + align_to_16(num_bytes);
+
+    u8 *storage = alloc(size/16, 16, context);
+
+    frozen->pilots      = (u32 *)storage;
+    frozen->key_info    = copy_bytes ? (Key_info *)(storage + key_info_offset) : NULL;
+    frozen->keys        = storage + keys_offset + key_size;
+    frozen->vals        = storage + vals_offset + val_size;
+    frozen->count       = n;
+    frozen->num_groups  = num_groups;
+    frozen->context     = context;
+    frozen->binary_mode = map->binary_mode;
+    frozen->slice_mode  = map->slice_mode;
+
+    // Find a pilot for each group.
+    u8  *taken = New(n+1, u8, tmp);
+    s64 *slots = New(n+1, s64, tmp);
+
+    for (s64 o = 0; o < num_groups; o++) {
+        s64  g          = order[o];
+        s64 *group      = &members[group_starts[g]];
+        s64  group_size = group_starts[g+1] - group_starts[g];
+
+        frozen->pilots[g] = 0;
+        if (!group_size)  continue;
+
+        // No pilot can separate two keys with the same hash.
+        for (s64 a = 0; a < group_size; a++) {
+            for (s64 b = a+1; b < group_size; b++) {
+                if (hashes[group[a]] == hashes[group[b]])  Fatal("Can't freeze a map with two keys that have the same 64-bit hash.");
+            }
+        }
+
+        for (u64 pilot = 0; ; pilot++) {
+            if (pilot > UINT32_MAX)  Fatal("Couldn't find a perfect hash function for the map.");
+
+            s64 j = 0;
+            for (; j < group_size; j++) {
+                s64 slot = slot_of(hashes[group[j]], pilot, n);
+                if (taken[slot])  break;
+
+                taken[slot]     = true;
+                slots[group[j]] = slot;
+            }
+
+            if (j == group_size) {
+                frozen->pilots[g] = pilot;
+                break;
+            }
+
+            // Undo the slots we took for this pilot.
+            while (j--)  taken[slots[group[j]]] = false;
+        }
+    }
+
+    // Copy the keys and values into their slots.
+    u8 *bytes = storage + bytes_offset;
+
+    for (s64 i = 0; i < n; i++) {
+        s64 slot = slots[i];
+
+        if (map->slice_mode) {
+            Byte_slice slice = ((Byte_slice *)map->keys)[i];
+            if (slice.size)  memcpy(bytes, slice.data, slice.size);
+            ((Byte_slice *)frozen->keys)[slot] = (Byte_slice){bytes, slice.size};
+            bytes += slice.size;
+        } else if (!map->binary_mode) {
+            s64 length = map->key_info[i].length;
+            memcpy(bytes, ((char **)map->keys)[i], length+1);
+            ((char **)frozen->keys)[slot] = (char *)bytes;
+            bytes += length+1;
+        } else {
+            memcpy((u8 *)frozen->keys + slot*key_size, (u8 *)map->keys + i*key_size, key_size);
+        }
+
+        if (copy_bytes)  frozen->key_info[slot] = map->key_info[i];
+
+        memcpy((u8 *)frozen->vals + slot*val_size, (u8 *)map->vals + i*val_size, val_size);
+    }
+
+    // Keep the map's default value.
+    if (map->vals)  memcpy((u8 *)frozen->vals - val_size, (u8 *)map->vals - val_size, val_size);
+    else            memset((u8 *)frozen->vals - val_size, 0, val_size);
+
+    free_context(tmp);
+}
+
+s64 frozen_find(Any_frozen_map *frozen, u64 key_size, void *key)
+// Return the key's index in the frozen map's key-value arrays, or -1 if it's not there. KEY points to the key.
+{
+    if (!frozen->count)  return -1;
+
+    void *data;
+    s64   length;
+
+    if (frozen->slice_mode) {
+        data   = ((Byte_slice *)key)->data;
+        length = ((Byte_slice *)key)->size;
+    } else if (!frozen->binary_mode) {
+        data   = *(char **)key;
+        length = strlen(data);
+    } else {
+        data   = key;
+        length = key_size;
+    }
+
+    u64 hash = hash_bytes(data, length);
+    s64 slot = slot_of(hash, frozen->pilots[group_of(hash, frozen->num_groups)], frozen->count);
+
+    if (frozen->key_info) {
+        Key_info *info = &frozen->key_info[slot];
+        if (info->hash != hash || info->length != length)  return -1;
+
+        void *stored = (frozen->slice_mode) ? (void *)((Byte_slice *)frozen->keys)[slot].data : (void *)((char **)frozen->keys)[slot];
+
+        return (length && memcmp(data, stored, length)) ? -1 : slot;
+    }
+
+    return memcmp(data, (u8 *)frozen->keys + slot*key_size, key_size) ? -1 : slot;
+}
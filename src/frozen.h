@@ -0,0 +1,69 @@
+#ifndef FROZEN_H_INCLUDED
+#define FROZEN_H_INCLUDED
+
+#include "map.h"
+
+//
+// A FrozenMap is a read-only copy of a Map, Dict or SliceMap, for maps that are built once and then only read. It has no
+// hash table. Instead it uses a minimal perfect hash: a function that sends each of its keys to a different slot in
+// 0..count-1. The keys and values sit in those slots, so there are no empty slots and no probing. A lookup is one hash,
+// one read from a small table, one slot access and one key comparison.
+//
+// The hash function works like PTHash and CHD (compress, hash and displace). Keys are split into groups of about four
+// by their hash. Each group has a 32-bit "pilot" that, mixed with a key's hash, gives the key's slot. When freezing the
+// map, we go through the groups from biggest to smallest and try pilots until we find one that puts all the group's keys
+// in free slots. The first groups almost always succeed straight away. Later ones take longer as the slots fill up, but
+// they're small.
+//
+//     Dict(int) *dict = NewDict(dict, ctx);
+//     *Set(dict, "apple") = 1;
+//     ...
+//     FrozenMap(char *, int) *frozen = FreezeMap(frozen, dict, ctx);
+//
+//     char *key = "apple";
+//     int *val = FrozenGet(frozen, &key);  // Like *Get(), this points to the default value if the key isn't there.
+//
+// FrozenGet() and FrozenIsSet() take a pointer to the key so that they don't have to write to the map. This means many
+// threads can read a frozen map at once without locking. Frozen dicts and slice maps copy their keys' bytes, so you can
+// free the original map. Everything is in one allocation from the context, besides the FrozenMap struct itself.
+//
+// You can iterate over .keys and .vals as usual, although the order won't be the same as the original map's.
+//
+
+#define FrozenMap(KEY_TYPE, VAL_TYPE)   \
+    struct {                            \
+        KEY_TYPE       *keys;           \
+        VAL_TYPE       *vals;           \
+        s64             count;          \
+                                        \
+        u32            *pilots;         \
+        s64             num_groups;     \
+        Key_info       *key_info;       \
+                                        \
+        Memory_context *context;        \
+        bool            binary_mode;    \
+        bool            slice_mode;     \
+    }
+
+typedef FrozenMap(void, void) Any_frozen_map;
+
+void freeze_map(Any_map *map, u64 key_size, u64 val_size, Any_frozen_map *frozen, Memory_context *context);
+s64 frozen_find(Any_frozen_map *frozen, u64 key_size, void *key);
+
+// The sizeof() expressions make the compiler check that the two maps' key and value types match.
+#define FreezeMap(FROZEN, MAP, CONTEXT) \
+    (EnterAllocSite(), \
+     (FROZEN) = zero_alloc(1, sizeof(*FROZEN), (CONTEXT)), \
+     (void)sizeof(1 ? (MAP)->keys : (FROZEN)->keys), \
+     (void)sizeof(1 ? (MAP)->vals : (FROZEN)->vals), \
+     freeze_map((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), (Any_frozen_map *)(FROZEN), (CONTEXT)), \
+     LeaveAllocSite(), \
+     (FROZEN))
+
+#define FrozenGet(MAP, KEY_PTR) \
+    (&(MAP)->vals[frozen_find((Any_frozen_map *)(MAP), sizeof(*(MAP)->keys), (1 ? (KEY_PTR) : (MAP)->keys))])
+
+#define FrozenIsSet(MAP, KEY_PTR) \
+    (frozen_find((Any_frozen_map *)(MAP), sizeof(*(MAP)->keys), (1 ? (KEY_PTR) : (MAP)->keys)) >= 0)
+
+#endif // FROZEN_H_INCLUDED
@@ -0,0 +1,25 @@
+#include "intern.h"
+
+String_pool *new_string_pool(Memory_context *context)
+{
+    String_pool *pool = NewStringSet(pool, context);
+    pool->pack_keys = true;
+
+    return pool;
+}
+
+char *intern(String_pool *pool, char *string, s64 length)
+// Return the pool's copy of the first length bytes of the string, adding it if it isn't there yet.
+{
+    grow_map_if_needed((Any_map *)pool, sizeof(char *), 0);
+
+    Probe_key key   = {string, length, hash_bytes(string, length)};
+    s64       index = set_probe_key((Any_map *)pool, sizeof(char *), key);
+
+    return pool->keys[index];
+}
+
+char *intern_string(String_pool *pool, char *string)
+{
+    return intern(pool, string, strlen(string));
+}
@@ -0,0 +1,34 @@
+#ifndef INTERN_H_INCLUDED
+#define INTERN_H_INCLUDED
+
+#include "map.h"
+
+//
+// A String_pool interns strings: it keeps one copy of each distinct string, and intern() returns a pointer to that copy.
+// Two strings interned in the same pool are equal if and only if their pointers are equal, so you can compare them with
+// == instead of strcmp(), and use them as keys of a binary map, which hashes the 8-byte pointer rather than the string:
+//
+//     String_pool *pool = new_string_pool(ctx);
+//
+//     char *a = intern_string(pool, "apple");
+//     char *b = intern(pool, "apples", 5);  // Doesn't have to be zero-terminated.
+//     assert(a == b);
+//
+//     Map(char *, int) *counts = NewMap(counts, ctx);
+//     *Set(counts, a) += 1;
+//
+// A pool is a string set with packed keys, so the copies live in the pool's String_arena (.key_arena) rather than each
+// having its own allocation, and the hash table is the usual map. The copies are zero-terminated, and they last until
+// the pool's context is freed. Since it's a set, you can iterate over .keys to see every string in the pool.
+//
+// Don't delete strings from a pool. Deleting doesn't free a packed key anyway, and interning the string again would
+// give you a different pointer.
+//
+
+typedef StringSet String_pool;
+
+String_pool *new_string_pool(Memory_context *context);
+char *intern(String_pool *pool, char *string, s64 length);
+char *intern_string(String_pool *pool, char *string);
+
+#endif // INTERN_H_INCLUDED
@@ -0,0 +1,131 @@
+#define _GNU_SOURCE // For syscall().
+
+#include "lock.h"
+#include "trace.h"
+
+#if OS == WINDOWS
+  #include <windows.h>
+#else
+  #include <linux/futex.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+static int num_spins = -1; // How many times an adaptive lock spins before sleeping. Set by init_lock().
+
+static void wait_on_futex(u32 *futex, u32 expected)
+// Sleep until someone wakes us, as long as *futex == expected. This may return spuriously.
+{
+#if OS == WINDOWS
+    WaitOnAddress(futex, &expected, sizeof(expected), INFINITE);
+#else
+    syscall(SYS_futex, futex, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+#endif
+}
+
+static void wake_futex(u32 *futex)
+// Wake one thread waiting on the futex.
+{
+#if OS == WINDOWS
+    WakeByAddressSingle(futex);
+#else
+    syscall(SYS_futex, futex, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+}
+
+void init_lock(Lock *lock, Lock_kind kind)
+{
+    if (num_spins < 0)  num_spins = (get_cpu_count() > 1) ? 100 : 0;
+
+    *lock = (Lock){.kind = kind};
+
+    pthread_mutex_init(&lock->mutex, NULL);
+}
+
+void destroy_lock(Lock *lock)
+// Nobody may hold the lock or be waiting for it.
+{
+    assert(!AtomicLoad(&lock->futex));
+
+    int error = pthread_mutex_destroy(&lock->mutex);
+    assert(!error);
+}
+
+static bool try_acquire(Lock *lock)
+{
+    if (lock->kind == LOCK_MUTEX)  return !pthread_mutex_trylock(&lock->mutex);
+
+    return AtomicCompareSwap(&lock->futex, 0, 1) == 0;
+}
+
+void acquire_lock(Lock *lock)
+{
+    u64 trace_start = TraceTime();
+
+    if (try_acquire(lock)) {
+        lock->stats.num_acquisitions += 1;
+    } else {
+        // Someone else has the lock.
+        u64 start = get_time_ns();
+
+        if (lock->kind == LOCK_MUTEX) {
+            pthread_mutex_lock(&lock->mutex);
+        } else {
+            // Spin for a while in case the lock is released soon.
+            u32 state = 1;
+            for (int i = 0; i < num_spins; i++) {
+                CpuRelax();
+                state = AtomicLoad(&lock->futex);
+                if (!state && (state = AtomicCompareSwap(&lock->futex, 0, 1)) == 0)  break;
+            }
+
+            if (state) {
+                // This is Ulrich Drepper's futex-based mutex, from his paper "Futexes Are Tricky". Once we've been made
+                // to wait, we set the state to 2 so the thread that releases the lock knows to wake someone.
+                if (state != 2)  state = AtomicExchange(&lock->futex, 2);
+                while (state) {
+                    wait_on_futex(&lock->futex, 2);
+                    state = AtomicExchange(&lock->futex, 2);
+                }
+            }
+        }
+
+        lock->stats.num_acquisitions += 1;
+        lock->stats.num_contended    += 1;
+        lock->stats.wait_time        += get_time_ns() - start;
+    }
+
+#ifdef TRACING
+    lock->locked_at = TraceTime();
+    TraceEvent(TRACE_LOCK_WAIT, trace_start, lock);
+#endif
+}
+
+void release_lock(Lock *lock)
+{
+#ifdef TRACING
+    TraceEvent(TRACE_LOCK_HOLD, lock->locked_at, lock);
+#endif
+
+    if (lock->kind == LOCK_MUTEX) {
+        pthread_mutex_unlock(&lock->mutex);
+    } else {
+        // If the state was 2, someone may be waiting.
+        if (AtomicAdd(&lock->futex, -1) != 1) {
+            AtomicStore(&lock->futex, 0);
+            wake_futex(&lock->futex);
+        }
+    }
+}
+
+Lock_stats get_lock_stats(Lock *lock)
+// The counts are only updated by the thread holding the lock, so if other threads are using the lock, the result may be slightly out of date.
+{
+    Lock_stats stats;
+
+    stats.num_acquisitions = AtomicLoad(&lock->stats.num_acquisitions);
+    stats.num_contended    = AtomicLoad(&lock->stats.num_contended);
+    stats.wait_time        = AtomicLoad(&lock->stats.wait_time);
+
+    return stats;
+}
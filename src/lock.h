@@ -0,0 +1,52 @@
+#ifndef LOCK_H_INCLUDED
+#define LOCK_H_INCLUDED
+
+#include <pthread.h>
+
+#include "basic.h"
+
+//
+// A lock that counts how often it's acquired, how often it's contended and how long threads wait for it.
+// It comes in two kinds:
+//
+//   LOCK_MUTEX     A pthread mutex.
+//   LOCK_ADAPTIVE  Spins for a short while, then sleeps on a futex (or WaitOnAddress() on Windows). It doesn't spin on
+//                  machines with only one CPU, since the thread holding the lock can't make progress while we spin.
+//
+// We only read the clock when a lock is contended, so the statistics don't slow down uncontended locking.
+//
+
+enum Lock_kind {
+    LOCK_MUTEX,
+    LOCK_ADAPTIVE,
+};
+
+typedef enum   Lock_kind  Lock_kind;
+typedef struct Lock       Lock;
+typedef struct Lock_stats Lock_stats;
+
+struct Lock_stats {
+    s64 num_acquisitions;
+    s64 num_contended;    // How many acquisitions had to wait for another thread.
+    u64 wait_time;        // Total nanoseconds spent waiting.
+};
+
+struct Lock {
+    pthread_mutex_t mutex;   // Used by LOCK_MUTEX.
+    u32             futex;   // Used by LOCK_ADAPTIVE. 0 means unlocked, 1 means locked, 2 means locked and maybe someone's waiting.
+    Lock_kind       kind;
+
+    // Only modified by the thread holding the lock.
+    Lock_stats      stats;
+#ifdef TRACING
+    u64             locked_at; // When the lock was last acquired, for tracing how long it's held.
+#endif
+};
+
+void init_lock(Lock *lock, Lock_kind kind);
+void destroy_lock(Lock *lock);
+void acquire_lock(Lock *lock);
+void release_lock(Lock *lock);
+Lock_stats get_lock_stats(Lock *lock);
+
+#endif // LOCK_H_INCLUDED
@@ -1,299 +1,778 @@
 #include "map.h"
-
-// The below work as long as 1 < BITS < the number of bits in UINT. Otherwise it's undefined behaviour.
-#define RotateLeft(UINT, BITS)   (((UINT) << (BITS)) | ((UINT) >> (8*sizeof(UINT) - (BITS))))
-#define RotateRight(UINT, BITS)  (((UINT) >> (BITS)) | ((UINT) << (8*sizeof(UINT) - (BITS))))
+#include "ctrl.h"
+#include "trace.h"
 
 u64 hash_seed = 0x7071067811865475;
 
+static inline void multiply_128(u64 *a, u64 *b)
+// Multiply two 64-bit numbers. Put the low 64 bits of the result in *a and the high 64 bits in *b.
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t)*a * *b;
+    *a = (u64)product;
+    *b = (u64)(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    *a = _umul128(*a, *b, b);
+#else
+    u64 a_hi = *a >> 32,  a_lo = (u32)*a;
+    u64 b_hi = *b >> 32,  b_lo = (u32)*b;
+    u64 hi_hi = a_hi*b_hi,  hi_lo = a_hi*b_lo,  lo_hi = a_lo*b_hi,  lo_lo = a_lo*b_lo;
+    u64 middle = hi_lo + (lo_lo >> 32) + (u32)lo_hi;
+    *a = (middle << 32) | (u32)lo_lo;
+    *b = hi_hi + (middle >> 32) + (lo_hi >> 32);
+#endif
+}
+
+static inline u64 mix(u64 a, u64 b)
+{
+    multiply_128(&a, &b);
+    return a ^ b;
+}
+
+// These do unaligned little-endian loads. Compilers turn the memcpy into a single load instruction.
+static inline u64 read_u64(u8 *p)  { u64 v;  memcpy(&v, p, sizeof(v));  return v; }
+static inline u64 read_u32(u8 *p)  { u32 v;  memcpy(&v, p, sizeof(v));  return v; }
+
 u64 hash_bytes(void *p, u64 size)
-// Sean Barrett's version of SipHash. Plus it won't return zero.
-{
-    u64 seed = hash_seed;
-
-    int siphash_c_rounds = 1;
-    int siphash_d_rounds = 1;
-
-    u8 *d = p;
-
-    if (size == 4) {
-        u32 hash = d[0] | ((u32)d[1] << 8) | ((u32)d[2] << 16) | ((u32)d[3] << 24);
-        hash ^= seed;
-        hash = (hash ^ 61) ^ (hash >> 16);
-        hash = hash + (hash << 3);
-        hash = hash ^ (hash >> 4);
-        hash = hash * 0x27d4eb2d;
-        hash ^= seed;
-        hash = hash ^ (hash >> 15);
-        u64 hash64 = (((u64)hash << 16 << 16) | hash) ^ seed;
-        return (hash64) ? hash64 : 1;
+// Wang Yi's wyhash, final version 4. It reads the key 8 bytes at a time (or two overlapping 4-byte reads for keys of 4
+// to 16 bytes) and mixes with 64x64->128-bit multiplies. Long keys go through three independent lanes of 16 bytes at a
+// time, so the CPU can overlap the multiplies. Plus it won't return zero.
+{
+    static u64 const secret[4] = {0x2d358dccaa6c78a5, 0x8bb84b93962eacc9, 0x4b33a62ed433d4a3, 0x4d5a2da51de1aa47};
+
+    u8 *d    = p;
+    u64 seed = hash_seed ^ mix(hash_seed ^ secret[0], secret[1]);
+    u64 a, b;
+
+    if (size <= 16) {
+        if (size >= 4) {
+            u64 offset = (size >> 3) << 2; // 0 for 4-7 bytes, 4 for 8-16 bytes.
+            a = (read_u32(d) << 32) | read_u32(d + offset);
+            b = (read_u32(d + size - 4) << 32) | read_u32(d + size - 4 - offset);
+        } else if (size > 0) {
+            a = ((u64)d[0] << 16) | ((u64)d[size >> 1] << 8) | d[size-1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        u64 remaining = size;
+
+        if (remaining >= 48) {
+            u64 seed1 = seed;
+            u64 seed2 = seed;
+            do {
+                seed  = mix(read_u64(d)    ^ secret[1], read_u64(d+8)  ^ seed);
+                seed1 = mix(read_u64(d+16) ^ secret[2], read_u64(d+24) ^ seed1);
+                seed2 = mix(read_u64(d+32) ^ secret[3], read_u64(d+40) ^ seed2);
+                d         += 48;
+                remaining -= 48;
+            } while (remaining >= 48);
+            seed ^= seed1 ^ seed2;
+        }
+
+        while (remaining > 16) {
+            seed = mix(read_u64(d) ^ secret[1], read_u64(d+8) ^ seed);
+            d         += 16;
+            remaining -= 16;
+        }
+
+        // The last 16 bytes, which may overlap with bytes we've already read.
+        a = read_u64(d + remaining - 16);
+        b = read_u64(d + remaining - 8);
     }
-    if (size == 8 && sizeof(u64) == 8) {
-        u64 hash = d[0] | ((u64)d[1] << 8) | ((u64)d[2] << 16) | ((u64)d[3] << 24);
-        hash |= ((u64)d[4] | ((u64)d[5] << 8) | ((u64)d[6] << 16) | ((u64)d[7] << 24)) << 16 << 16;
-        hash ^= seed;
-        hash = (~hash) + (hash << 21);
-        hash ^= RotateRight(hash, 24);
-        hash *= 265;
-        hash ^= RotateRight(hash, 14);
-        hash ^= seed;
-        hash *= 21;
-        hash ^= RotateRight(hash, 28);
-        hash += (hash << 31);
-        hash = (~hash) + (hash << 18);
-        return (hash) ? hash : 1;
+
+    a ^= secret[1];
+    b ^= seed;
+    multiply_128(&a, &b);
+
+    u64 hash = mix(a ^ secret[0] ^ size, b ^ secret[1]);
+
+    return (hash) ? hash : 1;
+}
+
+u64 hash_string(char *string)
+// Also won't return zero. We find the length first because strlen() is vectorised, then hash the bytes all together.
+{
+    return hash_bytes(string, strlen(string));
+}
+
+static bool has_key_info(Any_map *map)
+// Dicts and slice maps have variable-length keys, so they keep a Key_info for each key.
+{
+    return map->slice_mode || !map->binary_mode;
+}
+
+Probe_key get_probe_key(Any_map *map, u64 key_size, void *key)
+// Work out the bytes, length and hash of a key as the map sees it. KEY points to a key of the map's key type.
+{
+    Probe_key probe;
+
+    if (map->slice_mode) {
+        probe.data   = ((Byte_slice *)key)->data;
+        probe.length = ((Byte_slice *)key)->size;
+    } else if (!map->binary_mode) {
+        probe.data   = *(char **)key;
+        probe.length = strlen(probe.data);
+    } else {
+        probe.data   = key;
+        probe.length = key_size;
     }
+    probe.hash = hash_bytes(probe.data, probe.length);
 
-    u64 v0 = ((((u64)0x736f6d65 << 16) << 16) + 0x70736575) ^  seed;
-    u64 v1 = ((((u64)0x646f7261 << 16) << 16) + 0x6e646f6d) ^ ~seed;
-    u64 v2 = ((((u64)0x6c796765 << 16) << 16) + 0x6e657261) ^  seed;
-    u64 v3 = ((((u64)0x74656462 << 16) << 16) + 0x79746573) ^ ~seed;
-
-#define SipRound() \
-    do { \
-        v0 += v1;  v1 = RotateLeft(v1, 13);  v1 ^= v0;  v0 = RotateLeft(v0, 8*sizeof(u8)/2); \
-        v2 += v3;  v3 = RotateLeft(v3, 16);  v3 ^= v2;                                       \
-        v2 += v1;  v1 = RotateLeft(v1, 17);  v1 ^= v2;  v2 = RotateLeft(v2, 8*sizeof(u8)/2); \
-        v0 += v3;  v3 = RotateLeft(v3, 21);  v3 ^= v0;                                       \
-    } while (0)
-
-    u64 data, i;
-    for (i = 0; i+sizeof(u64) <= size; i+=sizeof(u64), d+=sizeof(u64)) {
-        data = d[0] | ((u64)d[1] << 8) | ((u64)d[2] << 16) | ((u64)d[3] << 24);
-        data |= ((u64)d[4] | ((u64)d[5] << 8) | ((u64)d[6] << 16) | ((u64)d[7] << 24)) << 16 << 16;
-        v3 ^= data;
-        for (int j = 0; j < siphash_c_rounds; j++)  SipRound();
-        v0 ^= data;
+    return probe;
+}
+
+static bool keys_match(Any_map *map, u64 key_size, Probe_key *key, s64 kv_index)
+// We only call this after checking the hashes match.
+{
+    if (has_key_info(map)) {
+        // Check the lengths before comparing any bytes.
+        if (map->key_info[kv_index].length != key->length)  return false;
+
+        void *data = (map->slice_mode) ? (void *)((Byte_slice *)map->keys)[kv_index].data : (void *)((char **)map->keys)[kv_index];
+
+        // Empty slice keys can have null data, which memcmp() mustn't see.
+        return !key->length || !memcmp(key->data, data, key->length);
     }
-    data = size << (8*sizeof(u8)-8);
-
-    switch (size - i) {
-      case 7:  data |= ((u64)d[6] << 24) << 24; // fall through
-      case 6:  data |= ((u64)d[5] << 20) << 20; // fall through
-      case 5:  data |= ((u64)d[4] << 16) << 16; // fall through
-      case 4:  data |= (d[3] << 24); // fall through
-      case 3:  data |= (d[2] << 16); // fall through
-      case 2:  data |= (d[1] << 8); // fall through
-      case 1:  data |= d[0]; // fall through
-      case 0:  break;
+
+    return !memcmp(key->data, (u8 *)map->keys + kv_index*key_size, key_size);
+}
+
+static s64 find_empty_bucket(u8 *ctrl, s64 num_buckets, u64 hash)
+// Return the index of the first empty bucket at or after the hash's home bucket.
+{
+    u64 mask        = num_buckets-1;
+    s64 group_start = hash & mask;
+
+    while (true) {
+        u32 empty = match_empty(load_group(&ctrl[group_start]));
+        if (empty)  return (group_start + lowest_bit(empty)) & mask;
+
+        group_start = (group_start + GROUP_SIZE) & mask;
     }
+}
 
-    v3 ^= data;
-    for (int j = 0; j < siphash_c_rounds; j++)  SipRound();
-    v0 ^= data;
-    v2 ^= 0xff;
-    for (int j = 0; j < siphash_d_rounds; j++)  SipRound();
-    v0 = v1^v2^v3;
-    return (v0) ? v0 : 1;
+static s64 get_distance(u64 hash, s64 bucket_index, u64 mask)
+// How many buckets past its home a bucket with this hash is.
+{
+    return (bucket_index - (hash & mask)) & mask;
 }
 
-u64 hash_string(char *string)
-// Thomas Wang's mix function, via Sean Barrett. Also won't return zero.
-{
-    u64 seed = hash_seed;
-    u64 hash = seed;
-    while (*string)  hash = RotateLeft(hash, 9) + (u8)*string++;
-    hash ^= seed;
-    hash = (~hash) + (hash << 18);
-    hash ^= hash ^ RotateRight(hash, 31);
-    hash = hash * 21;
-    hash ^= hash ^ RotateRight(hash, 11);
-    hash += (hash << 6);
-    hash ^= RotateRight(hash, 22);
-    hash += seed;
-    return (hash) ? hash : 1;
+static s64 find_bucket(Any_map *map, void *buckets, u8 *ctrl, s64 num_buckets, u64 key_size, Probe_key *key, s64 *empty_index)
+// Return the index of the bucket containing the key, or -1 if it's not there. If it's not there, set *empty_index to
+// the index of the bucket where the key should go, or -1 if it's a Robin Hood map and we stopped early.
+{
+    u64 mask        = num_buckets-1;
+    u8  hash_byte   = hash_to_ctrl(key->hash);
+    s64 group_start = key->hash & mask;
+
+    while (true) {
+        Ctrl_group group = load_group(&ctrl[group_start]);
+
+        for (u32 match = match_byte(group, hash_byte); match; match &= match-1) {
+            s64 bucket_index = (group_start + lowest_bit(match)) & mask;
+
+            if (!bucket_hash_matches(buckets, num_buckets, bucket_index, key->hash))  continue;
+            if (keys_match(map, key_size, key, get_bucket_kv_index(buckets, num_buckets, bucket_index)))  return bucket_index;
+        }
+
+        // If there's an empty bucket in this group, the key would have been before it. Any matches after the empty
+        // bucket can't have been our key, because keys are unique.
+        u32 empty = match_empty(group);
+        if (empty) {
+            *empty_index = (group_start + lowest_bit(empty)) & mask;
+            return -1;
+        }
+
+        // In a Robin Hood map, if the last bucket in the group is closer to its home than our key would be, our key
+        // would have taken its place. So the key isn't here. (We can't tell anything from a deleted bucket.)
+        if (map->robin_hood) {
+            s64 last = (group_start + GROUP_SIZE-1) & mask;
+
+            if (is_full(ctrl[last]) && get_distance(get_bucket_hash(buckets, num_buckets, last), last, mask) < get_distance(key->hash, last, mask)) {
+                *empty_index = -1;
+                return -1;
+            }
+        }
+
+        group_start = (group_start + GROUP_SIZE) & mask;
+    }
 }
 
-bool init_map_if_needed(void **keys, void **vals, s64 *count, s64 *limit, u64 key_size, u64 val_size, Hash_bucket **buckets, s64 *num_buckets, Memory_context *context)
-// Return true if the map needed initting.
+static s64 insert_bucket(Any_map *map, u64 hash, s64 kv_index, u8 ctrl_byte, s64 empty_index)
+// Put a bucket for the key-value pair at kv_index in the new table and return the bucket's index. If the map isn't a
+// Robin Hood map, the bucket goes in empty_index, or in the first empty bucket after its home if empty_index is -1.
+//
+// The hash only has to be complete if the new table has full buckets. Otherwise its low 32 bits will do, and we take
+// the control byte separately, since it comes from the top of the hash.
+//
+// In a Robin Hood map, a bucket that's further from its home than the one it's passing takes that one's place, and the
+// displaced bucket carries on looking for a spot. This keeps the buckets in each run of full buckets sorted by their
+// homes, which evens out the probe lengths and lets lookups for missing keys stop early. See find_bucket().
 {
-    if (*keys)  return false;
+    s64 num_buckets = map->num_buckets;
+    u64 mask        = num_buckets-1;
+
+    if (!map->robin_hood) {
+        if (empty_index < 0)  empty_index = find_empty_bucket(map->ctrl, num_buckets, hash);
+
+        put_bucket(map->buckets, num_buckets, empty_index, hash, kv_index);
+        set_ctrl(map->ctrl, num_buckets, empty_index, ctrl_byte);
+
+        return empty_index;
+    }
+
+    s64 result   = -1;
+    s64 i        = hash & mask;
+    s64 distance = 0;
+
+    while (true) {
+        if (map->ctrl[i] == CTRL_EMPTY) {
+            put_bucket(map->buckets, num_buckets, i, hash, kv_index);
+            set_ctrl(map->ctrl, num_buckets, i, ctrl_byte);
+
+            return (result < 0) ? i : result;
+        }
+
+        u64 resident_hash     = get_bucket_hash(map->buckets, num_buckets, i);
+        s64 resident_distance = get_distance(resident_hash, i, mask);
+
+        if (resident_distance < distance) {
+            s64 resident_kv_index = get_bucket_kv_index(map->buckets, num_buckets, i);
+            u8  resident_ctrl     = map->ctrl[i];
+
+            put_bucket(map->buckets, num_buckets, i, hash, kv_index);
+            set_ctrl(map->ctrl, num_buckets, i, ctrl_byte);
+            if (result < 0)  result = i;
+
+            hash      = resident_hash;
+            kv_index  = resident_kv_index;
+            ctrl_byte = resident_ctrl;
+            distance  = resident_distance;
+        }
+
+        i = (i+1) & mask;
+        distance += 1;
+    }
+}
+
+//
+// The Bloom filter is an array of 64-byte blocks. Each key sets a few bits in one block, so checking for a key costs at
+// most one cache miss. The top half of the hash picks the block, and we mix the hash again to pick the bits, because
+// the low bits already pick the key's home bucket.
+//
+#define BLOOM_BLOCK_BITS  512
+
+static u64 *get_bloom_block(Any_map *map, u64 hash)
+{
+    s64 block = ((hash >> 32) * map->bloom_num_blocks) >> 32;
+
+    return &map->bloom[block * BLOOM_BLOCK_BITS/64];
+}
+
+static s64 get_bloom_num_hashes(Any_map *map)
+// The best number of hashes is about ln 2 times the bits per key. More than 8 doesn't help within one block.
+{
+    return Max(1, Min(8, map->bloom_bits_per_key * 69 / 100));
+}
+
+static void bloom_add(Any_map *map, u64 hash)
+{
+    u64 *block = get_bloom_block(map, hash);
+    u64  bits  = (hash ^ (hash >> 29)) * 0xbf58476d1ce4e5b9;
+
+    for (s64 i = 0; i < get_bloom_num_hashes(map); i++) {
+        u64 bit = bits >> 55;
+        block[bit/64] |= (u64)1 << (bit%64);
+
+        bits = (bits << 9) | (bits >> 55);
+    }
+}
+
+static bool bloom_might_contain(Any_map *map, u64 hash)
+{
+    u64 *block = get_bloom_block(map, hash);
+    u64  bits  = (hash ^ (hash >> 29)) * 0xbf58476d1ce4e5b9;
+
+    for (s64 i = 0; i < get_bloom_num_hashes(map); i++) {
+        u64 bit = bits >> 55;
+        if (!(block[bit/64] & ((u64)1 << (bit%64))))  return false;
+
+        bits = (bits << 9) | (bits >> 55);
+    }
+
+    return true;
+}
+
+static s64 find_key(Any_map *map, u64 key_size, Probe_key *key, s64 *empty_index)
+// Like find_bucket() but for the map as a whole. If the map is being resized and the key is still in the old table,
+// move it to the new table before returning its new bucket index.
+{
+    // If the map has a Bloom filter, most missing keys stop here. The filter covers the keys in both tables.
+    if (map->bloom && !bloom_might_contain(map, key->hash)) {
+        *empty_index = -1;
+        return -1;
+    }
+
+    s64 bucket_index = find_bucket(map, map->buckets, map->ctrl, map->num_buckets, key_size, key, empty_index);
+
+    if (bucket_index >= 0 || !map->old_buckets)  return bucket_index;
+
+    s64 old_empty_index;
+    s64 old_index = find_bucket(map, map->old_buckets, map->old_ctrl, map->old_num_buckets, key_size, key, &old_empty_index);
+
+    if (old_index < 0)  return -1;
+
+    s64 kv_index = get_bucket_kv_index(map->old_buckets, map->old_num_buckets, old_index);
+
+    bucket_index = insert_bucket(map, key->hash, kv_index, map->old_ctrl[old_index], *empty_index);
+    set_ctrl(map->old_ctrl, map->old_num_buckets, old_index, CTRL_DELETED);
+
+    return bucket_index;
+}
+
+static s64 find_bucket_by_index(void *buckets, u8 *ctrl, s64 num_buckets, u64 hash, s64 kv_index)
+// Return the index of the bucket for the key-value pair at kv_index, or -1 if it's not in this table.
+{
+    u64 mask        = num_buckets-1;
+    s64 group_start = hash & mask;
+
+    while (true) {
+        Ctrl_group group = load_group(&ctrl[group_start]);
+
+        for (u32 match = match_byte(group, hash_to_ctrl(hash)); match; match &= match-1) {
+            s64 bucket_index = (group_start + lowest_bit(match)) & mask;
+            if (get_bucket_kv_index(buckets, num_buckets, bucket_index) == kv_index)  return bucket_index;
+        }
+
+        if (match_empty(group))  return -1;
+
+        group_start = (group_start + GROUP_SIZE) & mask;
+    }
+}
+
+static u64 get_full_hash(Any_map *map, u64 key_size, s64 kv_index)
+// Dicts and slice maps have their keys' hashes cached. Binary maps have to hash the key again.
+{
+    if (has_key_info(map))  return map->key_info[kv_index].hash;
+
+    return hash_bytes((u8 *)map->keys + kv_index*key_size, key_size);
+}
+
+static void rebuild_bloom(Any_map *map, u64 key_size)
+// Make a new Bloom filter sized for the map's key-value arrays and add all the keys to it. This also clears the bits of
+// any keys that have been deleted since the filter was last built.
+{
+    if (map->bloom)  dealloc(map->bloom, map->context);
+    map->bloom            = NULL;
+    map->bloom_num_blocks = 0;
+
+    if (map->bloom_bits_per_key <= 0)  return;
+
+    s64 num_blocks = Max(1, (map->limit * map->bloom_bits_per_key + BLOOM_BLOCK_BITS-1) / BLOOM_BLOCK_BITS);
+
+    map->bloom            = zero_alloc(num_blocks, BLOOM_BLOCK_BITS/8, map->context);
+    map->bloom_num_blocks = num_blocks;
+
+    for (s64 i = 0; i < map->count; i++)  bloom_add(map, get_full_hash(map, key_size, i));
+}
+
+static void migrate_buckets(Any_map *map, u64 key_size, s64 max_buckets)
+// Move up to max_buckets buckets from the old table to the new one. Free the old table when it's empty.
+//
+// While a map is being resized, every key is in exactly one of the two tables. Lookups check the new table first, then
+// the old one. Since we're taking buckets out of the old table, we mark them CTRL_DELETED rather than CTRL_EMPTY so
+// that lookups in the old table keep probing past them.
+{
+    s64  end        = Min(map->num_migrated + max_buckets, map->old_num_buckets);
+    bool needs_hash = has_compact_buckets(map->old_num_buckets) && !has_compact_buckets(map->num_buckets);
+
+    for (s64 old_index = map->num_migrated; old_index < end; old_index++) {
+        if (!is_full(map->old_ctrl[old_index]))  continue;
+
+        s64 kv_index = get_bucket_kv_index(map->old_buckets, map->old_num_buckets, old_index);
+
+        // Compact buckets only have half the hash. If the new table has full buckets, we have to get the rest.
+        u64 hash = needs_hash ? get_full_hash(map, key_size, kv_index) : get_bucket_hash(map->old_buckets, map->old_num_buckets, old_index);
+
+        insert_bucket(map, hash, kv_index, map->old_ctrl[old_index], -1);
+        set_ctrl(map->old_ctrl, map->old_num_buckets, old_index, CTRL_DELETED);
+    }
+
+    map->num_migrated = end;
+
+    if (map->num_migrated == map->old_num_buckets) {
+        // The storage allocation starts with the buckets.
+        dealloc(map->old_buckets, map->context);
+
+        map->old_buckets     = NULL;
+        map->old_ctrl        = NULL;
+        map->old_num_buckets = 0;
+        map->num_migrated    = 0;
+    }
+}
+
+static void alloc_map_storage(Any_map *map, s64 num_buckets, u64 key_size, u64 val_size)
+// Make a single allocation for the map's buckets, control bytes, key info (if any), key array and value array, in that order, and point
+// the map's members at the parts of it. We start each part on a 16-byte boundary so that everything is aligned.
+//
+// The key-value arrays have room for 3/4 as many pairs as there are buckets (plus the reserved pair at index -1),
+// because that's how full we let the buckets get. This way the whole lot grows together.
+{
+    s64 limit = num_buckets/4*3 + 1;
+
+    // Dicts and slice maps also get an array of Key_info, parallel to the keys.
+    u64 key_info_size = has_key_info(map) ? limit * sizeof(Key_info) : 0;
+
+    u64 ctrl_offset     = num_buckets * get_bucket_size(num_buckets);
+    u64 key_info_offset = align_to_16(ctrl_offset + num_buckets + GROUP_SIZE-1);
+    u64 keys_offset     = key_info_offset + key_info_size;
+    u64 vals_offset     = keys_offset + align_to_16(limit * key_size);
+    u64 size            = vals_offset + align_to_16(limit * val_size);
+
+    u8 *storage = alloc(size/16, 16, map->context);
+
+    map->buckets     = storage;
+    map->ctrl        = storage + ctrl_offset;
+    map->key_info    = has_key_info(map) ? (Key_info *)(storage + key_info_offset) + 1 : NULL;
+    map->keys        = storage + keys_offset + key_size;
+    map->vals        = storage + vals_offset + val_size;
+    map->limit       = limit;
+    map->num_buckets = num_buckets;
+
+    memset(map->ctrl, CTRL_EMPTY, num_buckets + GROUP_SIZE-1);
+}
+
+bool init_map_if_needed(Any_map *map, u64 key_size, u64 val_size)
+// Return true if the map needed initting. If the map is being resized, this is also where we move some buckets from
+// the old table to the new one, since all the map operations call this function.
+{
+    // How many old buckets to move per operation while resizing. We need to move at least 4/3 of a bucket for each Set()
+    // to finish before the new table fills up. We move a whole group's worth.
+    s64 MIGRATE_STEP = GROUP_SIZE;
+
+    if (map->keys) {
+        if (map->old_buckets)  migrate_buckets(map, key_size, MIGRATE_STEP);
+        return false;
+    }
 
     // Initialise the map.
-    s64 INITIAL_KV_LIMIT    = 8; // Limit on key/value pairs. Includes the first one which is reserved, accessed as keys[-1] and vals[-1].
-    s64 INITIAL_NUM_BUCKETS = 8;
+    s64 INITIAL_NUM_BUCKETS = GROUP_SIZE;
 
-    *limit = INITIAL_KV_LIMIT;
-    *keys  = alloc(*limit, key_size, context); //|Speed: We should allocate the keys and vals arrays together, always. The only minor annoyance is making sure the vals are properly aligned.
-    *vals  = alloc(*limit, val_size, context); //|
+    alloc_map_storage(map, INITIAL_NUM_BUCKETS, key_size, val_size);
 
-    // Reserve the first key/value pair. keys[-1] will be used as temporary storage for a key we're operating on with Get(), Set() or Delete().
+    // We reserve the first key/value pair. keys[-1] will be used as temporary storage for a key we're operating on with Get(), Set() or Delete().
     // vals[-1] will store the default value for *Get() to return if the requested key is not present.
     //
     // This means that when you use *Get() with an incorrect key, the result is a zeroed-out value of the same type as map's values.
     // We rely on this behaviour in application code. Use SetDefault() to change the default value returned on a per-map basis.
     // The default default will always be the zeroed-out value.
-    memset(*vals, 0, val_size);
-    *keys = (u8 *)*keys + key_size;
-    *vals = (u8 *)*vals + val_size;
+    memset((u8 *)map->vals - val_size, 0, val_size);
 
-    *num_buckets = INITIAL_NUM_BUCKETS;
-    *buckets     = New(*num_buckets, Hash_bucket, context);
+    rebuild_bloom(map, key_size);
 
     return true;
 }
 
-void grow_map_if_needed(void **keys, void **vals, s64 *count, s64 *limit, u64 key_size, u64 val_size, Hash_bucket **buckets, s64 *num_buckets, Memory_context *context)
+static void resize_map(Any_map *map, u64 key_size, u64 val_size, s64 num_buckets)
+// Move the map into new storage with num_buckets buckets, which might be more or fewer than it has now. The key-value
+// pairs are copied straight away. The buckets move all at once or, if the map resizes incrementally, a few at a time.
 {
-    bool is_new_map = init_map_if_needed(keys, vals, count, limit, key_size, val_size, buckets, num_buckets, context);
+    u64 trace_start = TraceTime();
+
+    // If we haven't finished the last resize, finish it now. (This shouldn't happen when growing. See init_map_if_needed().)
+    if (map->old_buckets)  migrate_buckets(map, key_size, map->old_num_buckets);
+
+    Any_map old = *map;
+
+    alloc_map_storage(map, num_buckets, key_size, val_size);
+    assert(old.count < map->limit);
+
+    // Copy the key-value pairs, including the reserved pair.
+    memcpy((u8 *)map->keys - key_size, (u8 *)old.keys - key_size, (old.count+1)*key_size);
+    memcpy((u8 *)map->vals - val_size, (u8 *)old.vals - val_size, (old.count+1)*val_size);
+    if (old.key_info)  memcpy(map->key_info, old.key_info, old.count*sizeof(Key_info));
+
+    rebuild_bloom(map, key_size);
+
+    map->old_buckets     = old.buckets;
+    map->old_ctrl        = old.ctrl;
+    map->old_num_buckets = old.num_buckets;
+    map->num_migrated    = 0;
+
+    // Unless we're resizing incrementally, move all the buckets now.
+    if (!map->incremental_resize)  migrate_buckets(map, key_size, map->old_num_buckets);
+
+    TraceEvent(TRACE_MAP_REHASH, trace_start, map->num_buckets);
+}
+
+void grow_map_if_needed(Any_map *map, u64 key_size, u64 val_size)
+{
+    bool is_new_map = init_map_if_needed(map, key_size, val_size);
 
     if (is_new_map)  return;
 
-    if (*count >= *limit-1) {
-        // We're out of room in the key/value arrays.
-        *keys = (u8 *)*keys - key_size;
-        *vals = (u8 *)*vals - val_size;
-        *keys = resize(*keys, 2*(*limit), key_size, context);
-        *vals = resize(*vals, 2*(*limit), val_size, context);
-        *keys = (u8 *)*keys + key_size;
-        *vals = (u8 *)*vals + val_size;
+    if (map->count < map->limit-1)  return;
 
-        *limit *= 2;
-    }
+    // We're out of room in the key/value arrays, which means more than 3/4 of the buckets are used.
+    resize_map(map, key_size, val_size, 2*map->num_buckets);
+}
+
+static s64 get_num_buckets_for(s64 count, s64 max_load_eighths)
+// Return the smallest number of buckets that keeps count keys at or below the given load, in eighths, and still leaves
+// room to add a key without growing.
+{
+    s64 num_buckets = GROUP_SIZE;
+
+    while (8*count > max_load_eighths*num_buckets || count >= num_buckets/4*3)  num_buckets *= 2;
 
-    if (*count >= *num_buckets/4*3) {
-        // More than 3/4 of the buckets are used.
-        Hash_bucket *new_buckets = New(2*(*num_buckets), Hash_bucket, context);
+    return num_buckets;
+}
+
+void shrink_map_if_needed(Any_map *map, u64 key_size, u64 val_size)
+// If the map is less than 1/8 full, shrink it so it's about 3/8 full. There's a wide gap between the load where we shrink
+// and the loads we shrink to and grow at, so a map that hovers around a size doesn't keep resizing.
+{
+    if (!map->keys || map->num_buckets <= GROUP_SIZE)  return;
+
+    if (8*map->count >= map->num_buckets)  return;
+
+    s64 num_buckets = get_num_buckets_for(map->count, 3);
 
-        for (s64 old_index = 0; old_index < *num_buckets; old_index++) {
-            if (!(*buckets)[old_index].hash)  continue;
+    if (num_buckets < map->num_buckets)  resize_map(map, key_size, val_size, num_buckets);
+}
+
+void shrink_map_to_fit(Any_map *map, u64 key_size, u64 val_size)
+// Shrink the map as far as it will go while still leaving room for one more key.
+{
+    if (!map->keys)  return;
 
-            s64 new_index = (*buckets)[old_index].hash % (2*(*num_buckets));
-            while (new_buckets[new_index].hash) {
-                new_index -= 1;
-                if (new_index < 0)  new_index += 2*(*num_buckets);
+    s64 num_buckets = get_num_buckets_for(map->count, 6);
+
+    if (num_buckets < map->num_buckets)  resize_map(map, key_size, val_size, num_buckets);
+}
+
+static s64 add_key(Any_map *map, u64 key_size, Probe_key key)
+// Add the key to the map's hash table if it wasn't already there and return the key's index in the map->keys array.
+{
+    assert(map->context);
+    assert(map->count < map->num_buckets); // Assume empty buckets exist so the probing loops aren't infinite loops.
+
+    s64 empty_index;
+    s64 bucket_index = find_key(map, key_size, &key, &empty_index);
+
+    if (bucket_index >= 0)  return get_bucket_kv_index(map->buckets, map->num_buckets, bucket_index);
+
+    // The key is new. Take the empty bucket.
+    s64 kv_index = map->count;
+
+    if ((map->pack_keys || map->slice_mode) && !map->borrow_keys && !map->key_arena) {
+        map->key_arena = New(1, String_arena, map->context);
+        map->key_arena->context = map->context;
+    }
+
+    if (map->slice_mode) {
+        // Slice maps always pack their keys (unless they borrow them).
+        u8 *data = key.data;
+        if (!map->borrow_keys)  data = arena_copy(map->key_arena, data, key.length);
+
+        ((Byte_slice *)map->keys)[kv_index] = (Byte_slice){data, key.length};
+        map->key_info[kv_index] = (Key_info){key.hash, key.length};
+    } else if (!map->binary_mode) {
+        char *string = key.data;
+
+        if (!map->borrow_keys) {
+            if (map->pack_keys) {
+                string = arena_copy_string(map->key_arena, string, key.length);
+            } else {
+                string = alloc(key.length+1, sizeof(char), map->context);
+                memcpy(string, key.data, key.length);
+                string[key.length] = '\0';
             }
-            new_buckets[new_index] = (*buckets)[old_index];
         }
-        dealloc(*buckets, context);
-        *buckets = new_buckets;
-        *num_buckets *= 2;
+
+        ((char **)map->keys)[kv_index] = string;
+        map->key_info[kv_index] = (Key_info){key.hash, key.length};
+    } else {
+        memcpy((u8 *)map->keys + kv_index*key_size, key.data, key_size);
     }
+
+    insert_bucket(map, key.hash, kv_index, hash_to_ctrl(key.hash), empty_index);
+    if (map->bloom)  bloom_add(map, key.hash);
+
+    map->count += 1;
+
+    return kv_index;
 }
 
-s64 set_key(void *keys, s64 *count, u64 key_size, Hash_bucket *buckets, s64 num_buckets, Memory_context *context, bool binary_mode)
+s64 set_key(Any_map *map, u64 key_size)
 // Assume the key to set is stored in map->keys[-1]. Add the key to the map's hash table if it
 // wasn't already there and return the key's index in the map->keys array.
 {
-    assert(context);
-    assert(*count < num_buckets); // Assume empty buckets exist so the while loops below aren't infinite loops.
+    return add_key(map, key_size, get_probe_key(map, key_size, (u8 *)map->keys - key_size));
+}
 
-    if (!binary_mode) {
-        // The key is a C-style string.
-        char *key = ((char **)keys)[-1];
-        u64  hash = hash_string(key);
-        s64 bucket_index = hash % num_buckets;
-        while (true) {
-            if (!buckets[bucket_index].hash) {
-                // The bucket is empty. We'll take it.
-                s64 kv_index = *count;
-                ((char **)keys)[kv_index] = copy_string(key, context);
-                buckets[bucket_index].hash  = hash;
-                buckets[bucket_index].index = kv_index;
-                *count += 1;
-                return kv_index;
-            }
-            if (buckets[bucket_index].hash == hash) {
-                // The hashes match. Make sure the keys match.
-                s64 kv_index = buckets[bucket_index].index;
-                if (!strcmp(key, ((char **)keys)[kv_index]))  return kv_index;
-            }
-            bucket_index -= 1;
-            if (bucket_index < 0)  bucket_index += num_buckets;
+s64 set_probe_key(Any_map *map, u64 key_size, Probe_key key)
+// Like set_key(), for a key whose bytes, length and hash the caller has already worked out. This lets you add a dict key
+// that isn't zero-terminated: the dict's copy of it will be.
+{
+    assert(has_key_info(map) || key.length == key_size);
+
+    return add_key(map, key_size, key);
+}
+
+s64 get_bucket_index(Any_map *map, u64 key_size)
+{
+    Probe_key key = get_probe_key(map, key_size, (u8 *)map->keys - key_size); // The key is map->keys[-1].
+
+    s64 empty_index;
+    return find_key(map, key_size, &key, &empty_index);
+}
+
+s64 get_key_index(Any_map *map, u64 key_size)
+// Like get_bucket_index(), but return the key's index in the key-value arrays, or -1 if it's not there.
+{
+    s64 bucket_index = get_bucket_index(map, key_size);
+
+    return (bucket_index < 0) ? -1 : get_bucket_kv_index(map->buckets, map->num_buckets, bucket_index);
+}
+
+//
+// For GetMany() and SetMany(), we work through the keys in batches. For each batch, we first hash all the keys and
+// prefetch the control bytes and buckets where each key's probe will start. By the time we come back to look the keys up,
+// the memory should be on its way, so instead of waiting for each cache miss in turn we wait for them all at once.
+//
+#define BATCH_SIZE  16
+
+static void prefetch_probes(Any_map *map, u64 key_size, void *keys, s64 count, Probe_key *probes)
+{
+    u64 mask = map->num_buckets-1;
+
+    for (s64 i = 0; i < count; i++) {
+        probes[i] = get_probe_key(map, key_size, (u8 *)keys + i*key_size);
+
+        s64 home = probes[i].hash & mask;
+        Prefetch(&map->ctrl[home]);
+        Prefetch((u8 *)map->buckets + home*get_bucket_size(map->num_buckets));
+    }
+}
+
+void get_many(Any_map *map, u64 key_size, u64 val_size, void *keys, s64 count, void *out_vals)
+// Look up count keys and copy their values into out_vals. Keys that aren't in the map get the default value.
+{
+    init_map_if_needed(map, key_size, val_size);
+
+    Probe_key probes[BATCH_SIZE];
+    s64       kv_indexes[BATCH_SIZE];
+
+    for (s64 start = 0; start < count; start += BATCH_SIZE) {
+        s64 batch_count = Min(BATCH_SIZE, count - start);
+
+        prefetch_probes(map, key_size, (u8 *)keys + start*key_size, batch_count, probes);
+
+        // Find the buckets, and prefetch the values we're about to copy.
+        for (s64 i = 0; i < batch_count; i++) {
+            s64 empty_index;
+            s64 bucket_index = find_key(map, key_size, &probes[i], &empty_index);
+
+            kv_indexes[i] = (bucket_index < 0) ? -1 : get_bucket_kv_index(map->buckets, map->num_buckets, bucket_index);
+            Prefetch((u8 *)map->vals + kv_indexes[i]*val_size);
         }
-    } else {
-        // The key is binary.
-        void *key = (u8 *)keys - key_size; // key = map->keys[-1]
-        u64  hash = hash_bytes(key, key_size);
-        s64 bucket_index = hash % num_buckets;
-        while (true) {
-            if (!buckets[bucket_index].hash) {
-                // The bucket is empty. We'll take it.
-                s64 kv_index = *count;
-                memcpy((u8 *)keys + kv_index*key_size, key, key_size);
-                buckets[bucket_index].hash  = hash;
-                buckets[bucket_index].index = kv_index;
-                *count += 1;
-                return kv_index;
-            }
-            if (buckets[bucket_index].hash == hash) {
-                // The hashes match. Make sure the keys match.
-                s64 kv_index = buckets[bucket_index].index;
-                if (!memcmp(key, (u8 *)keys + kv_index*key_size, key_size))  return kv_index;
-            }
-            bucket_index -= 1;
-            if (bucket_index < 0)  bucket_index += num_buckets;
+
+        for (s64 i = 0; i < batch_count; i++) {
+            memcpy((u8 *)out_vals + (start+i)*val_size, (u8 *)map->vals + kv_indexes[i]*val_size, val_size);
         }
     }
 }
 
-s64 get_bucket_index(void *keys, u64 key_size, Hash_bucket *buckets, s64 num_buckets, bool binary_mode)
+static void add_many(Any_map *map, u64 key_size, u64 val_size, void *keys, s64 count, void *vals, bool might_grow)
+// Set count keys to the corresponding values. If might_grow is false, the caller has made sure there's room for all the
+// keys and that the map isn't in the middle of a resize, so we can skip the checks.
 {
-    if (!binary_mode) {
-        // The key is a C-style string.
-        char *key = ((char **)keys)[-1];
-        u64  hash = hash_string(key);
-        s64 bucket_index = hash % num_buckets;
-        while (true) {
-            if (!buckets[bucket_index].hash)  return -1;
+    Probe_key probes[BATCH_SIZE];
 
-            if (buckets[bucket_index].hash == hash) {
-                // The hashes match. Make sure the keys match.
-                s64 kv_index = buckets[bucket_index].index;
-                if (!strcmp(key, ((char **)keys)[kv_index]))  return bucket_index;
-            }
-            bucket_index -= 1;
-            if (bucket_index < 0)  bucket_index += num_buckets;
-        }
-    } else {
-        // The key is binary.
-        void *key = (u8 *)keys - key_size; // key = map->keys[-1]
-        u64  hash = hash_bytes(key, key_size);
-        s64 bucket_index = hash % num_buckets;
-        while (true) {
-            if (!buckets[bucket_index].hash)  return -1;
+    for (s64 start = 0; start < count; start += BATCH_SIZE) {
+        s64 batch_count = Min(BATCH_SIZE, count - start);
 
-            if (buckets[bucket_index].hash == hash) {
-                // The hashes match. Make sure the keys match.
-                s64 kv_index = buckets[bucket_index].index;
-                if (!memcmp(key, (u8 *)keys + kv_index*key_size, key_size))  return bucket_index;
-            }
-            bucket_index -= 1;
-            if (bucket_index < 0)  bucket_index += num_buckets;
+        prefetch_probes(map, key_size, (u8 *)keys + start*key_size, batch_count, probes);
+
+        for (s64 i = 0; i < batch_count; i++) {
+            // If the map grows in the middle of a batch, the rest of the prefetches were wasted, but the hashes are still good.
+            if (might_grow)  grow_map_if_needed(map, key_size, val_size);
+
+            s64 kv_index = add_key(map, key_size, probes[i]);
+            memcpy((u8 *)map->vals + kv_index*val_size, (u8 *)vals + (start+i)*val_size, val_size);
         }
     }
 }
 
-bool delete_key(void *keys, void *vals, s64 *count, u64 key_size, u64 val_size, Hash_bucket *buckets, s64 num_buckets, Memory_context *context, bool binary_mode)
-// Return true if the key existed.
+void set_many(Any_map *map, u64 key_size, u64 val_size, void *keys, s64 count, void *vals)
+// Set count keys to the corresponding values.
 {
-    s64 bucket_index = get_bucket_index(keys, key_size, buckets, num_buckets, binary_mode);
-    if (bucket_index < 0)  return false;
+    add_many(map, key_size, val_size, keys, count, vals, true);
+}
 
-    s64 kv_index = buckets[bucket_index].index;
+void reserve_map(Any_map *map, u64 key_size, u64 val_size, s64 count)
+// Make sure the map has room for count keys in total, so that it won't grow until it has more than that.
+{
+    init_map_if_needed(map, key_size, val_size);
+
+    s64 num_buckets = get_num_buckets_for(count, 6);
+
+    if (num_buckets > map->num_buckets)  resize_map(map, key_size, val_size, num_buckets);
+}
+
+void build_map(Any_map *map, u64 key_size, u64 val_size, void *keys, s64 count, void *vals)
+// Like set_many(), but we make room for all the keys first, so we don't have to check whether to grow after each one.
+{
+    reserve_map(map, key_size, val_size, map->count + count);
+
+    if (map->old_buckets)  migrate_buckets(map, key_size, map->old_num_buckets);
+
+    add_many(map, key_size, val_size, keys, count, vals, false);
+}
+
+void remove_bucket(Any_map *map, s64 bucket_index, u64 key_size, u64 val_size, u64 last_hash)
+// Remove a bucket and its key-value pair from the map. To fill the gap in the key-value arrays we move the last pair
+// into it, so we need to update that pair's bucket. last_hash must be the hash of the last key, map->keys[count-1].
+// The bucket must be in the new table, and if it's a dict, the caller must take care of freeing the key.
+{
+    void *buckets     = map->buckets;
+    s64   num_buckets = map->num_buckets;
+    u64   mask        = num_buckets-1;
+
+    s64 kv_index = get_bucket_kv_index(buckets, num_buckets, bucket_index);
 
-    // Delete the bucket. This is algorithm 6.4R from Knuth volume 3. Note that the errata for the
-    // second edition of this book correct a significant bug in this algorithm. Step R4 should end
-    // with "return to step R1", not "return to step R2".
+    // Delete the bucket. This is algorithm 6.4R from Knuth volume 3, adapted for probing forwards instead of backwards.
+    // Note that the errata for the second edition of this book correct a significant bug in this algorithm. Step R4
+    // should end with "return to step R1", not "return to step R2". Because we move buckets back into the gap instead
+    // of leaving a "deleted" marker, lookups never have to skip over dead buckets.
+    //
+    // In a Robin Hood map, the buckets in a run are sorted by their homes, so this amounts to shifting buckets back one
+    // place until we reach one that's at its home or an empty bucket. And once one bucket can stay put, so can the rest.
     {
         s64 i = bucket_index;
         while (true) {
-            buckets[i] = (Hash_bucket){0};
+            set_ctrl(map->ctrl, num_buckets, i, CTRL_EMPTY);
 
             s64 j = i;
             while (true) {
-                i -= 1;
-                if (i < 0)  i += num_buckets;
+                j = (j+1) & mask;
 
-                if (!buckets[i].hash)  goto bucket_deleted;
+                if (map->ctrl[j] == CTRL_EMPTY)  goto bucket_deleted;
 
-                s64 r = buckets[i].hash % num_buckets;
+                s64 r = get_bucket_hash(buckets, num_buckets, j) & mask;
 
-                if (i <= r && r < j)  continue;
-                if (r < j && j < i)   continue;
-                if (j < i && i <= r)  continue;
+                // If the bucket's home r is cyclically in (i, j], it can stay where it is.
+                bool can_stay = (i < r && r <= j) || (r <= j && j < i) || (j < i && i < r);
 
-                buckets[j] = buckets[i];
+                if (can_stay && map->robin_hood)  goto bucket_deleted;
+                if (can_stay)  continue;
+
+                put_bucket(buckets, num_buckets, i, get_bucket_hash(buckets, num_buckets, j), get_bucket_kv_index(buckets, num_buckets, j));
+                set_ctrl(map->ctrl, num_buckets, i, map->ctrl[j]);
+                i = j;
                 break;
             }
         }
@@ -302,36 +781,166 @@ bucket_deleted:
 
     // Delete the key and value.
     {
-        // If it's a string-mode map, delete the copy we made of the key.
-        if (!binary_mode)  dealloc(((char **)keys)[kv_index], context);
+        s64 last_index = map->count-1;
 
-        if (kv_index < *count-1) {
+        if (kv_index < last_index) {
             // Copy the final kv pair into the places of the pair we're deleting.
-            memcpy((u8 *)keys+key_size*kv_index, (u8 *)keys+key_size*(*count-1), key_size);
-            memcpy((u8 *)vals+val_size*kv_index, (u8 *)vals+val_size*(*count-1), val_size);
-
-            // Update the hash table with the new index of the pair that we moved.
-            u64 hash = (!binary_mode)
-                ? hash_string(((char **)keys)[*count-1])
-                : hash_bytes((u8 *)keys+key_size*(*count-1), key_size);
-
-            s64 bucket_index = hash % num_buckets;
-            while (true) {
-                if (buckets[bucket_index].index == *count-1) {
-                    buckets[bucket_index].index = kv_index;
-                    break;
-                }
-                assert(buckets[bucket_index].hash);
-                bucket_index -= 1;
-                if (bucket_index < 0)  bucket_index += num_buckets;
+            memcpy((u8 *)map->keys+key_size*kv_index, (u8 *)map->keys+key_size*last_index, key_size);
+            memcpy((u8 *)map->vals+val_size*kv_index, (u8 *)map->vals+val_size*last_index, val_size);
+            if (map->key_info)  map->key_info[kv_index] = map->key_info[last_index];
+
+            // Update the hash table with the new index of the pair that we moved. Its bucket might be in either table.
+            s64 i = find_bucket_by_index(buckets, map->ctrl, num_buckets, last_hash, last_index);
+            if (i >= 0) {
+                set_bucket_kv_index(buckets, num_buckets, i, kv_index);
+            } else {
+                i = find_bucket_by_index(map->old_buckets, map->old_ctrl, map->old_num_buckets, last_hash, last_index);
+                assert(i >= 0);
+                set_bucket_kv_index(map->old_buckets, map->old_num_buckets, i, kv_index);
             }
         }
         // Delete the final kv pair.
-        memset((u8 *)keys+key_size*(*count-1), 0, key_size);
-        memset((u8 *)vals+val_size*(*count-1), 0, val_size);
+        memset((u8 *)map->keys+key_size*last_index, 0, key_size);
+        memset((u8 *)map->vals+val_size*last_index, 0, val_size);
     }
 
-    *count -= 1;
+    map->count -= 1;
+}
+
+static bool delete_probe_key(Any_map *map, u64 key_size, u64 val_size, Probe_key *key)
+// Return true if the key existed.
+{
+    // If the map is being resized, this moves the key's bucket to the new table. So we only delete from the new table.
+    s64 empty_index;
+    s64 bucket_index = find_key(map, key_size, key, &empty_index);
+    if (bucket_index < 0)  return false;
+
+    s64 kv_index   = get_bucket_kv_index(map->buckets, map->num_buckets, bucket_index);
+    s64 last_index = map->count-1;
+
+    // If it's a string-mode map, delete the copy we made of the key. (Keys in the arena stay until the context goes.)
+    if (!map->binary_mode && !map->slice_mode && !map->borrow_keys && !map->pack_keys)  dealloc(((char **)map->keys)[kv_index], map->context);
+
+    // Dicts and slice maps have the hash of the last key cached. We don't need it at all if we're deleting the last key.
+    u64 last_hash = (kv_index < last_index) ? get_full_hash(map, key_size, last_index) : 0;
+
+    remove_bucket(map, bucket_index, key_size, val_size, last_hash);
+
+    shrink_map_if_needed(map, key_size, val_size);
 
     return true;
 }
+
+Map_stats map_stats(Any_map *map)
+// Count how far each key's bucket is from its home bucket. If the map is being resized, we count the buckets in both
+// tables, each relative to its own table.
+{
+    Map_stats stats = {.count = map->count, .num_buckets = map->num_buckets};
+
+    if (!map->keys)  return stats;
+
+    stats.load_factor = (double)map->count / map->num_buckets;
+
+    s64 total_distance = 0;
+
+    for (int table = 0; table < 2; table++) {
+        void *buckets     = (table == 0) ? map->buckets     : map->old_buckets;
+        u8   *ctrl        = (table == 0) ? map->ctrl        : map->old_ctrl;
+        s64   num_buckets = (table == 0) ? map->num_buckets : map->old_num_buckets;
+
+        for (s64 i = 0; i < num_buckets; i++) {
+            if (!is_full(ctrl[i]))  continue;
+
+            s64 distance = get_distance(get_bucket_hash(buckets, num_buckets, i), i, num_buckets-1);
+
+            total_distance += distance;
+            stats.max_probe_length = Max(stats.max_probe_length, distance);
+            stats.histogram[Min(distance, MAP_STATS_HISTOGRAM_SIZE-1)] += 1;
+        }
+    }
+
+    if (map->count)  stats.mean_probe_length = (double)total_distance / map->count;
+
+    return stats;
+}
+
+bool delete_key(Any_map *map, u64 key_size, u64 val_size)
+// Assume the key to delete is stored in map->keys[-1]. Return true if the key existed.
+{
+    Probe_key key = get_probe_key(map, key_size, (u8 *)map->keys - key_size);
+
+    return delete_probe_key(map, key_size, val_size, &key);
+}
+
+//
+// Set operations. These run over the dense key arrays rather than the buckets. Where a set keeps its keys' hashes in
+// .key_info, we use those instead of hashing the keys again.
+//
+
+static Probe_key get_probe_key_at(Any_map *set, u64 key_size, s64 index)
+{
+    if (!has_key_info(set))  return get_probe_key(set, key_size, (u8 *)set->keys + index*key_size);
+
+    Probe_key probe;
+
+    probe.data   = (set->slice_mode) ? (void *)((Byte_slice *)set->keys)[index].data : (void *)((char **)set->keys)[index];
+    probe.length = set->key_info[index].length;
+    probe.hash   = set->key_info[index].hash;
+
+    return probe;
+}
+
+static bool contains_probe_key(Any_map *set, u64 key_size, Probe_key *key)
+{
+    if (!set->keys)  return false;
+
+    s64 empty_index;
+    return find_key(set, key_size, key, &empty_index) >= 0;
+}
+
+void set_union(Any_map *dest, Any_map *src, u64 key_size, u64 val_size)
+// Add all of src's keys to dest. If they're maps rather than sets, src's values overwrite dest's, like Set() would.
+{
+    assert(dest->binary_mode == src->binary_mode && dest->slice_mode == src->slice_mode);
+
+    for (s64 i = 0; i < src->count; i++) {
+        grow_map_if_needed(dest, key_size, val_size);
+        s64 kv_index = add_key(dest, key_size, get_probe_key_at(src, key_size, i));
+
+        if (val_size)  memcpy((u8 *)dest->vals + kv_index*val_size, (u8 *)src->vals + i*val_size, val_size);
+    }
+}
+
+void set_intersect(Any_map *dest, Any_map *src, u64 key_size, u64 val_size)
+// Remove the keys from dest that aren't in src.
+{
+    assert(dest->binary_mode == src->binary_mode && dest->slice_mode == src->slice_mode);
+
+    // Deleting a key moves the last key into its place. By going backwards, we've always already checked that key.
+    for (s64 i = dest->count-1; i >= 0; i--) {
+        Probe_key key = get_probe_key_at(dest, key_size, i);
+
+        if (!contains_probe_key(src, key_size, &key))  delete_probe_key(dest, key_size, val_size, &key);
+    }
+}
+
+void set_difference(Any_map *dest, Any_map *src, u64 key_size, u64 val_size)
+// Remove the keys from dest that are in src. We go through whichever set is smaller.
+{
+    assert(dest->binary_mode == src->binary_mode && dest->slice_mode == src->slice_mode);
+
+    if (!dest->keys)  return;
+
+    if (src->count < dest->count) {
+        for (s64 i = 0; i < src->count; i++) {
+            Probe_key key = get_probe_key_at(src, key_size, i);
+            delete_probe_key(dest, key_size, val_size, &key);
+        }
+    } else {
+        for (s64 i = dest->count-1; i >= 0; i--) {
+            Probe_key key = get_probe_key_at(dest, key_size, i);
+
+            if (contains_probe_key(src, key_size, &key))  delete_probe_key(dest, key_size, val_size, &key);
+        }
+    }
+}
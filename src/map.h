@@ -2,12 +2,104 @@
 #define MAP_H_INCLUDED
 
 #include "context.h"
+#include "ctrl.h"
 
+//
+// Each bucket in the hash table holds a key's hash and the index of its key-value pair. Tables with up to
+// COMPACT_BUCKET_LIMIT buckets, which is to say nearly all of them, use 8-byte Compact_buckets that hold just the low 32
+// bits of the hash. That's all we need to find a bucket's home, and together with the 7 bits in the control byte it
+// rules out almost every mismatch without comparing keys. Bigger tables use 16-byte Hash_buckets with the full hash.
+// A map switches between the two when it grows or shrinks past the limit. Going from compact to full buckets is the only
+// time we have to hash the keys again.
+//
+// Use the functions below to get at buckets, since you need to know the number of buckets to know their type.
+//
 struct Hash_bucket {
     u64 hash;
     s64 index;
 };
 
+struct Compact_bucket {
+    u32 hash;
+    u32 index;
+};
+
+#ifndef COMPACT_BUCKET_LIMIT
+#define COMPACT_BUCKET_LIMIT  ((s64)1 << 32)
+#endif
+
+static inline bool has_compact_buckets(s64 num_buckets)
+{
+    return num_buckets <= COMPACT_BUCKET_LIMIT;
+}
+
+static inline u64 get_bucket_size(s64 num_buckets)
+{
+    return has_compact_buckets(num_buckets) ? sizeof(struct Compact_bucket) : sizeof(struct Hash_bucket);
+}
+
+static inline u64 get_bucket_hash(void *buckets, s64 num_buckets, s64 i)
+// For compact buckets, this is only the low 32 bits of the hash.
+{
+    if (has_compact_buckets(num_buckets))  return ((struct Compact_bucket *)buckets)[i].hash;
+    else                                   return ((struct Hash_bucket *)buckets)[i].hash;
+}
+
+static inline bool bucket_hash_matches(void *buckets, s64 num_buckets, s64 i, u64 hash)
+{
+    if (has_compact_buckets(num_buckets))  return ((struct Compact_bucket *)buckets)[i].hash == (u32)hash;
+    else                                   return ((struct Hash_bucket *)buckets)[i].hash == hash;
+}
+
+static inline s64 get_bucket_kv_index(void *buckets, s64 num_buckets, s64 i)
+{
+    if (has_compact_buckets(num_buckets))  return ((struct Compact_bucket *)buckets)[i].index;
+    else                                   return ((struct Hash_bucket *)buckets)[i].index;
+}
+
+static inline void put_bucket(void *buckets, s64 num_buckets, s64 i, u64 hash, s64 kv_index)
+{
+    if (has_compact_buckets(num_buckets))  ((struct Compact_bucket *)buckets)[i] = (struct Compact_bucket){(u32)hash, (u32)kv_index};
+    else                                   ((struct Hash_bucket *)buckets)[i]    = (struct Hash_bucket){hash, kv_index};
+}
+
+static inline void set_bucket_kv_index(void *buckets, s64 num_buckets, s64 i, s64 kv_index)
+{
+    if (has_compact_buckets(num_buckets))  ((struct Compact_bucket *)buckets)[i].index = (u32)kv_index;
+    else                                   ((struct Hash_bucket *)buckets)[i].index    = kv_index;
+}
+
+struct Key_info {
+    u64 hash;
+    s64 length;
+};
+
+// A key as the map functions see it. See get_probe_key().
+struct Probe_key {
+    void *data;   // For a dict or slice map, the key's bytes. For a binary map, a pointer to the key.
+    s64   length; // For a dict, the string length. For a slice map, the slice size. For a binary map, the key size.
+    u64   hash;
+};
+
+// What map_stats() returns. A key's probe length is how many buckets past its home bucket it is, so 0 is the best.
+// histogram[n] is how many keys have a probe length of n, except that the last entry counts all the longer ones too.
+#define MAP_STATS_HISTOGRAM_SIZE  32
+
+struct Map_stats {
+    s64    count;
+    s64    num_buckets;
+    double load_factor;
+    double mean_probe_length;
+    s64    max_probe_length;
+    s64    histogram[MAP_STATS_HISTOGRAM_SIZE];
+};
+
+// The key type for slice maps. See below.
+struct Byte_slice {
+    u8  *data;
+    s64  size;
+};
+
 //
 // The .keys and .vals members are both pointers to the *second* items in allocated arrays. The first items,
 // .keys[-1] and .vals[-1], are both used for special purposes. .keys[-1] is temporary storage for whatever key
@@ -16,8 +108,46 @@ struct Hash_bucket {
 //
 // .limit is the number of items we have room for in each of the key-value arrays, including the skipped first members.
 //
+// .buckets, .ctrl and the key-value arrays all live in one allocation, which starts at .buckets. They grow together.
+//
+// The hash table itself is .buckets, which holds each key's hash and its index in the key-value arrays, and .ctrl,
+// which has one control byte per bucket. A control byte says whether the bucket is empty and, if it's not, holds 7 bits
+// of the key's hash. This lets us look for a key by checking the control bytes of a group of buckets at once, usually
+// with a single SIMD instruction. See map.c.
+//
+// When the map grows, we normally rehash all the buckets at once. If you set .incremental_resize to true, we instead
+// keep the old buckets in .old_buckets and .old_ctrl and move a few of them into the new table on each operation, so
+// that no single operation has to rehash the whole map. .num_migrated counts how many old buckets we've dealt with.
+// The key-value arrays are still copied in one go, but that's just a memcpy().
+//
+// Deleting keys shrinks the map when it gets less than 1/8 full, and the old storage goes back to the map's context.
+// MapShrinkToFit() shrinks it as far as possible straight away. Shrinking uses the same machinery as growing, so it's
+// incremental if .incremental_resize is set. (The bytes of packed keys stay in .key_arena until the context goes.)
+//
+// If you set .robin_hood to true before adding any keys, the map uses Robin Hood insertion: a new key can take the bucket
+// of a key that's closer to its home, which then moves along. This keeps probe lengths more even and lets lookups of
+// missing keys stop early. Deleting shifts buckets back rather than leaving gaps. Use map_stats() to see how long the
+// probes in a map are.
+//
+// If you set .bloom_bits_per_key, the map keeps a blocked Bloom filter of its keys in .bloom, with about that many bits
+// per key. Looking up a missing key then usually costs a hash and one cache miss in the filter, and never touches the
+// buckets. This pays off for maps where most lookups miss. Set() adds keys to the filter, and we rebuild the filter
+// whenever the map resizes, which clears out the bits of deleted keys. If you set .bloom_bits_per_key after adding
+// keys, the filter starts at the next resize. 10 bits per key gives about 1% false positives.
+//
+// .slice_mode is true for slice maps, whose keys are Byte_slices: byte strings of any length, which may contain zeros.
+// A slice map copies the bytes of its keys into .key_arena (unless you set .borrow_keys) and otherwise works like a dict.
+// Make one with NewSliceMap() or `SliceMap(int) map = {.context = ctx, .slice_mode = true};` and pass keys with Slice():
+//
+//     *Set(map, Slice(data, size)) = 1;
+//
 // .binary_mode is true for normal maps and false for dicts. Dicts are maps where the keys are zero-terminated strings.
-// Dicts make an internal copy of their keys and use a different hashing function. Otherwise they're the same.
+// Dicts make an internal copy of their keys. Otherwise they're the same. Dicts also keep the hash and length of each key
+// in .key_info, which runs parallel to .keys, so that we can rule out most mismatches without comparing any characters.
+//
+// If you set .borrow_keys to true, a dict won't copy its keys. Instead it stores the pointers you give it, so the strings
+// must outlive the dict. If you set .pack_keys to true, a dict copies its keys into a String_arena (.key_arena) instead
+// of making an allocation for each. Deleting a key from a dict with packed keys doesn't free the key's memory.
 //
 // You can initialise a map on the heap with NewMap() or NewDict(). You can also initialise them on the stack:
 //
@@ -33,8 +163,7 @@ struct Hash_bucket {
 // Whereas if we had .string_mode and you forgot to set it, the program would treat your char* keys like 64-bit IDs,
 // which would lead to more pernicious bugs.
 //
-// .i is used for temporary storage by two of our macros. There is a subtle difference in its two uses.
-// Get() uses it to store the bucket index. Set() uses it to store the key-value index.
+// .i is used for temporary storage by our macros. Get() and Set() use it to store the key-value index.
 //
 #define Map(KEY_TYPE, VAL_TYPE)         \
     struct {                            \
@@ -43,28 +172,70 @@ struct Hash_bucket {
         s64             count;          \
         s64             limit;          \
                                         \
-        Hash_bucket    *buckets;        \
+        void           *buckets;        \
+        u8             *ctrl;           \
         s64             num_buckets;    \
+        Key_info       *key_info;       \
+                                        \
+        u64            *bloom;          \
+        s64             bloom_num_blocks;   \
+        s64             bloom_bits_per_key; \
+                                        \
+        void           *old_buckets;    \
+        u8             *old_ctrl;       \
+        s64             old_num_buckets;\
+        s64             num_migrated;   \
                                         \
         Memory_context *context;        \
                                         \
         bool            binary_mode;    \
+        bool            incremental_resize; \
+        bool            robin_hood;     \
+        bool            borrow_keys;    \
+        bool            pack_keys;      \
+        bool            slice_mode;     \
+        String_arena   *key_arena;      \
         s64             i;              \
     }
 
-#define Dict(VAL_TYPE)  Map(char *, VAL_TYPE)
+#define Dict(VAL_TYPE)      Map(char *, VAL_TYPE)
+#define SliceMap(VAL_TYPE)  Map(Byte_slice, VAL_TYPE)
+
+#define Slice(DATA, SIZE)  ((Byte_slice){(u8 *)(DATA), (SIZE)})
+
+typedef struct Hash_bucket    Hash_bucket;
+typedef struct Compact_bucket Compact_bucket;
+typedef struct Key_info       Key_info;
+typedef struct Probe_key      Probe_key;
+typedef struct Map_stats      Map_stats;
+typedef struct Byte_slice     Byte_slice;
+typedef Dict(char *)          string_dict;
+typedef Dict(int)             int_dict;
 
-typedef struct Hash_bucket Hash_bucket;
-typedef Dict(char *)       string_dict;
-typedef Dict(int)          int_dict;
+// The map functions take a pointer to any kind of map, along with the sizes of its keys and values.
+typedef Map(void, void)    Any_map;
 
 u64 hash_bytes(void *p, u64 size);
 u64 hash_string(char *string);
-bool init_map_if_needed(void **keys, void **vals, s64 *count, s64 *limit, u64 key_size, u64 val_size, Hash_bucket **buckets, s64 *num_buckets, Memory_context *context);
-void grow_map_if_needed(void **keys, void **vals, s64 *count, s64 *limit, u64 key_size, u64 val_size, Hash_bucket **buckets, s64 *num_buckets, Memory_context *context);
-s64 set_key(void *keys, s64 *count, u64 key_size, Hash_bucket *buckets, s64 num_buckets, Memory_context *context, bool binary_mode);
-s64 get_bucket_index(void *keys, u64 key_size, Hash_bucket *buckets, s64 num_buckets, bool binary_mode);
-bool delete_key(void *keys, void *vals, s64 *count, u64 key_size, u64 val_size, Hash_bucket *buckets, s64 num_buckets, Memory_context *context, bool binary_mode);
+Probe_key get_probe_key(Any_map *map, u64 key_size, void *key);
+bool init_map_if_needed(Any_map *map, u64 key_size, u64 val_size);
+void grow_map_if_needed(Any_map *map, u64 key_size, u64 val_size);
+void shrink_map_if_needed(Any_map *map, u64 key_size, u64 val_size);
+void shrink_map_to_fit(Any_map *map, u64 key_size, u64 val_size);
+s64 set_key(Any_map *map, u64 key_size);
+s64 set_probe_key(Any_map *map, u64 key_size, Probe_key key);
+s64 get_bucket_index(Any_map *map, u64 key_size);
+s64 get_key_index(Any_map *map, u64 key_size);
+bool delete_key(Any_map *map, u64 key_size, u64 val_size);
+void remove_bucket(Any_map *map, s64 bucket_index, u64 key_size, u64 val_size, u64 last_hash);
+void get_many(Any_map *map, u64 key_size, u64 val_size, void *keys, s64 count, void *out_vals);
+void set_many(Any_map *map, u64 key_size, u64 val_size, void *keys, s64 count, void *vals);
+void reserve_map(Any_map *map, u64 key_size, u64 val_size, s64 count);
+void build_map(Any_map *map, u64 key_size, u64 val_size, void *keys, s64 count, void *vals);
+Map_stats map_stats(Any_map *map);
+void set_union(Any_map *dest, Any_map *src, u64 key_size, u64 val_size);
+void set_intersect(Any_map *dest, Any_map *src, u64 key_size, u64 val_size);
+void set_difference(Any_map *dest, Any_map *src, u64 key_size, u64 val_size);
 
 #define NewMap(MAP, CONTEXT) \
     ((MAP) = zero_alloc(1, sizeof(*MAP), (CONTEXT)), \
@@ -77,30 +248,293 @@ bool delete_key(void *keys, void *vals, s64 *count, u64 key_size, u64 val_size,
      (MAP)->context = (CONTEXT), \
      (MAP))
 
+#define NewSliceMap(MAP, CONTEXT) \
+    ((MAP) = zero_alloc(1, sizeof(*MAP), (CONTEXT)), \
+     (MAP)->context = (CONTEXT), \
+     (MAP)->slice_mode = true, \
+     (MAP))
+
 #define Set(MAP, KEY) \
-    (grow_map_if_needed((void**)&(MAP)->keys, (void**)&(MAP)->vals, &(MAP)->count, &(MAP)->limit, sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), &(MAP)->buckets, &(MAP)->num_buckets, (MAP)->context), \
+    (EnterAllocSite(), \
+     grow_map_if_needed((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals)), \
      (MAP)->keys[-1] = (KEY), \
-     (MAP)->i = set_key((MAP)->keys, &(MAP)->count, sizeof(*(MAP)->keys), (MAP)->buckets, (MAP)->num_buckets, (MAP)->context, (MAP)->binary_mode), \
+     (MAP)->i = set_key((Any_map *)(MAP), sizeof(*(MAP)->keys)), \
+     LeaveAllocSite(), \
      &(MAP)->vals[(MAP)->i])
 
 #define Get(MAP, KEY) \
-    (init_map_if_needed((void**)&(MAP)->keys, (void**)&(MAP)->vals, &(MAP)->count, &(MAP)->limit, sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), &(MAP)->buckets, &(MAP)->num_buckets, (MAP)->context), \
+    (EnterAllocSite(), \
+     init_map_if_needed((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals)), \
+     LeaveAllocSite(), \
      (MAP)->keys[-1] = (KEY), \
-     (MAP)->i = get_bucket_index((MAP)->keys, sizeof(*(MAP)->keys), (MAP)->buckets, (MAP)->num_buckets, (MAP)->binary_mode), \
-     &(MAP)->vals[(MAP)->i < 0 ? -1 : (MAP)->buckets[(MAP)->i].index])
+     (MAP)->i = get_key_index((Any_map *)(MAP), sizeof(*(MAP)->keys)), \
+     &(MAP)->vals[(MAP)->i])
 
 #define Delete(MAP, KEY) \
-    (init_map_if_needed((void**)&(MAP)->keys, (void**)&(MAP)->vals, &(MAP)->count, &(MAP)->limit, sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), &(MAP)->buckets, &(MAP)->num_buckets, (MAP)->context), \
+    (EnterAllocSite(), \
+     init_map_if_needed((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals)), \
+     LeaveAllocSite(), \
      (MAP)->keys[-1] = (KEY), \
-     delete_key((MAP)->keys, (MAP)->vals, &(MAP)->count, sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), (MAP)->buckets, (MAP)->num_buckets, (MAP)->context, (MAP)->binary_mode))
+     delete_key((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals)))
+
+#define MapStats(MAP)  map_stats((Any_map *)(MAP))
+
+#define MapShrinkToFit(MAP) \
+    (EnterAllocSite(), \
+     shrink_map_to_fit((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals)), \
+     LeaveAllocSite())
 
 #define SetDefault(MAP, VALUE) \
-    (init_map_if_needed((void**)&(MAP)->keys, (void**)&(MAP)->vals, &(MAP)->count, &(MAP)->limit, sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), &(MAP)->buckets, &(MAP)->num_buckets, (MAP)->context), \
+    (EnterAllocSite(), \
+     init_map_if_needed((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals)), \
+     LeaveAllocSite(), \
      (MAP)->vals[-1] = (VALUE))
 
 #define IsSet(MAP, KEY) \
-    (init_map_if_needed((void**)&(MAP)->keys, (void**)&(MAP)->vals, &(MAP)->count, &(MAP)->limit, sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), &(MAP)->buckets, &(MAP)->num_buckets, (MAP)->context), \
+    (EnterAllocSite(), \
+     init_map_if_needed((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals)), \
+     LeaveAllocSite(), \
      (MAP)->keys[-1] = (KEY), \
-     get_bucket_index((MAP)->keys, sizeof(*(MAP)->keys), (MAP)->buckets, (MAP)->num_buckets, (MAP)->binary_mode) >= 0)
+     get_bucket_index((Any_map *)(MAP), sizeof(*(MAP)->keys)) >= 0)
+
+//
+// GetMany() looks up COUNT keys at once and copies their values (or the default value) into OUT_VALS. SetMany() sets
+// COUNT keys to the corresponding VALS. They're faster than calling Get() or Set() in a loop on big maps because they
+// overlap the cache misses. KEYS, VALS and OUT_VALS are plain pointers, so they work with arrays:
+//
+//     s64_array ids = ...;
+//     u32 *results = New(ids.count, u32, ctx);
+//     GetMany(map, ids.data, ids.count, results);
+//
+// The conditional expressions are just there to make the compiler check the types of the arrays against the map's.
+//
+#define GetMany(MAP, KEYS, COUNT, OUT_VALS) \
+    (EnterAllocSite(), \
+     get_many((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), (1 ? (KEYS) : (MAP)->keys), (COUNT), (1 ? (OUT_VALS) : (MAP)->vals)), \
+     LeaveAllocSite())
+
+#define SetMany(MAP, KEYS, COUNT, VALS) \
+    (EnterAllocSite(), \
+     set_many((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), (1 ? (KEYS) : (MAP)->keys), (COUNT), (1 ? (VALS) : (MAP)->vals)), \
+     LeaveAllocSite())
+
+//
+// MapReserve() makes room for COUNT keys in total, in one step, so that adding that many won't make the map grow.
+// (Deleting keys can still shrink it.) MapBuildFromArrays() is SetMany() for filling a map in bulk: it reserves room for
+// all the keys first, then adds them without checking whether the map needs to grow after each one.
+//
+#define MapReserve(MAP, COUNT) \
+    (EnterAllocSite(), \
+     reserve_map((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), (COUNT)), \
+     LeaveAllocSite())
+
+#define MapBuildFromArrays(MAP, KEYS, VALS, COUNT) \
+    (EnterAllocSite(), \
+     build_map((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), (1 ? (KEYS) : (MAP)->keys), (COUNT), (1 ? (VALS) : (MAP)->vals)), \
+     LeaveAllocSite())
+
+//
+// A HashSet is a map with keys and no values. It's an ordinary Map with a value size of zero, so it shares all the
+// hashing and bucket code, but there's no value array to allocate, grow or clear. A StringSet is to a HashSet what a Dict
+// is to a Map, and .borrow_keys and .pack_keys work the same way. Iterate over .keys as usual:
+//
+//     HashSet(u64) *ids   = NewHashSet(ids, ctx);
+//     StringSet    *names = NewStringSet(names, ctx);
+//
+//     bool added   = SetAdd(ids, 42);       // True if the key wasn't already there.
+//     bool there   = SetContains(ids, 42);
+//     bool removed = SetRemove(ids, 42);    // True if the key was there.
+//
+// We can't call these Set() or Add() because those names are taken by maps and arrays.
+//
+// SetUnion(), SetIntersect() and SetDifference() modify DEST in place. Both sets must have the same key type.
+//
+// MapUnion(), MapIntersect() and MapDifference() do the same for maps with values. MapUnion() copies SRC's values
+// into DEST, overwriting the values of keys DEST already has, so both maps must have the same value type too. The
+// others only look at SRC's keys, so SRC can be a map with any value type, or a set.
+//
+// The Set macros only take sets, because they run with a value size of zero, which would wreck a map's values. The
+// sizeof() expressions check this at compile time: &SET->vals is a void ** only if SET is a set.
+//
+#define HashSet(KEY_TYPE)  Map(KEY_TYPE, void)
+#define StringSet          HashSet(char *)
+
+#define NewHashSet(SET, CONTEXT)    NewMap(SET, CONTEXT)
+#define NewStringSet(SET, CONTEXT)  NewDict(SET, CONTEXT)
+
+#define CheckIsSet(SET)  (void)sizeof((void **)0 == &(SET)->vals)
+
+#define SetAdd(SET, KEY) \
+    (CheckIsSet(SET), \
+     EnterAllocSite(), \
+     grow_map_if_needed((Any_map *)(SET), sizeof(*(SET)->keys), 0), \
+     LeaveAllocSite(), \
+     (SET)->i = (SET)->count, \
+     (SET)->keys[-1] = (KEY), \
+     set_key((Any_map *)(SET), sizeof(*(SET)->keys)), \
+     (SET)->count > (SET)->i)
+
+#define SetContains(SET, KEY) \
+    (EnterAllocSite(), \
+     init_map_if_needed((Any_map *)(SET), sizeof(*(SET)->keys), 0), \
+     LeaveAllocSite(), \
+     (SET)->keys[-1] = (KEY), \
+     get_bucket_index((Any_map *)(SET), sizeof(*(SET)->keys)) >= 0)
+
+#define SetRemove(SET, KEY) \
+    (CheckIsSet(SET), \
+     EnterAllocSite(), \
+     init_map_if_needed((Any_map *)(SET), sizeof(*(SET)->keys), 0), \
+     LeaveAllocSite(), \
+     (SET)->keys[-1] = (KEY), \
+     delete_key((Any_map *)(SET), sizeof(*(SET)->keys), 0))
+
+// The sizeof() expressions make the compiler check that the sets have the same key type, and that they are sets.
+#define SetOperation(FUNCTION, DEST, SRC) \
+    (CheckIsSet(DEST), CheckIsSet(SRC), \
+     EnterAllocSite(), \
+     (void)sizeof(1 ? (DEST)->keys : (SRC)->keys), \
+     FUNCTION((Any_map *)(DEST), (Any_map *)(SRC), sizeof(*(DEST)->keys), 0), \
+     LeaveAllocSite())
+
+#define SetUnion(DEST, SRC)       SetOperation(set_union, DEST, SRC)
+#define SetIntersect(DEST, SRC)   SetOperation(set_intersect, DEST, SRC)
+#define SetDifference(DEST, SRC)  SetOperation(set_difference, DEST, SRC)
+
+#define MapOperation(FUNCTION, DEST, SRC) \
+    (EnterAllocSite(), \
+     (void)sizeof(1 ? (DEST)->keys : (SRC)->keys), \
+     FUNCTION((Any_map *)(DEST), (Any_map *)(SRC), sizeof(*(DEST)->keys), sizeof(*(DEST)->vals)), \
+     LeaveAllocSite())
+
+#define MapUnion(DEST, SRC)       ((void)sizeof(1 ? (DEST)->vals : (SRC)->vals), MapOperation(set_union, DEST, SRC))
+#define MapIntersect(DEST, SRC)   MapOperation(set_intersect, DEST, SRC)
+#define MapDifference(DEST, SRC)  MapOperation(set_difference, DEST, SRC)
+
+//
+// DeclareMap() makes a map type with its own statically typed functions, so that the compiler can inline the hashing and
+// the key comparisons instead of going through hash_bytes() and memcmp() with a key size it only knows at runtime:
+//
+//     DeclareMap(Id_map, u64, u32, hash_int, IntsEqual)
+//
+//     Id_map map = {.context = ctx, .binary_mode = true};
+//
+//     *Id_map_set(&map, 42) = 7;
+//     u32 *value = Id_map_get(&map, 42);  // Like *Get(), this returns &map.vals[-1] if the key isn't there.
+//     bool found = Id_map_delete(&map, 42);
+//
+// HASH takes a key and returns a u64. EQUAL takes two keys and returns true if they're the same. Both can be functions
+// or macros. The type is an ordinary binary Map, so you can iterate over .keys and .vals as usual. But since it might
+// hash its keys differently, you must only use the generated functions on it, not Get(), Set() and friends.
+// Incremental resizing, Robin Hood maps and Bloom filters aren't supported. Nor are maps too big for compact buckets,
+// since we'd have to hash the keys again with hash_bytes() to make full buckets. The set and delete functions exit with
+// a fatal error rather than use a map like that, even in release builds.
+//
+#define IntsEqual(A, B)  ((A) == (B))
+
+static inline u64 hash_int(u64 key)
+// A one-multiply mixer for integer keys. We fold the high half of the product into the low half because the bucket
+// index comes from the low bits of the hash and the control byte comes from the high bits.
+{
+    key *= 0x9e3779b97f4a7c15;
+    return key ^ (key >> 32);
+}
+
+static inline void check_declared_map(Any_map *map, char *name)
+// The declared map functions skip the parts of map.c that handle these features, so using one would quietly corrupt
+// the table. We check in release builds too, since it's cheap next to a hash table operation. We check before growing
+// the map because growing past the limit for compact buckets would rehash the keys with hash_bytes().
+{
+    if (!map->binary_mode)         Fatal("%s must have .binary_mode set.", name);
+    if (map->incremental_resize)   Fatal("%s doesn't support incremental resizing.", name);
+    if (map->robin_hood)           Fatal("%s doesn't support Robin Hood insertion.", name);
+    if (map->bloom_bits_per_key)   Fatal("%s doesn't support Bloom filters.", name);
+    if (!has_compact_buckets(2*map->num_buckets))  Fatal("%s is too big for compact buckets.", name);
+}
+
+#define DeclareMap(NAME, KEY_TYPE, VAL_TYPE, HASH, EQUAL)                                               \
+    typedef Map(KEY_TYPE, VAL_TYPE) NAME;                                                               \
+                                                                                                        \
+    static inline s64 NAME##_find(NAME *map, KEY_TYPE key, u64 hash, s64 *empty_index)                  \
+    /* This is find_bucket() from map.c, specialised. */                                                \
+    {                                                                                                   \
+        u64 mask        = map->num_buckets-1;                                                           \
+        s64 group_start = hash & mask;                                                                  \
+                                                                                                        \
+        while (true) {                                                                                  \
+            Ctrl_group group = load_group(&map->ctrl[group_start]);                                     \
+                                                                                                        \
+            for (u32 match = match_byte(group, hash_to_ctrl(hash)); match; match &= match-1) {          \
+                s64 i = (group_start + lowest_bit(match)) & mask;                                       \
+                if (!bucket_hash_matches(map->buckets, map->num_buckets, i, hash))  continue;           \
+                s64 kv_index = get_bucket_kv_index(map->buckets, map->num_buckets, i);                  \
+                if (EQUAL(map->keys[kv_index], key))  return i;                                         \
+            }                                                                                           \
+                                                                                                        \
+            u32 empty = match_empty(group);                                                             \
+            if (empty) {                                                                                \
+                *empty_index = (group_start + lowest_bit(empty)) & mask;                                \
+                return -1;                                                                              \
+            }                                                                                           \
+                                                                                                        \
+            group_start = (group_start + GROUP_SIZE) & mask;                                            \
+        }                                                                                               \
+    }                                                                                                   \
+                                                                                                        \
+    static inline VAL_TYPE *NAME##_get(NAME *map, KEY_TYPE key)                                         \
+    {                                                                                                   \
+        if (!map->keys)  init_map_if_needed((Any_map *)map, sizeof(KEY_TYPE), sizeof(VAL_TYPE));        \
+                                                                                                        \
+        s64 empty_index = 0;                                                                            \
+        s64 i = NAME##_find(map, key, HASH(key), &empty_index);                                         \
+                                                                                                        \
+        if (i < 0)  return &map->vals[-1];                                                              \
+        return &map->vals[get_bucket_kv_index(map->buckets, map->num_buckets, i)];                      \
+    }                                                                                                   \
+                                                                                                        \
+    static inline bool NAME##_is_set(NAME *map, KEY_TYPE key)                                           \
+    {                                                                                                   \
+        return NAME##_get(map, key) != &map->vals[-1];                                                  \
+    }                                                                                                   \
+                                                                                                        \
+    static inline VAL_TYPE *NAME##_set(NAME *map, KEY_TYPE key)                                         \
+    {                                                                                                   \
+        check_declared_map((Any_map *)map, #NAME);                                                      \
+                                                                                                        \
+        grow_map_if_needed((Any_map *)map, sizeof(KEY_TYPE), sizeof(VAL_TYPE));                         \
+                                                                                                        \
+        u64 hash = HASH(key);                                                                           \
+        s64 empty_index = 0;                                                                            \
+        s64 i = NAME##_find(map, key, hash, &empty_index);                                              \
+                                                                                                        \
+        if (i >= 0)  return &map->vals[get_bucket_kv_index(map->buckets, map->num_buckets, i)];         \
+                                                                                                        \
+        s64 kv_index = map->count;                                                                      \
+        map->keys[kv_index]       = key;                                                                \
+        put_bucket(map->buckets, map->num_buckets, empty_index, hash, kv_index);                        \
+        set_ctrl(map->ctrl, map->num_buckets, empty_index, hash_to_ctrl(hash));                         \
+        map->count += 1;                                                                                \
+                                                                                                        \
+        return &map->vals[kv_index];                                                                    \
+    }                                                                                                   \
+                                                                                                        \
+    static inline bool NAME##_delete(NAME *map, KEY_TYPE key)                                           \
+    {                                                                                                   \
+        if (!map->keys)  return false;                                                                  \
+        check_declared_map((Any_map *)map, #NAME);                                                      \
+                                                                                                        \
+        s64 empty_index = 0;                                                                            \
+        s64 i = NAME##_find(map, key, HASH(key), &empty_index);                                         \
+        if (i < 0)  return false;                                                                       \
+                                                                                                        \
+        s64 last_index = map->count-1;                                                                  \
+        s64 kv_index   = get_bucket_kv_index(map->buckets, map->num_buckets, i);                        \
+        u64 last_hash  = (kv_index < last_index) ? HASH(map->keys[last_index]) : 0;                     \
+                                                                                                        \
+        remove_bucket((Any_map *)map, i, sizeof(KEY_TYPE), sizeof(VAL_TYPE), last_hash);                \
+        shrink_map_if_needed((Any_map *)map, sizeof(KEY_TYPE), sizeof(VAL_TYPE));                       \
+                                                                                                        \
+        return true;                                                                                    \
+    }
 
 #endif // MAP_H_INCLUDED
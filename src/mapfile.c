@@ -0,0 +1,331 @@
+#define _POSIX_C_SOURCE 200809L // For mmap() and fstat().
+
+#include "mapfile.h"
+
+#if OS == WINDOWS
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+// The magic number also catches files written on a machine with the other byte order. Change the version whenever the
+// layout of the file, the layout of the hash table or the hash function changes.
+#define MAP_FILE_MAGIC    0x70616d2d74786374 // "tcxt-map" when read as a little-endian u64.
+#define MAP_FILE_VERSION  3
+
+static bool write_section(FILE *file, u64 *position, u64 offset, void *data, u64 size)
+// Pad the file with zeros up to the offset, then write the data. Return false if the write failed.
+{
+    static u8 zeros[16];
+
+    assert(*position <= offset && offset - *position < sizeof(zeros));
+
+    if (fwrite(zeros, 1, offset - *position, file) != offset - *position)  return false;
+    if (size && fwrite(data, 1, size, file) != size)  return false;
+
+    *position = offset + size;
+
+    return true;
+}
+
+bool save_map(Any_map *map, u64 key_size, u64 val_size, char *path)
+// Write the map to a file that open_map_file() can read. Return false if the file couldn't be written. See mapfile.h.
+{
+    init_map_if_needed(map, key_size, val_size);
+
+    // If the map is in the middle of a resize, finish it so that all the buckets are in one table.
+    while (map->old_buckets)  init_map_if_needed(map, key_size, val_size);
+
+    bool has_key_bytes = map->slice_mode || !map->binary_mode;
+    s64  count         = map->count;
+
+    // Work out where the keys' bytes go, relative to the start of the key bytes section.
+    u64 num_key_bytes = 0;
+    if (has_key_bytes) {
+        for (s64 i = 0; i < count; i++)  num_key_bytes += map->key_info[i].length + !map->slice_mode; // Dict keys are zero-terminated.
+    }
+
+    Map_file_header header = {
+        .magic       = MAP_FILE_MAGIC,
+        .version     = MAP_FILE_VERSION,
+        .key_size    = key_size,
+        .val_size    = val_size,
+        .count       = count,
+        .num_buckets = map->num_buckets,
+        .bucket_size = get_bucket_size(map->num_buckets),
+        .binary_mode = map->binary_mode,
+        .slice_mode  = map->slice_mode,
+    };
+
+    header.buckets_offset     = align_to_16(sizeof(header));
+    header.ctrl_offset        = align_to_16(header.buckets_offset + map->num_buckets * get_bucket_size(map->num_buckets));
+    header.key_info_offset    = align_to_16(header.ctrl_offset + map->num_buckets + GROUP_SIZE-1);
+    header.key_offsets_offset = align_to_16(header.key_info_offset + (has_key_bytes ? count * sizeof(Key_info) : 0));
+    header.key_bytes_offset   = align_to_16(header.key_offsets_offset + (has_key_bytes ? count * sizeof(u64) : 0));
+    header.keys_offset        = align_to_16(header.key_bytes_offset + num_key_bytes);
+    header.vals_offset        = align_to_16(header.keys_offset + (has_key_bytes ? 0 : count * key_size));
+    header.file_size          = header.vals_offset + (count+1) * val_size;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        log_error("Couldn't open %s for writing.", path);
+        return false;
+    }
+
+    u64  position = 0;
+    bool ok       = true;
+
+    ok = ok && write_section(file, &position, 0, &header, sizeof(header));
+    ok = ok && write_section(file, &position, header.buckets_offset, map->buckets, map->num_buckets * get_bucket_size(map->num_buckets));
+    ok = ok && write_section(file, &position, header.ctrl_offset, map->ctrl, map->num_buckets + GROUP_SIZE-1);
+
+    if (has_key_bytes) {
+        ok = ok && write_section(file, &position, header.key_info_offset, map->key_info, count * sizeof(Key_info));
+
+        // Pointers become offsets.
+        u64 key_offset = 0;
+        for (s64 i = 0; ok && i < count; i++) {
+            u64 offset = (i == 0) ? header.key_offsets_offset : position;
+            ok = write_section(file, &position, offset, &key_offset, sizeof(key_offset));
+            key_offset += map->key_info[i].length + !map->slice_mode;
+        }
+
+        for (s64 i = 0; ok && i < count; i++) {
+            void *data   = (map->slice_mode) ? (void *)((Byte_slice *)map->keys)[i].data : (void *)((char **)map->keys)[i];
+            u64   offset = (i == 0) ? header.key_bytes_offset : position;
+            ok = write_section(file, &position, offset, data, map->key_info[i].length + !map->slice_mode);
+        }
+    } else {
+        ok = ok && write_section(file, &position, header.keys_offset, map->keys, count * key_size);
+    }
+
+    // The values start with the default value in vals[-1].
+    ok = ok && write_section(file, &position, header.vals_offset, (u8 *)map->vals - val_size, (count+1) * val_size);
+
+    if (fclose(file) != 0)  ok = false;
+
+    if (!ok)  log_error("Couldn't write the map to %s.", path);
+
+    return ok;
+}
+
+static bool section_fits(u64 offset, u64 count, u64 item_size, u64 end)
+// Return true if a 16-byte aligned section of count items starting at offset ends by end. We're careful not to overflow.
+{
+    if (offset % 16 || offset > end)  return false;
+
+    return !item_size || count <= (end - offset) / item_size;
+}
+
+static bool map_file_is_valid(Map_file_header *header, u64 file_size, u64 key_size, u64 val_size)
+// Check everything that map_file_find() relies on, so that a truncated or corrupted file can't make a lookup read
+// outside the file or loop forever. This reads the control bytes and the key offsets, but not the buckets, keys or
+// values, which we check as we use them.
+{
+    if (file_size < sizeof(*header))              return false;
+    if (header->magic != MAP_FILE_MAGIC)          return false;
+    if (header->version != MAP_FILE_VERSION)      return false;
+    if (header->file_size != file_size)           return false;
+    if (header->key_size != key_size)             return false;
+    if (header->val_size != val_size)             return false;
+    if (!is_power_of_two(header->num_buckets))    return false;
+    if (header->num_buckets < GROUP_SIZE)         return false;
+    if (header->num_buckets > file_size)          return false;
+    if (header->count >= header->num_buckets)     return false;
+
+    // A build with a different COMPACT_BUCKET_LIMIT would read the buckets at the wrong width.
+    if (header->bucket_size != get_bucket_size(header->num_buckets))  return false;
+
+    // Dicts and slice maps have keys of a known size.
+    if (header->slice_mode && key_size != sizeof(Byte_slice))                      return false;
+    if (!header->slice_mode && !header->binary_mode && key_size != sizeof(char *))  return false;
+
+    // Every section must fit in the file, in order.
+    u64  count         = header->count;
+    u64  num_buckets   = header->num_buckets;
+    bool has_key_bytes = header->slice_mode || !header->binary_mode;
+
+    u64 num_key_infos = has_key_bytes ? count : 0;
+    u64 num_keys      = has_key_bytes ? 0 : count;
+
+    if (!section_fits(header->buckets_offset, num_buckets, get_bucket_size(num_buckets), header->ctrl_offset))  return false;
+    if (!section_fits(header->ctrl_offset, num_buckets + GROUP_SIZE-1, 1, header->key_info_offset))             return false;
+    if (!section_fits(header->key_info_offset, num_key_infos, sizeof(Key_info), header->key_offsets_offset))    return false;
+    if (!section_fits(header->key_offsets_offset, num_key_infos, sizeof(u64), header->key_bytes_offset))        return false;
+    if (!section_fits(header->key_bytes_offset, 0, 0, header->keys_offset))                                     return false;
+    if (!section_fits(header->keys_offset, num_keys, key_size, header->vals_offset))                            return false;
+    if (!section_fits(header->vals_offset, count+1, val_size, file_size))                                       return false;
+
+    // Probing stops at a group with an empty bucket, so there must be one. The control bytes after the last bucket are
+    // copies of the first ones, so that we can load a group that wraps around. See set_ctrl() in ctrl.h.
+    u8   *ctrl      = (u8 *)header + header->ctrl_offset;
+    bool  has_empty = false;
+
+    for (u64 i = 0; i < num_buckets; i++)  has_empty |= (ctrl[i] == CTRL_EMPTY);
+    if (!has_empty)  return false;
+
+    for (u64 i = 0; i < GROUP_SIZE-1; i++) {
+        if (ctrl[num_buckets + i] != ctrl[i])  return false;
+    }
+
+    // Each key's bytes must be inside the key bytes section.
+    if (has_key_bytes) {
+        Key_info *key_info        = (Key_info *)((u8 *)header + header->key_info_offset);
+        u64      *key_offsets     = (u64 *)((u8 *)header + header->key_offsets_offset);
+        u64       num_key_bytes   = header->keys_offset - header->key_bytes_offset;
+        u64       terminator_size = !header->slice_mode;
+
+        for (u64 i = 0; i < count; i++) {
+            u64 offset = key_offsets[i];
+            u64 length = key_info[i].length;
+
+            if (key_info[i].length < 0 || offset > num_key_bytes)  return false;
+            if (length > num_key_bytes - offset)                   return false;
+            if (terminator_size > num_key_bytes - offset - length) return false;
+        }
+    }
+
+    return true;
+}
+
+void *open_map_file(char *path, u64 key_size, u64 val_size, Memory_context *context)
+// Map a file written by save_map() into memory and return a Map_file for it, or NULL if that didn't work.
+{
+    u8  *data = NULL;
+    u64  size = 0;
+
+#if OS == WINDOWS
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        log_error("Couldn't open %s.", path);
+        return NULL;
+    }
+
+    LARGE_INTEGER file_size;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+        size = file_size.QuadPart;
+
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_error("Couldn't open %s.", path);
+        return NULL;
+    }
+
+    struct stat stats;
+    if (fstat(fd, &stats) == 0 && stats.st_size > 0) {
+        size = stats.st_size;
+
+        data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)  data = NULL;
+    }
+    close(fd);
+#endif
+
+    if (!data) {
+        log_error("Couldn't map %s into memory.", path);
+        return NULL;
+    }
+
+    Map_file_header *header = (Map_file_header *)data;
+
+    if (!map_file_is_valid(header, size, key_size, val_size)) {
+        log_error("%s isn't a valid map file with %llu-byte keys and %llu-byte values.", path, (unsigned long long)key_size, (unsigned long long)val_size);
+#if OS == WINDOWS
+        UnmapViewOfFile(data);
+#else
+        munmap(data, size);
+#endif
+        return NULL;
+    }
+
+    bool has_key_bytes = header->slice_mode || !header->binary_mode;
+
+    Any_map_file *map = New(Any_map_file, context);
+
+    map->header      = header;
+    map->context     = context;
+    map->count       = header->count;
+    map->num_buckets = header->num_buckets;
+    map->binary_mode = header->binary_mode;
+    map->slice_mode  = header->slice_mode;
+    map->buckets     = data + header->buckets_offset;
+    map->ctrl        = data + header->ctrl_offset;
+    map->key_info    = has_key_bytes ? (Key_info *)(data + header->key_info_offset) : NULL;
+    map->key_offsets = has_key_bytes ? (u64 *)(data + header->key_offsets_offset) : NULL;
+    map->key_bytes   = has_key_bytes ? data + header->key_bytes_offset : NULL;
+    map->keys        = has_key_bytes ? NULL : data + header->keys_offset;
+    map->vals        = data + header->vals_offset + val_size;
+
+    return map;
+}
+
+void close_map_file(void *map_file)
+{
+    Any_map_file *map = map_file;
+
+#if OS == WINDOWS
+    UnmapViewOfFile(map->header);
+#else
+    munmap(map->header, map->header->file_size);
+#endif
+
+    dealloc(map, map->context);
+}
+
+s64 map_file_find(Any_map_file *map, u64 key_size, void *key)
+// Return the key's index in the file's key-value arrays, or -1 if it's not there. KEY points to the key. This is
+// find_bucket() from map.c, reading keys from the file.
+{
+    void *data;
+    s64   length;
+
+    if (map->slice_mode) {
+        data   = ((Byte_slice *)key)->data;
+        length = ((Byte_slice *)key)->size;
+    } else if (!map->binary_mode) {
+        data   = *(char **)key;
+        length = strlen(data);
+    } else {
+        data   = key;
+        length = key_size;
+    }
+
+    u64 hash        = hash_bytes(data, length);
+    u64 mask        = map->num_buckets-1;
+    u8  hash_byte   = hash_to_ctrl(hash);
+    s64 group_start = hash & mask;
+
+    while (true) {
+        Ctrl_group group = load_group(&map->ctrl[group_start]);
+
+        for (u32 match = match_byte(group, hash_byte); match; match &= match-1) {
+            s64 bucket_index = (group_start + lowest_bit(match)) & mask;
+            if (!bucket_hash_matches(map->buckets, map->num_buckets, bucket_index, hash))  continue;
+
+            // map_file_is_valid() doesn't read the buckets, so we check the index here.
+            s64 i = get_bucket_kv_index(map->buckets, map->num_buckets, bucket_index);
+            if (i < 0 || i >= map->count)  continue;
+
+            if (map->key_info) {
+                if (map->key_info[i].length == length && !memcmp(data, map->key_bytes + map->key_offsets[i], length))  return i;
+            } else {
+                if (!memcmp(data, (u8 *)map->keys + i*key_size, key_size))  return i;
+            }
+        }
+
+        if (match_empty(group))  return -1;
+
+        group_start = (group_start + GROUP_SIZE) & mask;
+    }
+}
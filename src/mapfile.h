@@ -0,0 +1,102 @@
+#ifndef MAPFILE_H_INCLUDED
+#define MAPFILE_H_INCLUDED
+
+#include "map.h"
+
+//
+// SaveMap() writes a Map, Dict or SliceMap to a file that OpenMapFile() can later map straight into memory as a
+// read-only map. The file holds the hash table exactly as it was in memory, so opening it doesn't involve any parsing or
+// rehashing, and most pages are only read from disk when a lookup touches them:
+//
+//     Dict(int) *dict = NewDict(dict, ctx);
+//     ...
+//     if (!SaveMap(dict, "words.map"))  ...
+//
+//     Map_file(char *, int) *words = OpenMapFile(words, "words.map", ctx);
+//     if (!words)  ...
+//
+//     char *key = "apple";
+//     int *val = MapFileGet(words, &key);  // Like *Get(), this points to the default value if the key isn't there.
+//     bool there = MapFileIsSet(words, &key);
+//
+//     close_map_file(words);
+//
+// The file has no pointers in it. The buckets refer to keys and values by index, as usual, and dicts and slice maps
+// store an offset into the file's key bytes instead of a pointer to each key. So .keys is NULL for them, though you can
+// still iterate over .vals. For binary maps, .keys works as normal.
+//
+// Like frozen maps, these take a pointer to the key because the memory is read-only. Many threads can read a map file
+// at once. The format depends on the byte order of the machine and on the hash function, so a file should be opened
+// on the same kind of machine that wrote it. We check this as far as we can with the header's magic number and version.
+// The width of the buckets depends on COMPACT_BUCKET_LIMIT, so the header records it and we reject files written by a
+// build that made different buckets.
+//
+// OpenMapFile() also checks that the sections fit in the file, that every key's bytes are inside it, and that there's an
+// empty bucket for lookups to stop at. This reads the control bytes and the key offsets, but not the buckets, keys or
+// values. So a truncated or corrupted file fails to open, or gives wrong answers, rather than crashing a lookup.
+//
+
+// The file starts with this header. The offsets are from the start of the file, and each section is 16-byte aligned.
+typedef struct Map_file_header Map_file_header;
+
+struct Map_file_header {
+    u64 magic;
+    u64 version;
+    u64 file_size;
+    u64 key_size;
+    u64 val_size;
+    u64 count;
+    u64 num_buckets;
+    u64 bucket_size;        // 8 for compact buckets or 16 for full ones, which depends on COMPACT_BUCKET_LIMIT.
+    u64 binary_mode;
+    u64 slice_mode;
+
+    u64 buckets_offset;     // num_buckets buckets, compact or full as in map.h.
+    u64 ctrl_offset;        // num_buckets + GROUP_SIZE-1 control bytes.
+    u64 key_info_offset;    // count Key_infos, for dicts and slice maps.
+    u64 key_offsets_offset; // count u64 offsets from key_bytes_offset, for dicts and slice maps.
+    u64 key_bytes_offset;   // The bytes of each key, for dicts and slice maps. Dict keys are zero-terminated.
+    u64 keys_offset;        // count keys, for binary maps.
+    u64 vals_offset;        // count+1 values, starting with the default.
+};
+
+#define Map_file(KEY_TYPE, VAL_TYPE)    \
+    struct {                            \
+        KEY_TYPE        *keys;          \
+        VAL_TYPE        *vals;          \
+        s64              count;         \
+                                        \
+        void            *buckets;       \
+        u8              *ctrl;          \
+        s64              num_buckets;   \
+        Key_info        *key_info;      \
+        u64             *key_offsets;   \
+        u8              *key_bytes;     \
+                                        \
+        Map_file_header *header;        \
+        Memory_context  *context;       \
+        bool             binary_mode;   \
+        bool             slice_mode;    \
+    }
+
+typedef Map_file(void, void) Any_map_file;
+
+bool save_map(Any_map *map, u64 key_size, u64 val_size, char *path);
+void *open_map_file(char *path, u64 key_size, u64 val_size, Memory_context *context);
+void close_map_file(void *map_file);
+s64 map_file_find(Any_map_file *map, u64 key_size, void *key);
+
+#define SaveMap(MAP, PATH) \
+    save_map((Any_map *)(MAP), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), (PATH))
+
+// Return NULL if the file couldn't be opened or doesn't hold a map with the right sizes of key and value.
+#define OpenMapFile(MAP, PATH, CONTEXT) \
+    ((MAP) = open_map_file((PATH), sizeof(*(MAP)->keys), sizeof(*(MAP)->vals), (CONTEXT)))
+
+#define MapFileGet(MAP, KEY_PTR) \
+    (&(MAP)->vals[map_file_find((Any_map_file *)(MAP), sizeof(*(MAP)->keys), (1 ? (KEY_PTR) : (MAP)->keys))])
+
+#define MapFileIsSet(MAP, KEY_PTR) \
+    (map_file_find((Any_map_file *)(MAP), sizeof(*(MAP)->keys), (1 ? (KEY_PTR) : (MAP)->keys)) >= 0)
+
+#endif // MAPFILE_H_INCLUDED
@@ -0,0 +1,341 @@
+#include <pthread.h>
+
+#include "context.h"
+#include "profile.h"
+
+//
+// Everything in this file is compiled out unless PROFILING is defined. The profiler keeps its own books with malloc(),
+// since it's watching the contexts.
+//
+#ifdef PROFILING
+
+typedef struct Alloc_sample Alloc_sample;
+
+struct Alloc_sample {
+    void           *data; // NULL if this slot in the table is empty.
+    Memory_context *context;
+    char           *file;
+    int             line;
+    u64             weight; // The number of bytes this sample stands for.
+};
+
+// An open-addressing hash table of the live samples, keyed by data pointer and context. We need both because a child
+// context's first allocation can have the same address as the buffer it's in, which is an allocation in the parent.
+static Alloc_sample    *samples;
+static s64              num_samples;
+static s64              samples_limit; // Always a power of two.
+static pthread_mutex_t  samples_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static s64 alloc_sample_interval = 256*1024;
+
+thread_local s64 alloc_site_depth;
+thread_local s64 bytes_until_alloc_sample = 256*1024;
+
+static thread_local char *alloc_site_file;
+static thread_local int   alloc_site_line;
+static thread_local u64   random_state;
+
+void enter_alloc_site(char *file, int line)
+{
+    if (!alloc_site_depth) {
+        alloc_site_file = file;
+        alloc_site_line = line;
+    }
+    alloc_site_depth += 1;
+}
+
+void *leave_alloc_site(void *result)
+{
+    assert(alloc_site_depth > 0);
+
+    alloc_site_depth -= 1;
+
+    return result;
+}
+
+static s64 get_next_sample_countdown(void)
+// Randomise the distance between samples so that we don't keep sampling the same allocation in a loop.
+{
+    if (!random_state)  random_state = 0x2545f4914f6cdd1d ^ (u64)&random_state;
+
+    // Xorshift.
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+
+    return 1 + random_state % (2*alloc_sample_interval);
+}
+
+void set_alloc_sample_interval(s64 num_bytes)
+// Set the average number of bytes between samples. Also restart the calling thread's countdown.
+{
+    assert(num_bytes > 0);
+
+    alloc_sample_interval    = num_bytes;
+    bytes_until_alloc_sample = get_next_sample_countdown();
+}
+
+static s64 get_sample_home(void *data, Memory_context *context)
+{
+    u64 key = (u64)data ^ ((u64)context << 7);
+
+    return ((key * 0x9e3779b97f4a7c15) >> 32) & (samples_limit-1);
+}
+
+static s64 get_sample_index(void *data, Memory_context *context)
+// Return the index of the sample for this pointer if it exists, or the empty slot where it would go. The caller must hold the lock.
+{
+    s64 mask  = samples_limit-1;
+    s64 index = get_sample_home(data, context);
+
+    while (samples[index].data) {
+        if (samples[index].data == data && samples[index].context == context)  break;
+        index = (index+1) & mask;
+    }
+
+    return index;
+}
+
+static void delete_sample(s64 index)
+// Delete the sample at index by shifting any samples after it back. The caller must hold the lock.
+{
+    s64 mask = samples_limit-1;
+
+    s64 hole = index;
+    for (s64 i = (index+1) & mask; samples[i].data; i = (i+1) & mask) {
+        s64 home = get_sample_home(samples[i].data, samples[i].context);
+
+        // Move the sample into the hole if the hole is on the way from its home slot to its current slot.
+        bool can_move = (hole <= i) ? (home <= hole || home > i) : (home <= hole && home > i);
+        if (can_move) {
+            samples[hole] = samples[i];
+            hole = i;
+        }
+    }
+    samples[hole] = (Alloc_sample){0};
+
+    num_samples -= 1;
+}
+
+void sample_alloc(void *data, u64 size, Memory_context *context)
+// Called by alloc() when the countdown runs out.
+{
+    bytes_until_alloc_sample = get_next_sample_countdown();
+
+    if (!alloc_site_depth)  return; // Nobody recorded a call site, e.g. the allocation was internal to the library.
+
+    // An allocation of `size` bytes gets sampled with a probability of about size/interval, so it stands for
+    // about interval bytes. Allocations bigger than the interval always get sampled and stand for themselves.
+    u64 weight = Max(size, (u64)alloc_sample_interval);
+
+    pthread_mutex_lock(&samples_mutex);
+
+    if (2*(num_samples+1) > samples_limit) {
+        // Grow the table.
+        Alloc_sample *old       = samples;
+        s64           old_limit = samples_limit;
+
+        samples_limit = old_limit ? 2*old_limit : 1024;
+        samples       = calloc(samples_limit, sizeof(Alloc_sample));
+        if (!samples)  Fatal("Couldn't allocate the allocation profiler's table.");
+
+        for (s64 i = 0; i < old_limit; i++) {
+            if (old[i].data)  samples[get_sample_index(old[i].data, old[i].context)] = old[i];
+        }
+        free(old);
+    }
+
+    s64 index = get_sample_index(data, context);
+    if (!samples[index].data)  num_samples += 1;
+
+    samples[index] = (Alloc_sample){
+        .data    = data,
+        .context = context,
+        .file    = alloc_site_file,
+        .line    = alloc_site_line,
+        .weight  = weight,
+    };
+
+    context->num_alloc_samples += 1;
+
+    pthread_mutex_unlock(&samples_mutex);
+}
+
+bool move_alloc_sample(void *old_data, void *new_data, u64 new_size, Memory_context *context)
+// Called by resize() for contexts that have samples. Return true if the old block was sampled.
+{
+    bool found = false;
+
+    pthread_mutex_lock(&samples_mutex);
+
+    if (samples_limit) {
+        s64 index = get_sample_index(old_data, context);
+        if (samples[index].data) {
+            Alloc_sample sample = samples[index];
+            delete_sample(index);
+
+            sample.data   = new_data;
+            sample.weight = Max(new_size, (u64)alloc_sample_interval);
+            samples[get_sample_index(new_data, context)] = sample;
+            num_samples += 1;
+
+            found = true;
+        }
+    }
+
+    pthread_mutex_unlock(&samples_mutex);
+
+    return found;
+}
+
+void forget_alloc_sample(void *data, Memory_context *context)
+// Called when a block of a context that has samples is deallocated.
+{
+    pthread_mutex_lock(&samples_mutex);
+
+    if (samples_limit) {
+        s64 index = get_sample_index(data, context);
+        if (samples[index].data) {
+            delete_sample(index);
+            context->num_alloc_samples -= 1;
+        }
+    }
+
+    pthread_mutex_unlock(&samples_mutex);
+}
+
+void forget_context_samples(Memory_context *context)
+// Forget the samples of a context and all its descendants. Called before a context is freed or reset.
+{
+    pthread_mutex_lock(&samples_mutex);
+
+    for (s64 i = 0; i < samples_limit;) {
+        Memory_context *c = samples[i].context;
+
+        // Every descendant was allocated from this context's buffers, so we can tell which samples belong to the
+        // subtree by address. That way we don't have to look inside descendants that are about to disappear.
+        bool in_subtree = (c == context);
+        for (s64 j = 0; j < context->buffer_count && c && !in_subtree; j++) {
+            Memory_block *buffer = &context->buffers[j];
+            in_subtree = (buffer->data <= (u8 *)c && (u8 *)c < buffer->data + buffer->size);
+        }
+
+        if (samples[i].data && in_subtree) {
+            delete_sample(i); // This may shift another sample into slot i, so check it again.
+        } else {
+            i += 1;
+        }
+    }
+
+    context->num_alloc_samples = 0;
+
+    pthread_mutex_unlock(&samples_mutex);
+}
+
+u64 get_alloc_profile_bytes(Memory_context *context, char *file, int line)
+// Return the estimated live bytes attributed to a call site in a context, or to every call site if file is NULL.
+{
+    u64 bytes = 0;
+
+    pthread_mutex_lock(&samples_mutex);
+
+    for (s64 i = 0; i < samples_limit; i++) {
+        Alloc_sample *s = &samples[i];
+        if (!s->data || s->context != context)  continue;
+
+        if (!file || (s->line == line && !strcmp(s->file, file)))  bytes += s->weight;
+    }
+
+    pthread_mutex_unlock(&samples_mutex);
+
+    return bytes;
+}
+
+typedef struct Site_total Site_total;
+
+struct Site_total {
+    Memory_context *context;
+    char           *file;
+    int             line;
+    u64             bytes;
+    s64             num_samples;
+};
+
+static int compare_site_totals_by_site(const void *a, const void *b)
+{
+    const Site_total *x = a, *y = b;
+
+    if (x->context != y->context)  return (x->context < y->context) ? -1 : 1;
+    int cmp = strcmp(x->file, y->file);
+    if (cmp)                       return cmp;
+    if (x->line != y->line)        return (x->line < y->line) ? -1 : 1;
+
+    return 0;
+}
+
+static int compare_site_totals_by_bytes(const void *a, const void *b)
+{
+    const Site_total *x = a, *y = b;
+
+    if (x->context != y->context)  return (x->context < y->context) ? -1 : 1;
+    if (x->bytes != y->bytes)      return (x->bytes > y->bytes) ? -1 : 1;
+
+    return 0;
+}
+
+void print_alloc_profile(FILE *file)
+// Print the estimated live bytes attributed to each call site, grouped by context.
+{
+    pthread_mutex_lock(&samples_mutex);
+
+    Site_total *totals = malloc((num_samples ? num_samples : 1) * sizeof(Site_total));
+    s64 num_totals = 0;
+
+    if (!totals) {
+        pthread_mutex_unlock(&samples_mutex);
+        log_error("Couldn't allocate memory to print the allocation profile.");
+        return;
+    }
+
+    for (s64 i = 0; i < samples_limit; i++) {
+        Alloc_sample *s = &samples[i];
+        if (!s->data)  continue;
+
+        totals[num_totals++] = (Site_total){s->context, s->file, s->line, s->weight, 1};
+    }
+
+    s64 interval = alloc_sample_interval;
+
+    pthread_mutex_unlock(&samples_mutex);
+
+    // Combine the samples from the same site and context.
+    qsort(totals, num_totals, sizeof(Site_total), compare_site_totals_by_site);
+    {
+        s64 j = 0;
+        for (s64 i = 0; i < num_totals; i++) {
+            if (j && !compare_site_totals_by_site(&totals[j-1], &totals[i])) {
+                totals[j-1].bytes       += totals[i].bytes;
+                totals[j-1].num_samples += 1;
+            } else {
+                totals[j++] = totals[i];
+            }
+        }
+        num_totals = j;
+    }
+    qsort(totals, num_totals, sizeof(Site_total), compare_site_totals_by_bytes);
+
+    fprintf(file, "Estimated live bytes by allocation site (sampling about every %lld bytes):\n", (long long)interval);
+
+    for (s64 i = 0; i < num_totals; i++) {
+        Site_total *t = &totals[i];
+
+        if (!i || t->context != totals[i-1].context)  fprintf(file, "  Context %p:\n", (void *)t->context);
+
+        fprintf(file, "    %12llu  %s:%d (%lld samples)\n", (unsigned long long)t->bytes, t->file, t->line, (long long)t->num_samples);
+    }
+
+    fflush(file);
+
+    free(totals);
+}
+#endif // PROFILING
@@ -0,0 +1,41 @@
+#ifndef PROFILE_H_INCLUDED
+#define PROFILE_H_INCLUDED
+
+#include "basic.h"
+
+typedef struct Memory_context Memory_context;
+
+//
+// A sampling profiler for allocations. Compile with -DPROFILING to turn it on; otherwise none of this does anything.
+//
+// With profiling on, alloc(), zero_alloc(), New(), Add(), Set() and the other map macros record the __FILE__ and
+// __LINE__ they were called from, much like log_error(). Roughly one allocation per alloc_sample_interval bytes gets
+// sampled and attributed to its call site. Allocations that aren't sampled just decrement a thread-local counter.
+// Call print_alloc_profile() to see how many live bytes each call site is responsible for in each context, or
+// get_alloc_profile_bytes() to get the number for one call site or context.
+//
+// When these macros are nested (e.g. Set() calls alloc() internally) the outermost call site is the one we record.
+//
+
+#ifdef PROFILING
+  #define EnterAllocSite()  enter_alloc_site(__FILE__, __LINE__)
+  #define LeaveAllocSite()  ((void)leave_alloc_site(NULL))
+
+  extern thread_local s64 alloc_site_depth;
+  extern thread_local s64 bytes_until_alloc_sample;
+#else
+  #define EnterAllocSite()  ((void)0)
+  #define LeaveAllocSite()  ((void)0)
+#endif
+
+void enter_alloc_site(char *file, int line);
+void *leave_alloc_site(void *result);
+void set_alloc_sample_interval(s64 num_bytes);
+void sample_alloc(void *data, u64 size, Memory_context *context);
+bool move_alloc_sample(void *old_data, void *new_data, u64 new_size, Memory_context *context);
+void forget_alloc_sample(void *data, Memory_context *context);
+void forget_context_samples(Memory_context *context);
+void print_alloc_profile(FILE *file);
+u64 get_alloc_profile_bytes(Memory_context *context, char *file, int line);
+
+#endif // PROFILE_H_INCLUDED
@@ -0,0 +1,697 @@
+#include "radix.h"
+#include "ctrl.h"
+
+//
+// A reference to a child is a void pointer, which points either to a Radix_node or, with its low bit set, to a
+// Radix_leaf. Allocations are 16-byte aligned, so the low bit is free.
+//
+// A node's prefix is the run of bytes that all the keys below it share after the byte that led to the node. We keep up
+// to MAX_PREFIX of them in the node. If the prefix is longer than that, lookups only check the first MAX_PREFIX bytes
+// and rely on comparing the whole key when they get to a leaf. When we need the rest of a long prefix, we read it from
+// any leaf below the node, since they all share it.
+//
+// A key can end at an inner node when it's a prefix of other keys, like "/api" and "/api/users". Such a key's leaf
+// hangs off the node's .leaf instead of being one of its children.
+//
+#define MAX_PREFIX  12
+
+enum {
+    NODE4,
+    NODE16,
+    NODE48,
+    NODE256,
+};
+
+typedef struct Radix_node Radix_node;
+typedef struct Radix_leaf Radix_leaf;
+
+struct Radix_node {
+    u8          type;
+    u16         count;          // The number of children.
+    u32         prefix_length;
+    u8          prefix[MAX_PREFIX];
+    Radix_leaf *leaf;           // The leaf for the key that ends at this node, if there is one.
+};
+
+typedef struct {Radix_node node;  u8 keys[4];       void *children[4];}   Radix_node4;
+typedef struct {Radix_node node;  u8 keys[16];      void *children[16];}  Radix_node16;
+typedef struct {Radix_node node;  u8 indexes[256];  void *children[48];}  Radix_node48; // indexes[byte] is 1 + the child's index, or 0.
+typedef struct {Radix_node node;                    void *children[256];} Radix_node256;
+
+static s64 const node_capacities[] = {4, 16, 48, 256};
+static u64 const node_sizes[]      = {sizeof(Radix_node4), sizeof(Radix_node16), sizeof(Radix_node48), sizeof(Radix_node256)};
+
+// A leaf is this struct, then the value, then the key's bytes with a zero after them. .key points to the bytes. For a
+// tree with string keys, the cursors treat .key as a char * (it's the first member of a Byte_slice).
+struct Radix_leaf {
+    Byte_slice key;
+};
+
+static bool is_leaf(void *ref)
+{
+    return (uintptr_t)ref & 1;
+}
+
+static Radix_leaf *get_leaf(void *ref)
+{
+    return (Radix_leaf *)((u8 *)ref - 1);
+}
+
+static void *leaf_ref(Radix_leaf *leaf)
+{
+    return (u8 *)leaf + 1;
+}
+
+static void *get_leaf_val(Radix_leaf *leaf)
+{
+    return leaf + 1;
+}
+
+static Byte_slice get_tree_key(Any_radix_tree *tree)
+// The key the macros put in tree->key.
+{
+    if (tree->slice_mode)  return *(Byte_slice *)tree->key;
+
+    char *string = *(char **)tree->key;
+    return (Byte_slice){(u8 *)string, strlen(string)};
+}
+
+static bool leaf_matches(Radix_leaf *leaf, Byte_slice key)
+{
+    return leaf->key.size == key.size && (!key.size || !memcmp(leaf->key.data, key.data, key.size));
+}
+
+static int compare_keys(Byte_slice a, Byte_slice b)
+// Empty keys can have null data, so we only call memcmp() when there's something to compare.
+{
+    s64 length = Min(a.size, b.size);
+    int c      = length ? memcmp(a.data, b.data, length) : 0;
+    if (c)  return c;
+
+    return (a.size > b.size) - (a.size < b.size);
+}
+
+static Radix_leaf *new_leaf(Any_radix_tree *tree, u64 val_size, Byte_slice key)
+{
+    u64 size = sizeof(Radix_leaf) + val_size + key.size + 1;
+
+    Radix_leaf *leaf = alloc((size+15)/16, 16, tree->context);
+    u8         *data = (u8 *)get_leaf_val(leaf) + val_size;
+
+    memset(get_leaf_val(leaf), 0, val_size);
+    if (key.size)  memcpy(data, key.data, key.size);
+    data[key.size] = '\0';
+
+    leaf->key = (Byte_slice){data, key.size};
+
+    return leaf;
+}
+
+static Radix_node *new_node(Any_radix_tree *tree, int type)
+{
+    Radix_node *node = zero_alloc(1, node_sizes[type], tree->context);
+    node->type = type;
+
+    return node;
+}
+
+void init_radix_tree_if_needed(Any_radix_tree *tree, u64 val_size)
+// Make the storage for .key and .default_val. The tree itself starts out with no root.
+{
+    if (tree->key)  return;
+
+    assert(tree->context);
+
+    u8 *storage = zero_alloc(sizeof(Byte_slice) + val_size, 1, tree->context);
+    tree->key         = storage;
+    tree->default_val = storage + sizeof(Byte_slice);
+}
+
+//
+// Finding, adding and removing children. Node4 and Node16 keep their keys sorted so that we can visit the children in
+// order.
+//
+
+static void **find_child(Radix_node *node, u8 byte)
+// Return a pointer to the reference to the child for this byte, or NULL if there isn't one.
+{
+    switch (node->type) {
+        case NODE4: {
+            Radix_node4 *n = (Radix_node4 *)node;
+            for (s64 i = 0; i < node->count; i++) {
+                if (n->keys[i] == byte)  return &n->children[i];
+            }
+            return NULL;
+        }
+        case NODE16: {
+            // Without SSE2, match_byte() can give false positives, so we check each match.
+            Radix_node16 *n = (Radix_node16 *)node;
+            u32 match = match_byte(load_group(n->keys), byte) & ((1u << node->count) - 1);
+            for (; match; match &= match-1) {
+                s64 i = lowest_bit(match);
+                if (n->keys[i] == byte)  return &n->children[i];
+            }
+            return NULL;
+        }
+        case NODE48: {
+            Radix_node48 *n = (Radix_node48 *)node;
+            return n->indexes[byte] ? &n->children[n->indexes[byte]-1] : NULL;
+        }
+        default: {
+            Radix_node256 *n = (Radix_node256 *)node;
+            return n->children[byte] ? &n->children[byte] : NULL;
+        }
+    }
+}
+
+static void *get_child_at(Radix_node *node, s64 *position, u8 *byte)
+// Return the first child at or after the position, and set *position to its position and *byte to its key byte. Return
+// NULL if there are no more. Position 0 is the first child, and positions go up in key order.
+{
+    switch (node->type) {
+        case NODE4:
+        case NODE16: {
+            u8    *keys     = (node->type == NODE4) ? ((Radix_node4 *)node)->keys : ((Radix_node16 *)node)->keys;
+            void **children = (node->type == NODE4) ? ((Radix_node4 *)node)->children : ((Radix_node16 *)node)->children;
+            if (*position >= node->count)  return NULL;
+            *byte = keys[*position];
+            return children[*position];
+        }
+        case NODE48: {
+            Radix_node48 *n = (Radix_node48 *)node;
+            for (s64 b = *position; b < 256; b++) {
+                if (n->indexes[b]) {
+                    *position = b;
+                    *byte     = b;
+                    return n->children[n->indexes[b]-1];
+                }
+            }
+            return NULL;
+        }
+        default: {
+            Radix_node256 *n = (Radix_node256 *)node;
+            for (s64 b = *position; b < 256; b++) {
+                if (n->children[b]) {
+                    *position = b;
+                    *byte     = b;
+                    return n->children[b];
+                }
+            }
+            return NULL;
+        }
+    }
+}
+
+static void *get_first_child_after(Radix_node *node, u8 byte)
+// Return the child with the smallest key byte greater than this one, or NULL.
+{
+    u8 child_byte;
+
+    if (node->type == NODE48 || node->type == NODE256) {
+        s64 position = byte+1;
+        return get_child_at(node, &position, &child_byte);
+    }
+
+    for (s64 position = 0; position < node->count; position++) {
+        void *child = get_child_at(node, &position, &child_byte);
+        if (child_byte > byte)  return child;
+    }
+
+    return NULL;
+}
+
+static void insert_child(Radix_node *node, u8 byte, void *child)
+// Add a child to a node that has room for it.
+{
+    assert(node->count < node_capacities[node->type]);
+
+    switch (node->type) {
+        case NODE4:
+        case NODE16: {
+            u8    *keys     = (node->type == NODE4) ? ((Radix_node4 *)node)->keys : ((Radix_node16 *)node)->keys;
+            void **children = (node->type == NODE4) ? ((Radix_node4 *)node)->children : ((Radix_node16 *)node)->children;
+
+            s64 i = 0;
+            while (i < node->count && keys[i] < byte)  i += 1;
+
+            memmove(&keys[i+1], &keys[i], node->count - i);
+            memmove(&children[i+1], &children[i], (node->count - i)*sizeof(void *));
+            keys[i]     = byte;
+            children[i] = child;
+            break;
+        }
+        case NODE48: {
+            Radix_node48 *n = (Radix_node48 *)node;
+            s64 slot = 0;
+            while (n->children[slot])  slot += 1;
+            n->children[slot] = child;
+            n->indexes[byte]  = slot+1;
+            break;
+        }
+        default:
+            ((Radix_node256 *)node)->children[byte] = child;
+    }
+
+    node->count += 1;
+}
+
+static void remove_child(Radix_node *node, u8 byte)
+{
+    switch (node->type) {
+        case NODE4:
+        case NODE16: {
+            u8    *keys     = (node->type == NODE4) ? ((Radix_node4 *)node)->keys : ((Radix_node16 *)node)->keys;
+            void **children = (node->type == NODE4) ? ((Radix_node4 *)node)->children : ((Radix_node16 *)node)->children;
+
+            s64 i = 0;
+            while (keys[i] != byte)  i += 1;
+
+            memmove(&keys[i], &keys[i+1], node->count - i - 1);
+            memmove(&children[i], &children[i+1], (node->count - i - 1)*sizeof(void *));
+            break;
+        }
+        case NODE48: {
+            Radix_node48 *n = (Radix_node48 *)node;
+            n->children[n->indexes[byte]-1] = NULL;
+            n->indexes[byte] = 0;
+            break;
+        }
+        default:
+            ((Radix_node256 *)node)->children[byte] = NULL;
+    }
+
+    node->count -= 1;
+}
+
+static Radix_node *resize_node(Any_radix_tree *tree, Radix_node *node, int type)
+// Move the node's children into a new node of a different size, and free the old one.
+{
+    Radix_node *resized = new_node(tree, type);
+
+    resized->prefix_length = node->prefix_length;
+    resized->leaf          = node->leaf;
+    memcpy(resized->prefix, node->prefix, MAX_PREFIX);
+
+    u8 byte;
+    for (s64 position = 0; ; position++) {
+        void *child = get_child_at(node, &position, &byte);
+        if (!child)  break;
+
+        insert_child(resized, byte, child);
+    }
+
+    dealloc(node, tree->context);
+
+    return resized;
+}
+
+static void add_child(Any_radix_tree *tree, void **ref, u8 byte, void *child)
+// Add a child to the node at *ref, growing the node if it's full.
+{
+    Radix_node *node = *ref;
+
+    if (node->count == node_capacities[node->type]) {
+        node = resize_node(tree, node, node->type+1);
+        *ref = node;
+    }
+
+    insert_child(node, byte, child);
+}
+
+static Radix_leaf *get_min_leaf(void *ref)
+// Return the leaf with the smallest key at or below ref. A key that ends at a node comes before the node's children.
+{
+    while (!is_leaf(ref)) {
+        Radix_node *node = ref;
+        if (node->leaf)  return node->leaf;
+
+        s64 position = 0;
+        u8  byte;
+        ref = get_child_at(node, &position, &byte);
+    }
+
+    return get_leaf(ref);
+}
+
+static u8 *get_full_prefix(Radix_node *node, s64 depth)
+// Return a pointer to the node's whole prefix, given the depth it starts at.
+{
+    if (node->prefix_length <= MAX_PREFIX)  return node->prefix;
+
+    return get_min_leaf(node)->key.data + depth;
+}
+
+static bool prefix_might_match(Radix_node *node, Byte_slice key, s64 depth)
+// Check the bytes of the prefix that we keep in the node. The rest get checked at the leaf.
+{
+    if (depth + node->prefix_length > key.size)  return false;
+
+    return !memcmp(node->prefix, key.data + depth, Min(node->prefix_length, MAX_PREFIX));
+}
+
+//
+// Lookups.
+//
+
+static Radix_leaf *find_leaf(Any_radix_tree *tree, Byte_slice key)
+{
+    void *ref   = tree->root;
+    s64   depth = 0;
+
+    while (ref) {
+        if (is_leaf(ref))  return leaf_matches(get_leaf(ref), key) ? get_leaf(ref) : NULL;
+
+        Radix_node *node = ref;
+        if (!prefix_might_match(node, key, depth))  return NULL;
+        depth += node->prefix_length;
+
+        if (depth == key.size)  return (node->leaf && leaf_matches(node->leaf, key)) ? node->leaf : NULL;
+
+        void **child = find_child(node, key.data[depth]);
+        if (!child)  return NULL;
+
+        ref    = *child;
+        depth += 1;
+    }
+
+    return NULL;
+}
+
+void radix_get(Any_radix_tree *tree, u64 val_size)
+// Point tree->val at the value for the key in tree->key, or at the default value if the key isn't there.
+{
+    Radix_leaf *leaf = find_leaf(tree, get_tree_key(tree));
+
+    tree->val = leaf ? get_leaf_val(leaf) : tree->default_val;
+}
+
+void radix_longest_prefix(Any_radix_tree *tree, u64 val_size)
+// Point tree->val at the value of the longest key that the key in tree->key starts with, or at the default value.
+// Every key we pass on the way down is a candidate. We compare each one in full, since we skip parts of long prefixes.
+{
+    Byte_slice  key   = get_tree_key(tree);
+    Radix_leaf *best  = NULL;
+    void       *ref   = tree->root;
+    s64         depth = 0;
+
+    while (ref) {
+        if (is_leaf(ref)) {
+            Radix_leaf *leaf = get_leaf(ref);
+            if (leaf->key.size <= key.size && (!leaf->key.size || !memcmp(leaf->key.data, key.data, leaf->key.size)))  best = leaf;
+            break;
+        }
+
+        Radix_node *node = ref;
+        if (!prefix_might_match(node, key, depth))  break;
+        depth += node->prefix_length;
+
+        Radix_leaf *leaf = node->leaf;
+        if (leaf && leaf->key.size == depth && (!depth || !memcmp(leaf->key.data, key.data, depth)))  best = leaf;
+
+        if (depth == key.size)  break;
+
+        void **child = find_child(node, key.data[depth]);
+        if (!child)  break;
+
+        ref    = *child;
+        depth += 1;
+    }
+
+    tree->val = best ? get_leaf_val(best) : tree->default_val;
+}
+
+//
+// Adding keys.
+//
+
+static void add_to_new_node(Radix_node *node, Radix_leaf *leaf, s64 depth)
+// Hang a leaf off a node we've just made, whose prefix ends at depth.
+{
+    if (leaf->key.size == depth)  node->leaf = leaf;
+    else                          insert_child(node, leaf->key.data[depth], leaf_ref(leaf));
+}
+
+static Radix_leaf *insert(Any_radix_tree *tree, void **ref, Byte_slice key, s64 depth, u64 val_size)
+// Find or add the key below *ref, where depth bytes of the key have been used up. Return its leaf.
+{
+    if (!*ref) {
+        Radix_leaf *leaf = new_leaf(tree, val_size, key);
+        *ref = leaf_ref(leaf);
+        tree->count += 1;
+        return leaf;
+    }
+
+    if (is_leaf(*ref)) {
+        Radix_leaf *existing = get_leaf(*ref);
+        if (leaf_matches(existing, key))  return existing;
+
+        // Replace the leaf with a node that branches where the two keys differ.
+        s64 length = depth;
+        while (length < key.size && length < existing->key.size && key.data[length] == existing->key.data[length])  length += 1;
+
+        Radix_node *node = new_node(tree, NODE4);
+        node->prefix_length = length - depth;
+        memcpy(node->prefix, key.data + depth, Min(node->prefix_length, MAX_PREFIX));
+
+        Radix_leaf *leaf = new_leaf(tree, val_size, key);
+        add_to_new_node(node, existing, length);
+        add_to_new_node(node, leaf, length);
+
+        *ref = node;
+        tree->count += 1;
+        return leaf;
+    }
+
+    Radix_node *node = *ref;
+
+    if (node->prefix_length) {
+        // Find how much of the prefix the key shares.
+        u8 *prefix   = get_full_prefix(node, depth);
+        s64 mismatch = 0;
+        while (mismatch < node->prefix_length && depth + mismatch < key.size && prefix[mismatch] == key.data[depth + mismatch])  mismatch += 1;
+
+        if (mismatch < node->prefix_length) {
+            // The key leaves the prefix part way along. Put a new node above this one, with the shared part of the
+            // prefix, and shorten this node's prefix to what's left after the byte that leads to it.
+            Radix_node *parent = new_node(tree, NODE4);
+            parent->prefix_length = mismatch;
+            memcpy(parent->prefix, prefix, Min(mismatch, MAX_PREFIX));
+
+            u8 byte = prefix[mismatch];
+            node->prefix_length -= mismatch+1;
+            memmove(node->prefix, prefix + mismatch+1, Min(node->prefix_length, MAX_PREFIX));
+            insert_child(parent, byte, node);
+
+            Radix_leaf *leaf = new_leaf(tree, val_size, key);
+            add_to_new_node(parent, leaf, depth + mismatch);
+
+            *ref = parent;
+            tree->count += 1;
+            return leaf;
+        }
+
+        depth += node->prefix_length;
+    }
+
+    if (depth == key.size) {
+        if (!node->leaf) {
+            node->leaf = new_leaf(tree, val_size, key);
+            tree->count += 1;
+        }
+        return node->leaf;
+    }
+
+    void **child = find_child(node, key.data[depth]);
+    if (child)  return insert(tree, child, key, depth+1, val_size);
+
+    Radix_leaf *leaf = new_leaf(tree, val_size, key);
+    add_child(tree, ref, key.data[depth], leaf_ref(leaf));
+    tree->count += 1;
+
+    return leaf;
+}
+
+void radix_set(Any_radix_tree *tree, u64 val_size)
+// Add the key in tree->key if it isn't there already, with a zeroed value, and point tree->val at its value.
+{
+    Radix_leaf *leaf = insert(tree, &tree->root, get_tree_key(tree), 0, val_size);
+
+    tree->val = get_leaf_val(leaf);
+}
+
+//
+// Deleting keys.
+//
+
+static void tidy_node(Any_radix_tree *tree, void **ref)
+// After taking something away from the node at *ref, replace it with its only remaining child or leaf, or shrink it.
+{
+    Radix_node *node = *ref;
+
+    if (node->count == 0) {
+        *ref = node->leaf ? leaf_ref(node->leaf) : NULL;
+        dealloc(node, tree->context);
+        return;
+    }
+
+    if (node->count == 1 && !node->leaf) {
+        s64   position = 0;
+        u8    byte;
+        void *child = get_child_at(node, &position, &byte);
+
+        if (!is_leaf(child)) {
+            // Join the prefixes. We only need the first MAX_PREFIX bytes of the result.
+            Radix_node *c = child;
+            u8  prefix[MAX_PREFIX];
+            s64 length = Min(node->prefix_length, MAX_PREFIX);
+
+            memcpy(prefix, node->prefix, length);
+            if (length < MAX_PREFIX)  prefix[length++] = byte;
+            memcpy(prefix + length, c->prefix, Min(c->prefix_length, MAX_PREFIX - length));
+
+            c->prefix_length += node->prefix_length + 1;
+            memcpy(c->prefix, prefix, MAX_PREFIX);
+        }
+
+        *ref = child;
+        dealloc(node, tree->context);
+        return;
+    }
+
+    // Shrink the node when it's well under the capacity of the next size down, so it doesn't flip back and forth.
+    static s64 const shrink_below[] = {0, 3, 12, 37};
+
+    if (node->count < shrink_below[node->type])  *ref = resize_node(tree, node, node->type-1);
+}
+
+static bool delete(Any_radix_tree *tree, void **ref, Byte_slice key, s64 depth)
+// Delete the key from below the node at *ref. Return true if it was there.
+{
+    Radix_node *node = *ref;
+
+    if (!prefix_might_match(node, key, depth))  return false;
+    depth += node->prefix_length;
+
+    Radix_leaf *leaf;
+
+    if (depth == key.size) {
+        leaf = node->leaf;
+        if (!leaf || !leaf_matches(leaf, key))  return false;
+
+        node->leaf = NULL;
+    } else {
+        void **child = find_child(node, key.data[depth]);
+        if (!child)  return false;
+
+        if (!is_leaf(*child))  return delete(tree, child, key, depth+1);
+
+        leaf = get_leaf(*child);
+        if (!leaf_matches(leaf, key))  return false;
+
+        remove_child(node, key.data[depth]);
+    }
+
+    dealloc(leaf, tree->context);
+    tree->count -= 1;
+
+    tidy_node(tree, ref);
+
+    return true;
+}
+
+bool radix_delete(Any_radix_tree *tree, u64 val_size)
+// Delete the key in tree->key. Return true if it was there.
+{
+    Byte_slice key = get_tree_key(tree);
+
+    if (!tree->root)  return false;
+
+    if (is_leaf(tree->root)) {
+        Radix_leaf *leaf = get_leaf(tree->root);
+        if (!leaf_matches(leaf, key))  return false;
+
+        dealloc(leaf, tree->context);
+        tree->root   = NULL;
+        tree->count -= 1;
+        return true;
+    }
+
+    return delete(tree, &tree->root, key, 0);
+}
+
+//
+// Cursors. To move on from a key, we look for the smallest key after it, starting from the root. That way a cursor
+// doesn't need a stack, and it's fine to add keys while you're using one.
+//
+
+static Radix_leaf *find_at_least(void *ref, Byte_slice key, s64 depth, bool after)
+// Return the leaf with the smallest key below ref that's greater than the given key or, unless after is true, equal
+// to it. depth bytes of the key have been used up on the way to ref. Return NULL if there's no such key.
+{
+    if (!ref)  return NULL;
+
+    if (is_leaf(ref)) {
+        int c = compare_keys(get_leaf(ref)->key, key);
+        return (c > 0 || (c == 0 && !after)) ? get_leaf(ref) : NULL;
+    }
+
+    Radix_node *node = ref;
+
+    if (node->prefix_length) {
+        s64 length = Min(node->prefix_length, key.size - depth);
+        int c      = memcmp(get_full_prefix(node, depth), key.data + depth, length);
+
+        if (c < 0)  return NULL;                                     // Every key below the node is smaller.
+        if (c > 0 || length < node->prefix_length)  return get_min_leaf(node); // Every key below the node is bigger.
+
+        depth += node->prefix_length;
+    }
+
+    if (depth == key.size) {
+        // The node's own key is this key. Its children's keys are longer, so they're all bigger.
+        if (node->leaf && !after)  return node->leaf;
+
+        s64 position = 0;
+        u8  byte;
+        void *child = get_child_at(node, &position, &byte);
+        return child ? get_min_leaf(child) : NULL;
+    }
+
+    // The node's own key is shorter, so it's smaller. Try the child on the key's path, then the next child after it.
+    u8 byte = key.data[depth];
+
+    void **child = find_child(node, byte);
+    if (child) {
+        Radix_leaf *leaf = find_at_least(*child, key, depth+1, after);
+        if (leaf)  return leaf;
+    }
+
+    void *next = get_first_child_after(node, byte);
+    return next ? get_min_leaf(next) : NULL;
+}
+
+static void point_cursor_at(Any_radix_cursor *cursor, Radix_leaf *leaf)
+{
+    s64  length    = cursor->prefix.size;
+    bool in_prefix = leaf && leaf->key.size >= length && (!length || !memcmp(leaf->key.data, cursor->prefix.data, length));
+
+    cursor->key = in_prefix ? &leaf->key : NULL;
+    cursor->val = in_prefix ? get_leaf_val(leaf) : NULL;
+}
+
+void radix_first_with_prefix(Any_radix_tree *tree, u64 val_size, Any_radix_cursor *cursor)
+// Point the cursor at the first key that starts with the prefix in tree->key.
+{
+    cursor->prefix = get_tree_key(tree);
+
+    point_cursor_at(cursor, find_at_least(tree->root, cursor->prefix, 0, false));
+}
+
+void radix_next(Any_radix_tree *tree, u64 val_size, Any_radix_cursor *cursor)
+{
+    if (!cursor->key)  return;
+
+    Radix_leaf *leaf = (Radix_leaf *)cursor->key; // The cursor points at the leaf's .key, which is its first member.
+
+    point_cursor_at(cursor, find_at_least(tree->root, leaf->key, 0, true));
+}
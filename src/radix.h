@@ -0,0 +1,129 @@
+#ifndef RADIX_H_INCLUDED
+#define RADIX_H_INCLUDED
+
+#include "map.h"
+
+//
+// A RadixTree maps strings, or byte strings, to values like a Dict or SliceMap does, but it keeps the keys in order and
+// can find them by prefix. It's an adaptive radix tree (ART): each inner node branches on one byte of the key, and comes
+// in four sizes, Node4, Node16, Node48 and Node256, growing and shrinking with the number of children it has. A chain
+// of nodes with one child each is collapsed into a prefix on the node below, so the tree's depth depends on where keys
+// differ rather than how long they are.
+//
+//     RadixTree(char *, int) *routes = NewRadixTree(routes, ctx);
+//     *RadixSet(routes, "/api/") = 1;
+//     *RadixSet(routes, "/api/users/") = 2;
+//
+//     int *route = RadixLongestPrefix(routes, "/api/users/42");  // Points to 2.
+//     int *exact = RadixGet(routes, "/api");  // Like *Get(), this points to a zeroed default value if it's not there.
+//
+//     // Visit every key starting with "/api/u", in order.
+//     RadixCursor(char *, int) cursor;
+//     for (RadixFirstWithPrefix(routes, "/api/u", &cursor); cursor.key; RadixNext(routes, &cursor)) {
+//         printf("%s: %d\n", *cursor.key, *cursor.val);
+//     }
+//
+// NewSliceRadixTree() makes a tree with Byte_slice keys, which can contain zeros: RadixTree(Byte_slice, int). Keys are
+// ordered byte by byte, with a key coming before any longer key that starts with it. For string keys that's strcmp()
+// order.
+//
+// Each key and its value live together in a leaf, which has its own copy of the key's bytes. Leaves never move, so a
+// pointer to a value stays good until its key is deleted. Nodes and leaves are allocated from the tree's context, so you
+// can drop a whole tree by freeing its context. A cursor keeps a pointer to the prefix you gave it, so the prefix must
+// stay around while you use the cursor. Don't delete the cursor's current key before moving past it.
+//
+// Node16 finds a child by comparing the key byte against all 16 of its keys at once, with the same SIMD code the maps
+// use to match control bytes. See ctrl.h.
+//
+// .key and .val are used for temporary storage by the macros. .default_val points to the value *RadixGet() returns if
+// the key isn't there.
+//
+
+#define RadixTree(KEY_TYPE, VAL_TYPE)   \
+    struct {                            \
+        void           *root;           \
+        s64             count;          \
+        Memory_context *context;        \
+        bool            slice_mode;     \
+        KEY_TYPE       *key;            \
+        VAL_TYPE       *val;            \
+        VAL_TYPE       *default_val;    \
+    }
+
+#define RadixCursor(KEY_TYPE, VAL_TYPE) \
+    struct {                            \
+        KEY_TYPE   *key;  /* NULL when there are no more keys with the prefix. */ \
+        VAL_TYPE   *val;                \
+        Byte_slice  prefix;             \
+    }
+
+typedef RadixTree(void, void)   Any_radix_tree;
+typedef RadixCursor(void, void) Any_radix_cursor;
+
+void init_radix_tree_if_needed(Any_radix_tree *tree, u64 val_size);
+void radix_get(Any_radix_tree *tree, u64 val_size);
+void radix_set(Any_radix_tree *tree, u64 val_size);
+bool radix_delete(Any_radix_tree *tree, u64 val_size);
+void radix_longest_prefix(Any_radix_tree *tree, u64 val_size);
+void radix_first_with_prefix(Any_radix_tree *tree, u64 val_size, Any_radix_cursor *cursor);
+void radix_next(Any_radix_tree *tree, u64 val_size, Any_radix_cursor *cursor);
+
+#define NewRadixTree(TREE, CONTEXT) \
+    ((TREE) = zero_alloc(1, sizeof(*TREE), (CONTEXT)), \
+     (TREE)->context = (CONTEXT), \
+     (TREE))
+
+#define NewSliceRadixTree(TREE, CONTEXT) \
+    ((TREE) = zero_alloc(1, sizeof(*TREE), (CONTEXT)), \
+     (TREE)->context = (CONTEXT), \
+     (TREE)->slice_mode = true, \
+     (TREE))
+
+#define RadixGet(TREE, KEY) \
+    (EnterAllocSite(), \
+     init_radix_tree_if_needed((Any_radix_tree *)(TREE), sizeof(*(TREE)->val)), \
+     LeaveAllocSite(), \
+     *(TREE)->key = (KEY), \
+     radix_get((Any_radix_tree *)(TREE), sizeof(*(TREE)->val)), \
+     (TREE)->val)
+
+#define RadixIsSet(TREE, KEY) \
+    (RadixGet((TREE), (KEY)) != (TREE)->default_val)
+
+#define RadixSet(TREE, KEY) \
+    (EnterAllocSite(), \
+     init_radix_tree_if_needed((Any_radix_tree *)(TREE), sizeof(*(TREE)->val)), \
+     *(TREE)->key = (KEY), \
+     radix_set((Any_radix_tree *)(TREE), sizeof(*(TREE)->val)), \
+     LeaveAllocSite(), \
+     (TREE)->val)
+
+#define RadixDelete(TREE, KEY) \
+    (EnterAllocSite(), \
+     init_radix_tree_if_needed((Any_radix_tree *)(TREE), sizeof(*(TREE)->val)), \
+     LeaveAllocSite(), \
+     *(TREE)->key = (KEY), \
+     radix_delete((Any_radix_tree *)(TREE), sizeof(*(TREE)->val)))
+
+// Return a pointer to the value of the longest key that KEY starts with, or to the default value if there isn't one.
+#define RadixLongestPrefix(TREE, KEY) \
+    (EnterAllocSite(), \
+     init_radix_tree_if_needed((Any_radix_tree *)(TREE), sizeof(*(TREE)->val)), \
+     LeaveAllocSite(), \
+     *(TREE)->key = (KEY), \
+     radix_longest_prefix((Any_radix_tree *)(TREE), sizeof(*(TREE)->val)), \
+     (TREE)->val)
+
+// Point the cursor at the first key that starts with PREFIX. Use an empty prefix to visit every key.
+#define RadixFirstWithPrefix(TREE, PREFIX, CURSOR) \
+    (EnterAllocSite(), \
+     init_radix_tree_if_needed((Any_radix_tree *)(TREE), sizeof(*(TREE)->val)), \
+     LeaveAllocSite(), \
+     *(TREE)->key = (PREFIX), \
+     (void)(1 ? (CURSOR)->key : (TREE)->key), (void)(1 ? (CURSOR)->val : (TREE)->val), \
+     radix_first_with_prefix((Any_radix_tree *)(TREE), sizeof(*(TREE)->val), (Any_radix_cursor *)(CURSOR)))
+
+#define RadixNext(TREE, CURSOR) \
+    radix_next((Any_radix_tree *)(TREE), sizeof(*(TREE)->val), (Any_radix_cursor *)(CURSOR))
+
+#endif // RADIX_H_INCLUDED
@@ -0,0 +1,141 @@
+#include "../array.h"
+#include "../btree.h"
+
+static u64 next_random(u64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+int main()
+{
+    Memory_context *ctx = new_context(NULL);
+
+    s64 num_keys = 20000;
+
+    {
+        // Add and delete random keys, checking against a plain array of which keys are present.
+        BTree(s64, s64) *tree = NewBTree(tree, compare_s64, ctx);
+
+        bool *present = New(num_keys, bool, ctx);
+        s64   count   = 0;
+        u64   state   = 1;
+
+        for (s64 t = 0; t < 5*num_keys; t++) {
+            s64 key = next_random(&state) % num_keys;
+
+            if (!present[key]) {
+                assert(!BTreeIsSet(tree, key));
+                *BTreeSet(tree, key) = 3*key;
+                present[key] = true;
+                count += 1;
+            } else if (next_random(&state) % 4 == 0) {
+                assert(BTreeDelete(tree, key));
+                assert(!BTreeDelete(tree, key));
+                present[key] = false;
+                count -= 1;
+            } else {
+                assert(*BTreeGet(tree, key) == 3*key);
+            }
+            assert(tree->count == count);
+        }
+        assert(tree->height > 2);
+
+        // The keys come out in order.
+        BTreeCursor(s64, s64) cursor;
+        s64 expected = -1;
+
+        for (BTreeFirst(tree, &cursor); cursor.key; BTreeNext(tree, &cursor)) {
+            do expected += 1; while (!present[expected]);
+            assert(*cursor.key == expected && *cursor.val == 3*expected);
+        }
+        do expected += 1; while (expected < num_keys && !present[expected]);
+        assert(expected == num_keys);
+
+        // Range scans start at the first key that's not less than the bound.
+        for (s64 low = -5; low < num_keys + 5; low += 97) {
+            BTreeLowerBound(tree, low, &cursor);
+
+            s64 first = Max(low, 0);
+            while (first < num_keys && !present[first])  first += 1;
+
+            if (first == num_keys)  assert(!cursor.key);
+            else                    assert(*cursor.key == first);
+        }
+
+        // Delete everything. The cursors still work on a tree full of empty leaves.
+        for (s64 key = 0; key < num_keys; key++) {
+            if (present[key])  assert(BTreeDelete(tree, key));
+        }
+        assert(tree->count == 0);
+        BTreeFirst(tree, &cursor);
+        assert(!cursor.key);
+        BTreeLowerBound(tree, 0, &cursor);
+        assert(!cursor.key);
+        assert(*BTreeGet(tree, 5) == 0);
+    }
+
+    {
+        // Bulk load from sorted arrays, then keep adding to the tree.
+        s64_array keys = {.context = ctx};
+        s64_array vals = {.context = ctx};
+
+        for (s64 i = 0; i < num_keys; i++) {
+            *Add(&keys) = 2*i;
+            *Add(&vals) = i;
+        }
+
+        BTree(s64, s64) *tree = NewBTree(tree, compare_s64, ctx);
+        BTreeBuildFromArrays(tree, keys.data, vals.data, keys.count);
+
+        assert(tree->count == num_keys);
+        for (s64 i = 0; i < num_keys; i++)  assert(*BTreeGet(tree, 2*i) == i && !BTreeIsSet(tree, 2*i+1));
+
+        for (s64 i = 0; i < num_keys; i++)  *BTreeSet(tree, 2*i+1) = -i;
+
+        BTreeCursor(s64, s64) cursor;
+        s64 expected = 0;
+        for (BTreeFirst(tree, &cursor); cursor.key; BTreeNext(tree, &cursor)) {
+            assert(*cursor.key == expected);
+            assert(*cursor.val == ((expected % 2) ? -(expected/2) : expected/2));
+            expected += 1;
+        }
+        assert(expected == 2*num_keys);
+
+        // Building an empty tree is fine too.
+        BTree(s64, s64) *empty = NewBTree(empty, compare_s64, ctx);
+        BTreeBuildFromArrays(empty, keys.data, vals.data, 0);
+        BTreeFirst(empty, &cursor);
+        assert(!cursor.key);
+    }
+
+    {
+        // String keys, and big values so there are only a few pairs per leaf.
+        typedef struct {char text[100];} Big;
+
+        BTree(char *, Big) *tree = NewBTree(tree, compare_strings, ctx);
+
+        char **names = New(1000, char *, ctx);
+        for (s64 i = 0; i < 1000; i++) {
+            names[i] = alloc(16, sizeof(char), ctx);
+            snprintf(names[i], 16, "name %04d", (int)i);
+        }
+
+        for (s64 i = 999; i >= 0; i--)  strcpy(BTreeSet(tree, names[i])->text, names[i]);
+
+        BTreeCursor(char *, Big) cursor;
+        s64 i = 500;
+        for (BTreeLowerBound(tree, "name 0500", &cursor); cursor.key; BTreeNext(tree, &cursor)) {
+            assert(!strcmp(*cursor.key, names[i]) && !strcmp(cursor.val->text, names[i]));
+            i += 1;
+        }
+        assert(i == 1000);
+    }
+
+    check_context_integrity(ctx);
+    free_context(ctx);
+
+    return 0;
+}
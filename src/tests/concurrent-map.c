@@ -0,0 +1,129 @@
+#include "../concurrent.h"
+#include "../array.h"
+
+//
+// Writer threads set and delete keys while reader threads look them up. The value for key k is always value_for(k), so
+// a reader that finds a key can check it got the whole value and not a torn or stale one.
+//
+
+enum {
+    NUM_KEYS    = 1 << 14,
+    NUM_WRITERS = 2,
+    NUM_READERS = 3,
+};
+
+typedef struct {u64 a, b, c;} Value;
+
+typedef ConcurrentMap(u64, Value) Test_map;
+
+static Value value_for(u64 key)
+{
+    return (Value){key, ~key, key * 0x9e3779b97f4a7c15};
+}
+
+static void *writer_routine(void *arg)
+{
+    Test_map *map = arg;
+
+    // Each writer owns every NUM_WRITERS-th key. It adds them all, then deletes and re-adds every other one.
+    static s64 next_writer = 0;
+    s64 writer = AtomicAdd(&next_writer, 1);
+
+    for (u64 k = writer; k < NUM_KEYS; k += NUM_WRITERS) {
+        Value val = value_for(k);
+        ConcurrentSet(map, &k, &val);
+    }
+
+    for (u64 k = writer; k < NUM_KEYS; k += 2*NUM_WRITERS) {
+        assert(ConcurrentDelete(map, &k));
+        assert(!ConcurrentDelete(map, &k));
+
+        Value val = value_for(k);
+        ConcurrentSet(map, &k, &val);
+    }
+
+    return NULL;
+}
+
+static void *reader_routine(void *arg)
+{
+    Test_map *map = arg;
+
+    s64 num_found = 0;
+
+    for (s64 loop = 0; loop < 8; loop++) {
+        for (u64 k = 0; k < NUM_KEYS; k++) {
+            Value val;
+            if (ConcurrentGet(map, &k, &val)) {
+                Value expected = value_for(k);
+                assert(!memcmp(&val, &expected, sizeof(Value)));
+                num_found += 1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int main()
+{
+    Memory_context *ctx = new_context(NULL);
+
+    {
+        Test_map *map = NewConcurrentMap(map, 8, ctx);
+
+        Array(pthread_t) threads = {.context = ctx};
+
+        for (int i = 0; i < NUM_WRITERS; i++) {
+            if (pthread_create(Add(&threads), NULL, writer_routine, map))  Fatal("Failed to create a thread.");
+        }
+        for (int i = 0; i < NUM_READERS; i++) {
+            if (pthread_create(Add(&threads), NULL, reader_routine, map))  Fatal("Failed to create a thread.");
+        }
+        for (s64 i = 0; i < threads.count; i++) {
+            if (pthread_join(threads.data[i], NULL))  Fatal("Failed to join a thread.");
+        }
+
+        // Now that the writers are done, every key should be there.
+        s64 total = 0;
+        for (s64 i = 0; i < map->num_shards; i++)  total += map->shards[i].map.count;
+        assert(total == NUM_KEYS);
+
+        for (u64 k = 0; k < NUM_KEYS; k++) {
+            Value val;
+            assert(ConcurrentGet(map, &k, &val));
+            assert(val.a == k && val.b == ~k);
+        }
+
+        u64 missing = NUM_KEYS;
+        Value val;
+        assert(!ConcurrentGet(map, &missing, &val));
+
+        free_concurrent_map((Any_concurrent_map *)map);
+    }
+
+    {
+        // Dicts copy their keys, like normal dicts.
+        ConcurrentMap(char *, int) *dict = NewConcurrentDict(dict, 4, ctx);
+
+        char key[] = "apple";
+        char *k = key;
+        int val = 1;
+        ConcurrentSet(dict, &k, &val);
+
+        key[0] = 'x';
+        int found = 0;
+        assert(!ConcurrentGet(dict, &k, &found));
+
+        char *apple = "apple";
+        assert(ConcurrentGet(dict, &apple, &found) && found == 1);
+        assert(ConcurrentDelete(dict, &apple));
+        assert(!ConcurrentGet(dict, &apple, &found));
+
+        free_concurrent_map((Any_concurrent_map *)dict);
+    }
+
+    free_context(ctx);
+
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "../context.h"
+
+bool free_the_cache(Memory_context *context, u64 size, void *data)
+// A memory pressure callback that frees a sibling context we're using as a cache.
+{
+    Memory_context **cache = data;
+
+    if (!*cache)  return false;
+
+    free_context(*cache);
+    *cache = NULL;
+
+    return true;
+}
+
+int main()
+{
+    Memory_context *top = new_context(NULL);
+
+    {
+        // A context never takes more than its budget from its parent.
+        Memory_context *ctx = new_context(top);
+
+        u64 budget = 64*1024;
+        set_context_budget(ctx, budget);
+
+        s64 num_allocs = 0;
+        while (try_alloc(1, 1000, ctx))  num_allocs += 1;
+
+        assert(num_allocs > 0);
+        assert(ctx->buffer_bytes <= budget);
+        check_context_integrity(ctx);
+
+        // Smaller allocations might still fit in the gaps.
+        assert(try_alloc(1, 1000, ctx) == NULL);
+
+        // Raising the budget lets the context grow again.
+        set_context_budget(ctx, 2*budget);
+        assert(try_alloc(1, 1000, ctx));
+        assert(ctx->buffer_bytes <= 2*budget);
+        check_context_integrity(ctx);
+
+        free_context(ctx);
+    }
+
+    {
+        // try_resize() leaves the data alone when it fails.
+        Memory_context *ctx = new_context(top);
+        set_context_budget(ctx, 8*1024);
+
+        char *data = alloc(100, sizeof(char), ctx);
+        memset(data, 'x', 100);
+
+        assert(try_resize(data, 1024*1024, sizeof(char), ctx) == NULL);
+        for (int i = 0; i < 100; i++)  assert(data[i] == 'x');
+
+        char *resized = try_resize(data, 200, sizeof(char), ctx);
+        assert(resized);
+        for (int i = 0; i < 100; i++)  assert(resized[i] == 'x');
+
+        check_context_integrity(ctx);
+        free_context(ctx);
+    }
+
+    {
+        // A budget covers a context's descendants, and the pressure callback can make room.
+        Memory_context *parent = new_context(top);
+        set_context_budget(parent, 1024*1024);
+
+        Memory_context *cache = new_context(parent);
+        alloc(1, 300*1024, cache);
+
+        Memory_context *work = new_context(parent);
+        assert(try_alloc(1, 300*1024, work) == NULL);
+
+        set_memory_pressure_callback(parent, free_the_cache, &cache);
+        assert(try_alloc(1, 300*1024, work));
+        assert(cache == NULL);
+
+        check_context_integrity(parent);
+        free_context(parent);
+    }
+
+    {
+        // Raising a budget in small steps gives a context lots of small buffers, more than free_context() can hand
+        // back to the parent in one batch.
+        Memory_context *ctx = new_context(top);
+
+        u64 budget = 64*1024;
+        set_context_budget(ctx, budget);
+        while (try_alloc(1, 1000, ctx));
+
+        for (int i = 0; i < 300; i++) {
+            budget += 1024;
+            set_context_budget(ctx, budget);
+            while (try_alloc(1, 1000, ctx));
+        }
+        assert(ctx->buffer_count > 300);
+        check_context_integrity(ctx);
+
+        free_context(ctx);
+        check_context_integrity(top);
+        for (s64 i = 0; i < top->used_count; i++)  assert(top->used_blocks[i].size == 0); // Only sentinels are left.
+    }
+
+    {
+        // trim_context() gives back buffers with nothing in them.
+        Memory_context *ctx = new_context(top);
+
+        void *small = alloc(1, 100, ctx);
+        void *big   = alloc(1, 1024*1024, ctx);
+        assert(ctx->buffer_count >= 2);
+
+        dealloc(big, ctx);
+        u64 before = ctx->buffer_bytes;
+        u64 trimmed = trim_context(ctx);
+        assert(trimmed >= 1024*1024);
+        assert(ctx->buffer_bytes == before - trimmed);
+        check_context_integrity(ctx);
+
+        dealloc(small, ctx);
+        trim_context(ctx);
+        assert(ctx->buffer_count == 0);
+        assert(ctx->buffer_bytes == 0);
+        check_context_integrity(ctx);
+
+        // The context still works after being trimmed.
+        assert(alloc(1, 100, ctx));
+        check_context_integrity(ctx);
+
+        free_context(ctx);
+    }
+
+    check_context_integrity(top);
+    free_context(top);
+
+    return 0;
+}
@@ -7,6 +7,23 @@ float randf()
     return (float)rand()/(float)RAND_MAX;
 }
 
+bool is_owned_by_child(Memory_context *context, void *data)
+// Contexts keep track of their children, so we mustn't free or move the memory that child contexts are made of.
+{
+    for (Memory_context *child = context->first_child; child; child = child->next_sibling) {
+        if (data == child)               return true;
+        if (data == child->buffers)      return true;
+        if (data == child->free_blocks)  return true;
+        if (data == child->used_blocks)  return true;
+
+        for (s64 i = 0; i < child->buffer_count; i++) {
+            if (data == child->buffers[i].data)  return true;
+        }
+    }
+
+    return false;
+}
+
 void *random_alloc(Memory_context *context)
 {
     if (!context->used_count)  return NULL;
@@ -17,6 +34,8 @@ void *random_alloc(Memory_context *context)
 
     if (!block->size)  return NULL;
 
+    if (is_owned_by_child(context, block->data))  return NULL;
+
     return block->data;
 }
 
@@ -109,5 +128,63 @@ int main()
     while (ctx->parent)  ctx = ctx->parent;
     free_context(ctx);
 
+    //
+    // Free a whole subtree at once and make sure the top of the tree gets all its memory back.
+    //
+    {
+        Memory_context *top = new_context(NULL);
+        Memory_context *mid = new_context(top);
+
+        for (int i = 0; i < 20; i++) {
+            Memory_context *child = new_context(mid);
+            for (int j = 0; j < 50; j++)  alloc(rand() % 1000 + 1, 1, child);
+
+            Memory_context *grandchild = new_context(child);
+            for (int j = 0; j < 50; j++)  alloc(rand() % 1000 + 1, 1, grandchild);
+        }
+        check_context_integrity(mid);
+        check_context_integrity(top);
+
+        free_context(mid);
+        check_context_integrity(top);
+
+        assert(top->first_child == NULL);
+        for (s64 i = 0; i < top->used_count; i++)  assert(top->used_blocks[i].size == 0); // Only sentinels are left.
+
+        free_context(top);
+    }
+
+    //
+    // Free children whose blocks are mixed up with the parent's own, some next to free gaps and some not, so that
+    // release_blocks() has runs of blocks to coalesce and stale free blocks to drop.
+    //
+    {
+        Memory_context *top = new_context(NULL);
+
+        Memory_context *children[40];
+        void           *blocks[40];
+
+        for (int i = 0; i < countof(children); i++) {
+            children[i] = new_context(top);
+            for (int j = 0; j < 30; j++)  alloc(rand() % 2000 + 1, 1, children[i]);
+            blocks[i] = alloc(rand() % 500 + 1, 1, top);
+        }
+        for (int i = 0; i < countof(blocks); i += 3)  dealloc(blocks[i], top);
+        check_context_integrity(top);
+
+        for (int i = 0; i < countof(children); i++) {
+            int j = rand() % countof(children);
+            Memory_context *child = children[i];
+            children[i] = children[j];
+            children[j] = child;
+        }
+        for (int i = 0; i < countof(children); i++) {
+            free_context(children[i]);
+            check_context_integrity(top);
+        }
+
+        free_context(top);
+    }
+
     return 0;
 }
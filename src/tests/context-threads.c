@@ -43,7 +43,7 @@ void *thread_routine(void *arg)
 
         // Make a random number of deallocations.
         while (randf() < 0.5) {
-            pthread_mutex_lock(&ctx->mutex);
+            lock_context(ctx);
 
             u8 *rand_data = random_alloc(ctx);
 
@@ -58,7 +58,7 @@ void *thread_routine(void *arg)
                 if (can_delete)  rand_data[0] = 0;
             }
 
-            pthread_mutex_unlock(&ctx->mutex);
+            unlock_context(ctx);
 
             if (can_delete)  dealloc(rand_data, ctx);
         }
@@ -78,7 +78,12 @@ int main()
 
     Memory_context_array contexts = {.context = top_context};
     for (int i = 0; i < num_contexts; i++) {
-        *Add(&contexts) = new_context(top_context);
+        Memory_context *ctx = new_context(top_context);
+
+        // Test both kinds of lock.
+        if (i % 2)  set_context_lock_kind(ctx, LOCK_ADAPTIVE);
+
+        *Add(&contexts) = ctx;
     }
 
     Array(pthread_t) threads = {.context = top_context};
@@ -0,0 +1,53 @@
+#include "../intern.h"
+
+int main()
+{
+    Memory_context *ctx = new_context(NULL);
+
+    String_pool *pool = new_string_pool(ctx);
+
+    // The same string gives the same pointer, however it gets there.
+    char buffer[] = "apples and pears";
+
+    char *apple = intern_string(pool, "apple");
+    assert(!strcmp(apple, "apple"));
+    assert(apple != buffer);
+    assert(intern(pool, buffer, 5) == apple);
+    assert(intern(pool, buffer, 6) != apple);
+    assert(!strcmp(intern(pool, buffer, 6), "apples"));
+
+    // The empty string is a string too.
+    assert(intern(pool, buffer, 0) == intern_string(pool, ""));
+
+    // Intern lots of strings so the pool grows, then check we still get the same pointers back.
+    s64 num_strings = 10000;
+    char **interned = New(num_strings, char *, ctx);
+    char   key[32];
+
+    for (s64 i = 0; i < num_strings; i++) {
+        snprintf(key, sizeof(key), "string %d", (int)i);
+        interned[i] = intern_string(pool, key);
+    }
+    assert(pool->count == num_strings + 3);
+
+    for (s64 i = 0; i < num_strings; i++) {
+        snprintf(key, sizeof(key), "string %d", (int)i);
+        assert(intern_string(pool, key) == interned[i]);
+    }
+    assert(intern_string(pool, "apple") == apple);
+
+    // Interned strings work as binary map keys.
+    Map(char *, s64) *map = NewMap(map, ctx);
+    for (s64 i = 0; i < num_strings; i++)  *Set(map, interned[i]) = i;
+
+    for (s64 i = 0; i < num_strings; i++) {
+        snprintf(key, sizeof(key), "string %d", (int)i);
+        assert(*Get(map, intern_string(pool, key)) == i);
+    }
+    assert(!IsSet(map, apple));
+
+    check_context_integrity(ctx);
+    free_context(ctx);
+
+    return 0;
+}
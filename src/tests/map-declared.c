@@ -0,0 +1,49 @@
+#include "../map.h"
+
+DeclareMap(Id_map, u64, s64, hash_int, IntsEqual)
+
+int main()
+{
+    Memory_context *ctx = new_context(NULL);
+
+    Id_map map = {.context = ctx, .binary_mode = true};
+
+    assert(!Id_map_is_set(&map, 1));
+    assert(*Id_map_get(&map, 1) == 0);
+
+    // Mirror everything we do in a generic map, and check the two agree.
+    Map(u64, s64) *check = NewMap(check, ctx);
+
+    s64 num_keys = 30000;
+    u64 random   = 1;
+
+    for (s64 t = 0; t < 8*num_keys; t++) {
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+
+        u64 key = (random % num_keys) << 20; // Keys with lots of zero low bits.
+
+        if (IsSet(check, key)) {
+            assert(*Id_map_get(&map, key) == *Get(check, key));
+
+            if (random & 0x100) {
+                assert(Id_map_delete(&map, key) == true);
+                assert(Id_map_delete(&map, key) == false);
+                Delete(check, key);
+            }
+        } else {
+            assert(!Id_map_is_set(&map, key));
+            *Id_map_set(&map, key) = t;
+            *Set(check, key) = t;
+        }
+
+        assert(map.count == check->count);
+    }
+
+    for (s64 i = 0; i < map.count; i++)  assert(*Get(check, map.keys[i]) == map.vals[i]);
+
+    free_context(ctx);
+
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include "../mapfile.h"
+
+static void write_at(char *path, u64 offset, void *data, u64 size)
+// Overwrite part of a file.
+{
+    FILE *file = fopen(path, "r+b");
+    assert(file);
+    assert(fseek(file, offset, SEEK_SET) == 0);
+    assert(fwrite(data, 1, size, file) == size);
+    fclose(file);
+}
+
+static Map_file_header read_header(char *path)
+{
+    Map_file_header header;
+
+    FILE *file = fopen(path, "rb");
+    assert(file);
+    assert(fread(&header, sizeof(header), 1, file) == 1);
+    fclose(file);
+
+    return header;
+}
+
+int main()
+{
+    Memory_context *ctx = new_context(NULL);
+
+    char *path = "map-file-test.map";
+
+    {
+        // A binary map with some deleted keys and a non-zero default.
+        Map(u64, s64) *map = NewMap(map, ctx);
+        SetDefault(map, -1);
+
+        s64 num_keys = 50000;
+        for (s64 i = 0; i < num_keys; i++)  *Set(map, (u64)i * 0x9e3779b97f4a7c15) = i;
+        for (s64 i = 0; i < num_keys; i += 3)  Delete(map, (u64)i * 0x9e3779b97f4a7c15);
+
+        assert(SaveMap(map, path));
+
+        Map_file(u64, s64) *file = OpenMapFile(file, path, ctx);
+        assert(file);
+        assert(file->count == map->count);
+
+        for (s64 i = 0; i < num_keys; i++) {
+            u64 key = (u64)i * 0x9e3779b97f4a7c15;
+
+            if (i % 3)  assert(*MapFileGet(file, &key) == i);
+            else        assert(!MapFileIsSet(file, &key) && *MapFileGet(file, &key) == -1);
+        }
+
+        close_map_file(file);
+
+        // The sizes of the keys and values have to match.
+        Map_file(u32, s64) *wrong = OpenMapFile(wrong, path, ctx);
+        assert(!wrong);
+    }
+
+    {
+        // A dict with incremental resizing, saved in the middle of a resize.
+        Dict(int) *dict = NewDict(dict, ctx);
+        dict->incremental_resize = true;
+
+        char key[32];
+        s64 num_keys = 1000;
+        for (s64 i = 0; i < num_keys; i++) {
+            snprintf(key, sizeof(key), "key %d", (int)i);
+            *Set(dict, key) = i;
+        }
+
+        assert(SaveMap(dict, path));
+        assert(!dict->old_buckets);
+
+        Map_file(char *, int) *file = OpenMapFile(file, path, ctx);
+        assert(file);
+        assert(file->keys == NULL);
+
+        for (s64 i = 0; i < num_keys; i++) {
+            snprintf(key, sizeof(key), "key %d", (int)i);
+            char *k = key;
+            assert(*MapFileGet(file, &k) == i);
+        }
+
+        char *missing = "key";
+        assert(!MapFileIsSet(file, &missing));
+
+        close_map_file(file);
+    }
+
+    {
+        // A slice map, including an empty key.
+        SliceMap(int) *map = NewSliceMap(map, ctx);
+
+        u8 bytes[] = {'a', 0, 'b'};
+        *Set(map, Slice(bytes, 0)) = 10;
+        *Set(map, Slice(bytes, 2)) = 12;
+
+        assert(SaveMap(map, path));
+
+        Map_file(Byte_slice, int) *file = OpenMapFile(file, path, ctx);
+        assert(file);
+
+        Byte_slice keys[] = {Slice(bytes, 0), Slice(bytes, 1), Slice(bytes, 2)};
+        assert(*MapFileGet(file, &keys[0]) == 10);
+        assert(!MapFileIsSet(file, &keys[1]));
+        assert(*MapFileGet(file, &keys[2]) == 12);
+
+        close_map_file(file);
+    }
+
+    {
+        // Corrupted files fail to open instead of crashing lookups.
+        Dict(int) *dict = NewDict(dict, ctx);
+        *Set(dict, "apple") = 1;
+        *Set(dict, "banana") = 2;
+
+        char *apple = "apple";
+        Map_file(char *, int) *file;
+
+        assert(SaveMap(dict, path));
+        Map_file_header header = read_header(path);
+
+        // A key offset past the end of the key bytes.
+        u64 offset = 1000000;
+        write_at(path, header.key_offsets_offset + sizeof(u64), &offset, sizeof(offset));
+        assert(!OpenMapFile(file, path, ctx));
+
+        // A key too long to fit.
+        assert(SaveMap(dict, path));
+        s64 length = 100;
+        write_at(path, header.key_info_offset + offsetof(Key_info, length), &length, sizeof(length));
+        assert(!OpenMapFile(file, path, ctx));
+
+        // No empty buckets, so a lookup of a missing key would never stop.
+        assert(SaveMap(dict, path));
+        u8 full[GROUP_SIZE];
+        memset(full, 0x12, sizeof(full));
+        for (u64 i = 0; i < header.num_buckets; i += GROUP_SIZE)  write_at(path, header.ctrl_offset + i, full, sizeof(full));
+        write_at(path, header.ctrl_offset + header.num_buckets, full, GROUP_SIZE-1);
+        assert(!OpenMapFile(file, path, ctx));
+
+        // Offsets so big that adding the section sizes to them would overflow.
+        assert(SaveMap(dict, path));
+        u64 huge = UINT64_MAX - 15;
+        write_at(path, offsetof(Map_file_header, key_info_offset), &huge, sizeof(huge));
+        assert(!OpenMapFile(file, path, ctx));
+
+        // Buckets of the wrong width, as if written by a build with a different COMPACT_BUCKET_LIMIT.
+        assert(SaveMap(dict, path));
+        u64 bucket_size = 24 - header.bucket_size;
+        write_at(path, offsetof(Map_file_header, bucket_size), &bucket_size, sizeof(bucket_size));
+        assert(!OpenMapFile(file, path, ctx));
+
+        // A truncated file.
+        assert(SaveMap(dict, path));
+        u8   *bytes = alloc(header.file_size, 1, ctx);
+        FILE *copy  = fopen(path, "rb");
+        assert(copy && fread(bytes, 1, header.file_size, copy) == header.file_size);
+        fclose(copy);
+        copy = fopen(path, "wb");
+        assert(copy && fwrite(bytes, 1, header.file_size-1, copy) == header.file_size-1);
+        fclose(copy);
+        dealloc(bytes, ctx);
+        assert(!OpenMapFile(file, path, ctx));
+
+        // The original opens fine.
+        assert(SaveMap(dict, path));
+        assert(OpenMapFile(file, path, ctx));
+        assert(*MapFileGet(file, &apple) == 1);
+        close_map_file(file);
+    }
+
+    remove(path);
+
+    check_context_integrity(ctx);
+    free_context(ctx);
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "../frozen.h"
+
+int main()
+{
+    Memory_context *ctx = new_context(NULL);
+
+    {
+        // A binary map with some deleted keys and a non-zero default.
+        Map(u64, s64) *map = NewMap(map, ctx);
+        SetDefault(map, -1);
+
+        s64 num_keys = 100000;
+        for (s64 i = 0; i < num_keys; i++)  *Set(map, (u64)i * 0x9e3779b97f4a7c15) = i;
+        for (s64 i = 0; i < num_keys; i += 3)  Delete(map, (u64)i * 0x9e3779b97f4a7c15);
+
+        FrozenMap(u64, s64) *frozen = FreezeMap(frozen, map, ctx);
+        assert(frozen->count == map->count);
+
+        for (s64 i = 0; i < num_keys; i++) {
+            u64 key = (u64)i * 0x9e3779b97f4a7c15;
+
+            if (i % 3)  assert(*FrozenGet(frozen, &key) == i);
+            else        assert(!FrozenIsSet(frozen, &key) && *FrozenGet(frozen, &key) == -1);
+        }
+
+        // Every slot holds a key that maps back to it.
+        for (s64 i = 0; i < frozen->count; i++)  assert(FrozenGet(frozen, &frozen->keys[i]) == &frozen->vals[i]);
+    }
+
+    {
+        // A dict keeps its own copy of the keys, so we can free the original.
+        Memory_context *dict_ctx = new_context(ctx);
+
+        Dict(int) *dict = NewDict(dict, dict_ctx);
+        dict->pack_keys = true;
+
+        *Set(dict, "apple")  = 1;
+        *Set(dict, "banana") = 2;
+        *Set(dict, "")       = 3;
+
+        FrozenMap(char *, int) *frozen = FreezeMap(frozen, dict, ctx);
+        free_context(dict_ctx);
+
+        char *keys[] = {"apple", "banana", "", "cherry", "appl"};
+        assert(*FrozenGet(frozen, &keys[0]) == 1);
+        assert(*FrozenGet(frozen, &keys[1]) == 2);
+        assert(*FrozenGet(frozen, &keys[2]) == 3);
+        assert(!FrozenIsSet(frozen, &keys[3]));
+        assert(!FrozenIsSet(frozen, &keys[4]));
+    }
+
+    {
+        // Slice maps, including an empty slice.
+        SliceMap(int) *map = NewSliceMap(map, ctx);
+
+        u8 bytes[] = {'a', 0, 'b'};
+        *Set(map, Slice(bytes, 0)) = 10;
+        *Set(map, Slice(bytes, 2)) = 12;
+        *Set(map, Slice(bytes, 3)) = 13;
+
+        FrozenMap(Byte_slice, int) *frozen = FreezeMap(frozen, map, ctx);
+
+        Byte_slice keys[] = {Slice(bytes, 0), Slice(bytes, 1), Slice(bytes, 2), Slice(bytes, 3)};
+        assert(*FrozenGet(frozen, &keys[0]) == 10);
+        assert(!FrozenIsSet(frozen, &keys[1]));
+        assert(*FrozenGet(frozen, &keys[2]) == 12);
+        assert(*FrozenGet(frozen, &keys[3]) == 13);
+
+        Byte_slice empty = Slice(NULL, 0);
+        assert(*FrozenGet(frozen, &empty) == 10);
+    }
+
+    {
+        // Freezing an empty map works too.
+        Map(int, int) *map = NewMap(map, ctx);
+        FrozenMap(int, int) *frozen = FreezeMap(frozen, map, ctx);
+
+        int key = 1;
+        assert(frozen->count == 0);
+        assert(!FrozenIsSet(frozen, &key));
+        assert(*FrozenGet(frozen, &key) == 0);
+    }
+
+    check_context_integrity(ctx);
+    free_context(ctx);
+
+    return 0;
+}
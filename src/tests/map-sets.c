@@ -0,0 +1,129 @@
+#include "../map.h"
+
+int main()
+{
+    Memory_context *ctx = new_context(NULL);
+
+    {
+        HashSet(u64) *set = NewHashSet(set, ctx);
+
+        assert(SetAdd(set, 1) == true);
+        assert(SetAdd(set, 2) == true);
+        assert(SetAdd(set, 1) == false);
+        assert(set->count == 2);
+
+        assert(SetContains(set, 1));
+        assert(!SetContains(set, 3));
+
+        assert(SetRemove(set, 1) == true);
+        assert(SetRemove(set, 1) == false);
+        assert(!SetContains(set, 1));
+        assert(set->count == 1 && set->keys[0] == 2);
+    }
+
+    {
+        // Multiples of 2 and multiples of 3, up to 3000.
+        s64 n = 3000;
+
+        HashSet(u64) *twos   = NewHashSet(twos, ctx);
+        HashSet(u64) *threes = NewHashSet(threes, ctx);
+        for (u64 i = 0; i < n; i += 2)  SetAdd(twos, i);
+        for (u64 i = 0; i < n; i += 3)  SetAdd(threes, i);
+
+        HashSet(u64) *both = NewHashSet(both, ctx);
+        SetUnion(both, twos);
+        SetIntersect(both, threes);
+
+        HashSet(u64) *either = NewHashSet(either, ctx);
+        SetUnion(either, twos);
+        SetUnion(either, threes);
+
+        HashSet(u64) *only_twos = NewHashSet(only_twos, ctx);
+        SetUnion(only_twos, twos);
+        SetDifference(only_twos, threes);
+
+        for (u64 i = 0; i < n; i++) {
+            assert(SetContains(both, i)      == (i%2 == 0 && i%3 == 0));
+            assert(SetContains(either, i)    == (i%2 == 0 || i%3 == 0));
+            assert(SetContains(only_twos, i) == (i%2 == 0 && i%3 != 0));
+        }
+        assert(both->count == n/6);
+
+        // Taking away a bigger set goes the other way round.
+        HashSet(u64) *few = NewHashSet(few, ctx);
+        SetAdd(few, 0);
+        SetAdd(few, 1);
+        SetAdd(few, 2);
+        SetDifference(few, either);
+        assert(few->count == 1 && SetContains(few, 1));
+    }
+
+    {
+        // Maps with values. Deleting keys moves values around, and growing the map moves them all.
+        s64 n = 3000;
+
+        Map(u64, s64) *squares = NewMap(squares, ctx);
+        Map(u64, s64) *negs    = NewMap(negs, ctx);
+        HashSet(u64)  *evens   = NewHashSet(evens, ctx);
+        for (u64 i = 0; i < n; i += 3)  *Set(squares, i) = i*i;
+        for (u64 i = 0; i < n; i += 5)  *Set(negs, i) = -(s64)i;
+        for (u64 i = 0; i < n; i += 2)  SetAdd(evens, i);
+
+        MapUnion(squares, negs);
+        for (u64 i = 0; i < n; i++) {
+            if (i%5 == 0)       assert(*Get(squares, i) == -(s64)i);
+            else if (i%3 == 0)  assert(*Get(squares, i) == i*i);
+            else                assert(!IsSet(squares, i));
+        }
+
+        MapDifference(squares, evens);
+        MapIntersect(negs, evens);
+        for (u64 i = 0; i < n; i++) {
+            if (i%2 == 0)       assert(!IsSet(squares, i));
+            else if (i%5 == 0)  assert(*Get(squares, i) == -(s64)i);
+            else if (i%3 == 0)  assert(*Get(squares, i) == i*i);
+            else                assert(!IsSet(squares, i));
+
+            if (i%2 == 0 && i%5 == 0)  assert(*Get(negs, i) == -(s64)i);
+            else                       assert(!IsSet(negs, i));
+        }
+
+        Dict(int) *ages  = NewDict(ages, ctx);
+        Dict(int) *other = NewDict(other, ctx);
+        *Set(ages, "alice") = 30;
+        *Set(ages, "bob") = 40;
+        *Set(other, "bob") = 41;
+        *Set(other, "carol") = 50;
+        MapUnion(ages, other);
+        assert(ages->count == 3 && *Get(ages, "alice") == 30 && *Get(ages, "bob") == 41 && *Get(ages, "carol") == 50);
+        MapDifference(ages, other);
+        assert(ages->count == 1 && *Get(ages, "alice") == 30);
+    }
+
+    {
+        // String sets copy their keys.
+        StringSet *names = NewStringSet(names, ctx);
+        StringSet *other = NewStringSet(other, ctx);
+
+        char buffer[] = "alice";
+        assert(SetAdd(names, buffer));
+        buffer[0] = 'A';
+        assert(SetContains(names, "alice"));
+        assert(!SetContains(names, "Alice"));
+
+        SetAdd(names, "bob");
+        SetAdd(names, "carol");
+        SetAdd(other, "bob");
+        SetAdd(other, "dave");
+
+        SetIntersect(names, other);
+        assert(names->count == 1 && !strcmp(names->keys[0], "bob"));
+
+        assert(SetRemove(names, "bob"));
+        assert(names->count == 0);
+    }
+
+    free_context(ctx);
+
+    return 0;
+}
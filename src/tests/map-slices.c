@@ -0,0 +1,57 @@
+#include "../map.h"
+
+int main()
+{
+    Memory_context *ctx = new_context(NULL);
+
+    SliceMap(int) *map = NewSliceMap(map, ctx);
+
+    // Keys can contain zeros, and keys that are prefixes of each other are different keys.
+    u8 bytes[] = {'a', 0, 'b', 0, 0, 'c'};
+
+    *Set(map, Slice(bytes, 0)) = 10;
+    *Set(map, Slice(bytes, 1)) = 11;
+    *Set(map, Slice(bytes, 2)) = 12;
+    *Set(map, Slice(bytes, 6)) = 16;
+
+    assert(map->count == 4);
+    assert(*Get(map, Slice(bytes, 0)) == 10);
+    assert(*Get(map, Slice(bytes, 1)) == 11);
+    assert(*Get(map, Slice(bytes, 2)) == 12);
+    assert(*Get(map, Slice(bytes, 6)) == 16);
+    assert(!IsSet(map, Slice(bytes, 3)));
+
+    // The map keeps its own copy of the bytes.
+    bytes[0] = 'z';
+    assert(!IsSet(map, Slice(bytes, 2)));
+    bytes[0] = 'a';
+    assert(*Get(map, Slice(bytes, 2)) == 12);
+    assert(map->keys[2].data != bytes);
+
+    assert(Delete(map, Slice(bytes, 1)) == true);
+    assert(Delete(map, Slice(bytes, 1)) == false);
+    assert(!IsSet(map, Slice(bytes, 1)));
+    assert(*Get(map, Slice(bytes, 6)) == 16);
+
+    // Lots of keys of different lengths, so the map grows and deletions move things around. Each key is between 8 and
+    // 16 bytes, and the first 8 bytes are different for every key.
+    {
+        s64 num_keys = 20000;
+
+        u64 *numbers = New(2*num_keys, u64, ctx);
+        for (s64 i = 0; i < 2*num_keys; i++)  numbers[i] = i * 0x9e3779b97f4a7c15;
+
+        for (s64 i = 0; i < num_keys; i++)  *Set(map, Slice(&numbers[2*i], 8 + i%9)) = i;
+
+        for (s64 i = 0; i < num_keys; i += 2)  assert(Delete(map, Slice(&numbers[2*i], 8 + i%9)));
+
+        for (s64 i = 0; i < num_keys; i++) {
+            if (i % 2)  assert(*Get(map, Slice(&numbers[2*i], 8 + i%9)) == i);
+            else        assert(!IsSet(map, Slice(&numbers[2*i], 8 + i%9)));
+        }
+    }
+
+    free_context(ctx);
+
+    return 0;
+}
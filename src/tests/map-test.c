@@ -35,48 +35,163 @@ int main()
         key_data[i] = rand_char;
     }
 
-    Dict(u32) *dict = NewDict(dict, ctx);
-
-    for (s64 t = 0; t < num_tests; t++) {
-        s64 index = rand() % max_key_len;
-        char *key = &key_data[index];
-        u32 value;  memcpy(&value, key, sizeof(value));
-
-        if (!added[index] || deleted[index]) {
-            // The key shouldn't be in the dict.
-            assert(Get(dict, key) == &dict->vals[-1]);
-            assert(*Get(dict, key) == 0);
-
-            // Add the key.
-            *Set(dict, key) = value;
-            assert(*Get(dict, key) == value);
-            added[index] = true;
-            deleted[index] = false;
-        } else {
-            // The key should be in the dict.
-            assert(*Get(dict, key) == value);
-
-            // Sometimes just move on.
-            if (randf() < 0.5)  continue;
-
-            // Otherwise delete the key.
-            s64 old_count = dict->count;
-            if (randf() < 0.25) {
-                // Copy the key to a temporary buffer and do some operations with the copied key so
-                // we know that it's the contents of the string that matters.
-                strcpy(tmp, key);
-                *Set(dict, tmp) = 5;
-                assert(*Get(dict, key) == 5);
-                assert(Delete(dict, tmp) == true);
-                assert(*Get(dict, tmp) == 0);
-                assert(Delete(dict, tmp) == false);
+    // We run the test once for each way a dict can store its keys: copied, borrowed and packed into an arena. The last
+    // dict also has a Bloom filter.
+    for (int key_mode = 0; key_mode < 3; key_mode++) {
+        Dict(u32) *dict = NewDict(dict, ctx);
+        dict->borrow_keys        = (key_mode == 1);
+        dict->pack_keys          = (key_mode == 2);
+        dict->bloom_bits_per_key = (key_mode == 2) ? 10 : 0;
+
+        memset(added,   0, max_key_len*sizeof(bool));
+        memset(deleted, 0, max_key_len*sizeof(bool));
+
+        for (s64 t = 0; t < num_tests; t++) {
+            s64 index = rand() % max_key_len;
+            char *key = &key_data[index];
+            u32 value;  memcpy(&value, key, sizeof(value));
+
+            if (!added[index] || deleted[index]) {
+                // The key shouldn't be in the dict.
+                assert(Get(dict, key) == &dict->vals[-1]);
+                assert(*Get(dict, key) == 0);
+
+                // Add the key.
+                *Set(dict, key) = value;
+                assert(*Get(dict, key) == value);
+                added[index] = true;
+                deleted[index] = false;
             } else {
-                assert(Delete(dict, key) == true);
+                // The key should be in the dict.
+                assert(*Get(dict, key) == value);
+
+                // Sometimes just move on.
+                if (randf() < 0.5)  continue;
+
+                // Otherwise delete the key.
+                s64 old_count = dict->count;
+                if (randf() < 0.25) {
+                    // Copy the key to a temporary buffer and do some operations with the copied key so
+                    // we know that it's the contents of the string that matters.
+                    strcpy(tmp, key);
+                    *Set(dict, tmp) = 5;
+                    assert(*Get(dict, key) == 5);
+                    assert(Delete(dict, tmp) == true);
+                    assert(*Get(dict, tmp) == 0);
+                    assert(Delete(dict, tmp) == false);
+                } else {
+                    assert(Delete(dict, key) == true);
+                }
+                assert(dict->count == old_count-1);
+                assert(*Get(dict, key) == 0);
+                assert(Delete(dict, key) == false);
+                deleted[index] = true;
             }
-            assert(dict->count == old_count-1);
-            assert(*Get(dict, key) == 0);
-            assert(Delete(dict, key) == false);
-            deleted[index] = true;
+        }
+    }
+
+    // Now do the same kind of thing with a binary map with lots of keys, so that the hash table grows many times
+    // and deletions have to move plenty of buckets around. We do it with each way of resizing, with and without Robin Hood,
+    // and with and without a Bloom filter.
+    for (int mode = 0; mode < 8; mode++) {
+        s64 num_keys = 50000;
+
+        Map(u64, s64) *map = NewMap(map, ctx);
+        map->incremental_resize = mode & 1;
+        map->robin_hood         = mode & 2;
+        map->bloom_bits_per_key = (mode & 4) ? 10 : 0;
+        bool *present = New(num_keys, bool, ctx);
+
+        for (s64 t = 0; t < 4*num_keys; t++) {
+            s64 n   = rand() % num_keys;
+            u64 key = n * 0x9e3779b97f4a7c15; // Spread the keys out a bit.
+
+            if (!present[n]) {
+                assert(!IsSet(map, key));
+                *Set(map, key) = n;
+                present[n] = true;
+            } else if (randf() < 0.4) {
+                assert(Delete(map, key) == true);
+                assert(!IsSet(map, key));
+                present[n] = false;
+            } else {
+                assert(*Get(map, key) == n);
+            }
+        }
+
+        s64 num_present = 0;
+        for (s64 n = 0; n < num_keys; n++) {
+            u64 key = n * 0x9e3779b97f4a7c15;
+            if (present[n]) {
+                assert(*Get(map, key) == n);
+                num_present += 1;
+            } else {
+                assert(!IsSet(map, key));
+            }
+        }
+        assert(map->count == num_present);
+
+        for (s64 i = 0; i < map->count; i++)  assert(map->vals[i]*0x9e3779b97f4a7c15 == map->keys[i]);
+
+        Map_stats stats = MapStats(map);
+        s64 histogram_total = 0;
+        for (s64 i = 0; i < MAP_STATS_HISTOGRAM_SIZE; i++)  histogram_total += stats.histogram[i];
+        assert(histogram_total == map->count);
+        assert(stats.max_probe_length < map->num_buckets);
+        assert(0 < stats.load_factor && stats.load_factor <= 0.75);
+
+        // Check that GetMany() and SetMany() agree with Get() and Set().
+        u64 *keys = New(num_keys, u64, ctx);
+        s64 *vals = New(num_keys, s64, ctx);
+        for (s64 n = 0; n < num_keys; n++)  keys[n] = n * 0x9e3779b97f4a7c15;
+
+        GetMany(map, keys, num_keys, vals);
+        for (s64 n = 0; n < num_keys; n++)  assert(vals[n] == (present[n] ? n : 0));
+
+        for (s64 n = 0; n < num_keys; n++)  vals[n] = -n;
+        SetMany(map, keys, num_keys, vals);
+        assert(map->count == num_keys);
+        for (s64 n = 0; n < num_keys; n++)  assert(*Get(map, keys[n]) == -n);
+
+        // Deleting most of the keys shrinks the map, and MapShrinkToFit() shrinks it as far as it can go.
+        s64 peak_num_buckets = map->num_buckets;
+        for (s64 n = 100; n < num_keys; n++)  assert(Delete(map, keys[n]));
+        assert(map->num_buckets < peak_num_buckets/64);
+
+        MapShrinkToFit(map);
+        assert(map->num_buckets == 256);
+
+        for (s64 n = 0; n < num_keys; n++) {
+            if (n < 100)  assert(*Get(map, keys[n]) == -n);
+            else          assert(!IsSet(map, keys[n]));
+        }
+    }
+
+    {
+        // After MapReserve(), adding that many keys doesn't make the map grow.
+        s64 num_keys = 10000;
+
+        Map(u64, s64) *map = NewMap(map, ctx);
+        MapReserve(map, num_keys);
+
+        s64 num_buckets = map->num_buckets;
+        for (s64 n = 0; n < num_keys; n++)  *Set(map, n * 0x9e3779b97f4a7c15) = n;
+        assert(map->num_buckets == num_buckets);
+
+        // MapBuildFromArrays() works like SetMany(), so later duplicates win and existing keys are overwritten.
+        u64 *keys = New(2*num_keys, u64, ctx);
+        s64 *vals = New(2*num_keys, s64, ctx);
+        for (s64 i = 0; i < 2*num_keys; i++) {
+            keys[i] = (i % num_keys + num_keys/2) * 0x9e3779b97f4a7c15;
+            vals[i] = -i;
+        }
+
+        MapBuildFromArrays(map, keys, vals, 2*num_keys);
+        assert(map->count == num_keys + num_keys/2);
+
+        for (s64 n = 0; n < num_keys + num_keys/2; n++) {
+            s64 expected = (n < num_keys/2) ? n : -(n - num_keys/2 + num_keys);
+            assert(*Get(map, n * 0x9e3779b97f4a7c15) == expected);
         }
     }
 
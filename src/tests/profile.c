@@ -0,0 +1,59 @@
+#include "../context.h"
+
+//
+// This test needs the whole library built with -DPROFILING. The Makefile builds it that way as
+// bin/profiling/tests/profile. Built without profiling, it has nothing to check.
+//
+
+int main()
+{
+#ifdef PROFILING
+    // Sample every allocation, so that each sample's weight is exactly its size.
+    set_alloc_sample_interval(1);
+
+    Memory_context *ctx        = new_context(NULL);
+    Memory_context *child      = new_context(ctx);
+    Memory_context *grandchild = new_context(child);
+
+    char *a = alloc(100, 1, ctx);  int line_a = __LINE__;
+    assert(get_alloc_profile_bytes(ctx, __FILE__, line_a) == 100);
+    assert(get_alloc_profile_bytes(ctx, NULL, 0) == 100);
+
+    // This is too big for the child's first buffer. The new buffer comes from the parent, and the outermost call site
+    // gets the blame for it.
+    char *b = alloc(1<<20, 1, child);  int line_b = __LINE__;
+    assert(get_alloc_profile_bytes(child, __FILE__, line_b) == 1<<20);
+    assert(get_alloc_profile_bytes(ctx, __FILE__, line_b) >= 1<<20);
+    assert(get_alloc_profile_bytes(ctx, __FILE__, line_a) == 100);
+
+    char *c = alloc(70, 1, grandchild);  int line_c = __LINE__;
+    assert(get_alloc_profile_bytes(grandchild, __FILE__, line_c) == 70);
+
+    // A resize moves the sample to the new block and updates its size, whether or not the block moves.
+    a = resize(a, 120, 1, ctx);
+    assert(get_alloc_profile_bytes(ctx, __FILE__, line_a) == 120);
+    alloc(16, 1, ctx); // Make sure the next resize can't happen in place.
+    a = resize(a, 5000, 1, ctx);
+    assert(get_alloc_profile_bytes(ctx, __FILE__, line_a) == 5000);
+
+    // Deallocating forgets the sample.
+    dealloc(b, child);
+    assert(get_alloc_profile_bytes(child, __FILE__, line_b) == 0);
+    assert(get_alloc_profile_bytes(child, NULL, 0) == get_alloc_profile_bytes(child, __FILE__, line_c)); // The grandchild's buffer.
+
+    // Freeing the child forgets the samples in it and its descendants, and the parent forgets the child's buffers.
+    free_context(child);
+    assert(get_alloc_profile_bytes(grandchild, NULL, 0) == 0);
+    assert(get_alloc_profile_bytes(ctx, __FILE__, line_b) == 0);
+    assert(get_alloc_profile_bytes(ctx, __FILE__, line_c) == 0);
+    assert(get_alloc_profile_bytes(ctx, __FILE__, line_a) == 5000);
+
+    // So does resetting a context.
+    reset_context(ctx);
+    assert(get_alloc_profile_bytes(ctx, NULL, 0) == 0);
+
+    free_context(ctx);
+#endif
+
+    return 0;
+}
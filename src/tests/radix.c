@@ -0,0 +1,166 @@
+#include "../radix.h"
+
+static u64 next_random(u64 *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static char *random_key(u64 *state, Memory_context *ctx)
+// Short keys from a small alphabet, so that lots of them share prefixes and some are prefixes of others.
+{
+    s64   length = next_random(state) % 6;
+    char *key    = alloc(length+1, sizeof(char), ctx);
+
+    for (s64 i = 0; i < length; i++)  key[i] = "abc/"[next_random(state) % 4];
+    key[length] = '\0';
+
+    return key;
+}
+
+int main()
+{
+    Memory_context *ctx = new_context(NULL);
+
+    {
+        // Add and delete random keys, checking against a Dict.
+        RadixTree(char *, s64) *tree = NewRadixTree(tree, ctx);
+        Dict(s64) *dict = NewDict(dict, ctx);
+        u64 state = 1;
+
+        for (s64 t = 0; t < 20000; t++) {
+            char *key = random_key(&state, ctx);
+
+            if (!IsSet(dict, key)) {
+                assert(!RadixIsSet(tree, key));
+                *RadixSet(tree, key) = t;
+                *Set(dict, key) = t;
+            } else if (next_random(&state) % 3 == 0) {
+                assert(RadixDelete(tree, key));
+                assert(!RadixDelete(tree, key));
+                Delete(dict, key);
+            } else {
+                assert(*RadixGet(tree, key) == *Get(dict, key));
+            }
+            assert(tree->count == dict->count);
+        }
+
+        // Every key comes out once, in strcmp() order, and the prefix scans find exactly the keys with the prefix.
+        char *prefixes[] = {"", "a", "ab", "c/", "/b/a", "abcab", "abcabc", "z"};
+
+        for (s64 p = 0; p < countof(prefixes); p++) {
+            char *prefix   = prefixes[p];
+            s64   count    = 0;
+            char *previous = NULL;
+
+            RadixCursor(char *, s64) cursor;
+            for (RadixFirstWithPrefix(tree, prefix, &cursor); cursor.key; RadixNext(tree, &cursor)) {
+                assert(!strncmp(*cursor.key, prefix, strlen(prefix)));
+                assert(*cursor.val == *Get(dict, *cursor.key));
+                assert(!previous || strcmp(previous, *cursor.key) < 0);
+                previous = *cursor.key;
+                count += 1;
+            }
+
+            s64 expected = 0;
+            for (s64 i = 0; i < dict->count; i++)  expected += !strncmp(dict->keys[i], prefix, strlen(prefix));
+            assert(count == expected);
+        }
+
+        // Delete everything.
+        while (dict->count) {
+            char *key = dict->keys[0];
+            assert(RadixDelete(tree, key));
+            Delete(dict, key);
+        }
+        assert(tree->count == 0 && !tree->root);
+    }
+
+    {
+        // Longest prefix matching, with prefixes longer than the nodes keep inline.
+        RadixTree(char *, int) *routes = NewRadixTree(routes, ctx);
+        *RadixSet(routes, "/") = 1;
+        *RadixSet(routes, "/api/") = 2;
+        *RadixSet(routes, "/api/users/") = 3;
+        *RadixSet(routes, "/api/users/settings/notifications/") = 4;
+        *RadixSet(routes, "/api/users/settings/notifications/email") = 5;
+
+        assert(*RadixLongestPrefix(routes, "/index.html") == 1);
+        assert(*RadixLongestPrefix(routes, "/api") == 1);
+        assert(*RadixLongestPrefix(routes, "/api/") == 2);
+        assert(*RadixLongestPrefix(routes, "/api/users/42") == 3);
+        assert(*RadixLongestPrefix(routes, "/api/users/settings/notifications/sms") == 4);
+        assert(*RadixLongestPrefix(routes, "/api/users/settings/notifications/email/daily") == 5);
+        assert(*RadixLongestPrefix(routes, "/api/users/settings/notificationz/") == 3);
+        assert(*RadixLongestPrefix(routes, "") == 0);
+        assert(*RadixLongestPrefix(routes, "api") == 0);
+
+        // Splitting a long prefix, then joining it back together.
+        *RadixSet(routes, "/api/users/settings/mail") = 6;
+        assert(*RadixGet(routes, "/api/users/settings/notifications/email") == 5);
+        assert(RadixDelete(routes, "/api/users/settings/mail"));
+        assert(RadixDelete(routes, "/api/users/settings/notifications/"));
+        assert(*RadixLongestPrefix(routes, "/api/users/settings/notifications/sms") == 3);
+        assert(*RadixGet(routes, "/api/users/settings/notifications/email") == 5);
+        assert(!RadixIsSet(routes, "/api/users/settings/notifications/"));
+        assert(routes->count == 4);
+    }
+
+    {
+        // Byte slice keys, with zeros and the empty key. Nodes with lots of children grow to Node48 and Node256, then
+        // shrink back as their keys are deleted.
+        RadixTree(Byte_slice, s64) *tree = NewSliceRadixTree(tree, ctx);
+
+        u8 bytes[3] = {0};
+        *RadixSet(tree, Slice(NULL, 0)) = -1;
+        assert(*RadixGet(tree, Slice(bytes, 0)) == -1);
+
+        for (s64 n = 1; n <= 256; n++) {
+            bytes[0] = n-1;
+            *RadixSet(tree, Slice(bytes, 1)) = n;
+            *RadixSet(tree, Slice(bytes, 3)) = 1000+n;
+
+            for (s64 i = 0; i < n; i++) {
+                bytes[0] = i;
+                assert(*RadixGet(tree, Slice(bytes, 1)) == i+1);
+                assert(*RadixGet(tree, Slice(bytes, 3)) == 1000+i+1);
+                assert(!RadixIsSet(tree, Slice(bytes, 2)));
+            }
+        }
+        assert(tree->count == 1 + 2*256);
+        assert(*RadixGet(tree, Slice(bytes, 0)) == -1);
+
+        RadixCursor(Byte_slice, s64) cursor;
+        s64 count = 0;
+        for (RadixFirstWithPrefix(tree, Slice(NULL, 0), &cursor); cursor.key; RadixNext(tree, &cursor)) {
+            // The empty key first, then each byte followed by the longer key that starts with it.
+            if (count == 0)  assert(cursor.key->size == 0);
+            else             assert(cursor.key->data[0] == (count-1)/2 && cursor.key->size == ((count % 2) ? 1 : 3));
+            count += 1;
+        }
+        assert(count == tree->count);
+
+        for (s64 n = 256; n > 0; n--) {
+            bytes[0] = n-1;
+            assert(RadixDelete(tree, Slice(bytes, 1)));
+            assert(*RadixGet(tree, Slice(bytes, 3)) == 1000+n);
+            assert(RadixDelete(tree, Slice(bytes, 3)));
+
+            for (s64 i = 0; i < n-1; i++) {
+                bytes[0] = i;
+                assert(*RadixGet(tree, Slice(bytes, 1)) == i+1);
+            }
+        }
+        assert(tree->count == 1 && *RadixGet(tree, Slice(NULL, 0)) == -1);
+        assert(*RadixLongestPrefix(tree, Slice(NULL, 0)) == -1);
+        assert(RadixDelete(tree, Slice(bytes, 0)));
+        assert(!tree->root);
+    }
+
+    check_context_integrity(ctx);
+    free_context(ctx);
+
+    return 0;
+}
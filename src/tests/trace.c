@@ -0,0 +1,289 @@
+// We turn tracing on for this file so that TraceEvent() records events even if the library was built without it.
+#ifndef TRACING
+  #define TRACING
+#endif
+
+#include <pthread.h>
+
+#include "../context.h"
+#include "../trace.h"
+
+//
+// A small JSON parser, just enough to check that write_chrome_trace() writes valid JSON and to pull out the fields of
+// each event. It returns false if the JSON is invalid.
+//
+
+typedef struct {
+    char *name;
+    s64   name_length;
+    s64   tid;
+    u64   arg;
+    bool  has_ts, has_dur, has_ph, has_pid, has_args;
+} Event;
+
+typedef struct {
+    Event *events;
+    s64    num_events;
+    s64    limit;
+} Parser;
+
+static void skip_space(char **p)
+{
+    while (**p == ' ' || **p == '\n' || **p == '\t' || **p == '\r')  *p += 1;
+}
+
+static bool parse_string(char **p, char **start, s64 *length)
+{
+    if (**p != '"')  return false;
+    *p += 1;
+    *start = *p;
+
+    while (**p != '"') {
+        if (!**p || **p == '\n')  return false;
+        if (**p == '\\')  *p += 1;
+        *p += 1;
+    }
+
+    *length = *p - *start;
+    *p += 1;
+
+    return true;
+}
+
+static bool parse_number(char **p, double *number)
+{
+    char *end;
+    *number = strtod(*p, &end);
+    if (end == *p)  return false;
+    *p = end;
+    return true;
+}
+
+static bool parse_value(Parser *parser, char **p, int depth);
+
+static bool parse_event(Parser *parser, char **p)
+// Parse an object in the traceEvents array.
+{
+    Event event = {0};
+
+    if (**p != '{')  return false;
+    *p += 1;
+
+    while (true) {
+        skip_space(p);
+
+        char *key;
+        s64   length;
+        if (!parse_string(p, &key, &length))  return false;
+        skip_space(p);
+        if (**p != ':')  return false;
+        *p += 1;
+        skip_space(p);
+
+        #define IsKey(NAME)  (length == strlen(NAME) && !strncmp(key, NAME, length))
+
+        double number;
+
+        if (IsKey("name")) {
+            if (!parse_string(p, &event.name, &event.name_length))  return false;
+        } else if (IsKey("tid")) {
+            if (!parse_number(p, &number))  return false;
+            event.tid = number;
+        } else if (IsKey("ts") || IsKey("dur")) {
+            if (!parse_number(p, &number) || number < 0)  return false;
+            if (IsKey("ts"))  event.has_ts = true;
+            else              event.has_dur = true;
+        } else if (IsKey("ph")) {
+            char *ph;
+            s64   ph_length;
+            if (!parse_string(p, &ph, &ph_length) || ph_length != 1 || *ph != 'X')  return false;
+            event.has_ph = true;
+        } else if (IsKey("pid")) {
+            if (!parse_number(p, &number))  return false;
+            event.has_pid = true;
+        } else if (IsKey("args")) {
+            // One argument, either a number or a hex string.
+            if (**p != '{')  return false;
+            *p += 1;
+            skip_space(p);
+            if (!parse_string(p, &key, &length))  return false;
+            if (**p != ':')  return false;
+            *p += 1;
+            if (**p == '"') {
+                char *hex;
+                if (!parse_string(p, &hex, &length))  return false;
+                event.arg = strtoull(hex, NULL, 16);
+            } else {
+                char *end;
+                event.arg = strtoull(*p, &end, 10);
+                if (end == *p)  return false;
+                *p = end;
+            }
+            if (**p != '}')  return false;
+            *p += 1;
+            event.has_args = true;
+        } else {
+            if (!parse_value(parser, p, 1))  return false;
+        }
+
+        #undef IsKey
+
+        skip_space(p);
+        if (**p == '}')  break;
+        if (**p != ',')  return false;
+        *p += 1;
+    }
+    *p += 1;
+
+    if (parser->num_events == parser->limit)  return false;
+    parser->events[parser->num_events++] = event;
+
+    return true;
+}
+
+static bool parse_value(Parser *parser, char **p, int depth)
+{
+    skip_space(p);
+
+    if (**p == '"') {
+        char *string;
+        s64   length;
+        return parse_string(p, &string, &length);
+    }
+
+    if (**p == '[') {
+        *p += 1;
+        skip_space(p);
+        if (**p == ']') {
+            *p += 1;
+            return true;
+        }
+        while (true) {
+            skip_space(p);
+            bool ok = (depth == 1) ? parse_event(parser, p) : parse_value(parser, p, depth+1);
+            if (!ok)  return false;
+            skip_space(p);
+            if (**p == ']')  break;
+            if (**p != ',')  return false;
+            *p += 1;
+        }
+        *p += 1;
+        return true;
+    }
+
+    if (**p == '{') {
+        *p += 1;
+        while (true) {
+            skip_space(p);
+            char *key;
+            s64   length;
+            if (!parse_string(p, &key, &length))  return false;
+            skip_space(p);
+            if (**p != ':')  return false;
+            *p += 1;
+            if (!parse_value(parser, p, depth+1))  return false;
+            skip_space(p);
+            if (**p == '}')  break;
+            if (**p != ',')  return false;
+            *p += 1;
+        }
+        *p += 1;
+        return true;
+    }
+
+    double number;
+    return parse_number(p, &number);
+}
+
+enum {
+    NUM_WORKER_EVENTS = 70000,
+    RING_SIZE         = 1<<16,  // TRACE_BUFFER_LIMIT in trace.c.
+    WORKER_ARG        = 1000000000,
+};
+
+static void *worker(void *arg)
+// Record more events than the ring buffer holds, so the oldest get overwritten.
+{
+    for (s64 i = 0; i < NUM_WORKER_EVENTS; i++) {
+        u64 start = TraceTime();
+        TraceEvent(TRACE_GROW_CONTEXT, start, WORKER_ARG + i);
+    }
+
+    return NULL;
+}
+
+int main()
+{
+    Memory_context *ctx = new_context(NULL);
+
+    char *path = "trace-test.json";
+
+    u64 start = TraceTime();
+    TraceEvent(TRACE_LOCK_WAIT, start, 0xabcdef);
+    TraceEvent(TRACE_MAP_REHASH, start, 1024);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, worker, NULL);
+    pthread_join(thread, NULL);
+
+    assert(write_chrome_trace(path));
+
+    // Read the file back.
+    FILE *file = fopen(path, "rb");
+    assert(file);
+    fseek(file, 0, SEEK_END);
+    s64 size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *text = alloc(size+1, sizeof(char), ctx);
+    assert(fread(text, 1, size, file) == size);
+    text[size] = '\0';
+    fclose(file);
+    remove(path);
+
+    // Everything must parse, and every event needs all its fields. If the library was built with -DTRACING there will
+    // be events from the allocator too.
+    Parser parser = {.limit = 4*RING_SIZE};
+    parser.events = New(parser.limit, Event, ctx);
+
+    char *p = text;
+    assert(parse_value(&parser, &p, 0));
+    skip_space(&p);
+    assert(*p == '\0');
+
+    s64 main_tid        = -1;
+    s64 worker_tid      = -1;
+    s64 num_worker      = 0;
+    u64 next_worker_arg = WORKER_ARG + NUM_WORKER_EVENTS - RING_SIZE;
+    bool found_lock     = false;
+    bool found_rehash   = false;
+
+    for (s64 i = 0; i < parser.num_events; i++) {
+        Event *event = &parser.events[i];
+        assert(event->name && event->has_ph && event->has_pid && event->has_ts && event->has_dur && event->has_args);
+
+        if (event->name_length == strlen("lock wait") && !strncmp(event->name, "lock wait", event->name_length) && event->arg == 0xabcdef) {
+            found_lock = true;
+            main_tid   = event->tid;
+        }
+        if (event->name_length == strlen("map rehash") && !strncmp(event->name, "map rehash", event->name_length) && event->arg == 1024) {
+            found_rehash = true;
+        }
+        if (event->arg >= WORKER_ARG) {
+            // The worker's last RING_SIZE events, in order.
+            assert(!strncmp(event->name, "grow_context", event->name_length));
+            assert(event->arg == next_worker_arg);
+            next_worker_arg += 1;
+            worker_tid       = event->tid;
+            num_worker      += 1;
+        }
+    }
+
+    assert(found_lock && found_rehash);
+    assert(num_worker == RING_SIZE);
+    assert(main_tid != worker_tid);
+
+    free_context(ctx);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <pthread.h>
+
+#include "trace.h"
+
+typedef struct Trace_event  Trace_event;
+typedef struct Trace_buffer Trace_buffer;
+
+struct Trace_event {
+    u64 start; // Nanoseconds.
+    u64 end;
+    u64 arg;
+    u8  kind;
+};
+
+struct Trace_buffer {
+    Trace_event  *events;
+    s64           count;  // The total number of events ever added. The ring buffer holds the last TRACE_BUFFER_LIMIT.
+    int           thread_id;
+    Trace_buffer *next;
+};
+
+enum {TRACE_BUFFER_LIMIT = 1<<16}; // Must be a power of two.
+
+static char *trace_names[] = {
+    [TRACE_LOCK_WAIT]    = "lock wait",
+    [TRACE_LOCK_HOLD]    = "lock hold",
+    [TRACE_GROW_CONTEXT] = "grow_context",
+    [TRACE_RESIZE_MOVE]  = "resize (moved)",
+    [TRACE_MAP_REHASH]   = "map rehash",
+};
+
+static char *trace_arg_names[] = {
+    [TRACE_LOCK_WAIT]    = "context",
+    [TRACE_LOCK_HOLD]    = "context",
+    [TRACE_GROW_CONTEXT] = "bytes",
+    [TRACE_RESIZE_MOVE]  = "bytes_copied",
+    [TRACE_MAP_REHASH]   = "num_buckets",
+};
+
+// Every thread's buffer is kept on this list so write_chrome_trace() can find them. The mutex is only taken when a
+// thread records its first event and when writing the trace.
+static Trace_buffer    *all_trace_buffers;
+static int              num_trace_threads;
+static pthread_mutex_t  trace_buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static thread_local Trace_buffer *thread_trace_buffer;
+
+void add_trace_event(Trace_kind kind, u64 start, u64 end, u64 arg)
+{
+    assert(0 <= kind && kind < TRACE_KIND_COUNT);
+
+    Trace_buffer *buffer = thread_trace_buffer;
+
+    if (!buffer) {
+        // This is the thread's first event. We don't allocate the buffer from a context because we trace the contexts.
+        buffer = calloc(1, sizeof(Trace_buffer));
+        if (buffer)  buffer->events = calloc(TRACE_BUFFER_LIMIT, sizeof(Trace_event));
+        if (!buffer || !buffer->events)  Fatal("Couldn't allocate a trace buffer.");
+
+        pthread_mutex_lock(&trace_buffers_mutex);
+        buffer->thread_id = ++num_trace_threads;
+        buffer->next      = all_trace_buffers;
+        all_trace_buffers = buffer;
+        pthread_mutex_unlock(&trace_buffers_mutex);
+
+        thread_trace_buffer = buffer;
+    }
+
+    Trace_event *event = &buffer->events[buffer->count & (TRACE_BUFFER_LIMIT-1)];
+
+    event->start = start;
+    event->end   = end;
+    event->arg   = arg;
+    event->kind  = kind;
+
+    buffer->count += 1;
+}
+
+bool write_chrome_trace(char *path)
+// Write every thread's events to a file in the Chrome trace event format. Return false if the file couldn't be written.
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        log_error("Couldn't open %s for writing.", path);
+        return false;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    bool first = true;
+
+    pthread_mutex_lock(&trace_buffers_mutex);
+
+    for (Trace_buffer *buffer = all_trace_buffers; buffer; buffer = buffer->next) {
+        s64 num_events = Min(buffer->count, TRACE_BUFFER_LIMIT);
+
+        for (s64 i = buffer->count - num_events; i < buffer->count; i++) {
+            Trace_event *event = &buffer->events[i & (TRACE_BUFFER_LIMIT-1)];
+
+            // Timestamps are in microseconds.
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,",
+                    first ? "" : ",\n", trace_names[event->kind], buffer->thread_id, event->start/1000.0, (event->end - event->start)/1000.0);
+
+            if (event->kind == TRACE_LOCK_WAIT || event->kind == TRACE_LOCK_HOLD) {
+                fprintf(file, "\"args\":{\"%s\":\"0x%llx\"}}", trace_arg_names[event->kind], (unsigned long long)event->arg);
+            } else {
+                fprintf(file, "\"args\":{\"%s\":%llu}}", trace_arg_names[event->kind], (unsigned long long)event->arg);
+            }
+
+            first = false;
+        }
+    }
+
+    pthread_mutex_unlock(&trace_buffers_mutex);
+
+    fprintf(file, "\n]}\n");
+
+    bool ok = !ferror(file);
+    if (fclose(file))  ok = false;
+
+    return ok;
+}
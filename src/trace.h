@@ -0,0 +1,41 @@
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include "basic.h"
+
+//
+// Tracing for the allocator and maps. Compile with -DTRACING to record events; otherwise the macros below compile to
+// nothing. Each thread records events into its own ring buffer, so recording an event doesn't take any locks. When the
+// ring buffer is full, the oldest events are overwritten.
+//
+// Call write_chrome_trace() to dump the events in the Chrome trace format, which you can load in chrome://tracing or
+// https://ui.perfetto.dev. Do this while the other threads are quiet, since we don't synchronise with them.
+//
+//     u64 start = TraceTime();
+//     ...
+//     TraceEvent(TRACE_GROW_CONTEXT, start, buffer_size);
+//
+
+enum Trace_kind {
+    TRACE_LOCK_WAIT,     // Waiting to acquire a lock. The argument is the lock's address, which is also its context's.
+    TRACE_LOCK_HOLD,     // Holding a lock. The argument is the lock's address, which is also its context's.
+    TRACE_GROW_CONTEXT,  // Adding a buffer to a context. The argument is the size of the buffer.
+    TRACE_RESIZE_MOVE,   // A resize() that couldn't happen in place. The argument is the number of bytes copied.
+    TRACE_MAP_REHASH,    // Rehashing a map's buckets. The argument is the new number of buckets.
+    TRACE_KIND_COUNT,
+};
+
+typedef enum Trace_kind Trace_kind;
+
+#ifdef TRACING
+  #define TraceTime()                     get_time_ns()
+  #define TraceEvent(KIND, START, ARG)    add_trace_event((KIND), (START), get_time_ns(), (u64)(ARG))
+#else
+  #define TraceTime()                     ((u64)0)
+  #define TraceEvent(KIND, START, ARG)    ((void)0)
+#endif
+
+void add_trace_event(Trace_kind kind, u64 start, u64 end, u64 arg);
+bool write_chrome_trace(char *path);
+
+#endif // TRACE_H_INCLUDED